@@ -841,6 +841,32 @@ void endpoint_set_accesss(ENDPOINT* endpoint, const char* subject);
  */
 void endpoint_reset_accesss(ENDPOINT* endpoint, const char* subject);
 
+/**
+ * @brief Set how the messages sent on an endpoint are validated against its schema.
+ *
+ * @param endpoint
+ *		Endpoint for which to set the policy.
+ *
+ * @param policy
+ *		"always", "sampled" (1 in @p sample messages) or "trusted" (never;
+ *		the schema hashes matched at map).
+ *
+ * @param sample
+ *		N for "sampled"; 0 for the default from core_config.
+ */
+void endpoint_set_validation(ENDPOINT* endpoint, const char* policy, int sample);
+
+/**
+ * @brief Return the validation counters of an endpoint.
+ *
+ * @param endpoint
+ *		Endpoint for which to get the counters.
+ *
+ * @return JSON string with "validated", "validation_failed" and
+ *		"validation_skipped"; to be freed by the caller.
+ */
+char* endpoint_get_stats(ENDPOINT* endpoint);
+
 /**
  * @brief Return a JSON description of the endpoint.
  *
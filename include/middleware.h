@@ -9,6 +9,12 @@
 
 #include <stdbool.h>
 
+/* app-core ipc transports for mw_init */
+#define MW_IPC_FIFO     0
+#define MW_IPC_SOCKPAIR 1
+#define MW_IPC_SHM      2
+#define MW_IPC_EMBEDDED 3
+
 /**
  * @brief Initialise values and communication threads, spawn the core layer in
  * another process and connect to it. Call this before using any other library functions.
@@ -19,14 +25,17 @@
  * @param log_level
  *		Log-level of the middleware, based on [slog log levels](https://github.com/kala13x/slog).
  *
- * @param use_socketpair
- *		false - Port is used.
- *		true  - Creates a pair of local UNIX sockets for IPC, and port is ignored.
+ * @param ipc
+ *		MW_IPC_FIFO     (false) - Named pipes are used.
+ *		MW_IPC_SOCKPAIR (true)  - Creates a pair of local UNIX sockets for IPC.
+ *		MW_IPC_SHM              - Shared-memory rings with eventfd wake ups (Linux).
+ *		MW_IPC_EMBEDDED         - No core process: the core library runs in this
+ *		                          process and calls are plain function calls.
  *
  * @return Address of the (running) middleware instance.
  *
  */
-char* mw_init(const char* app_name, int log_level, bool use_socketpair);
+char* mw_init(const char* app_name, int log_level, int ipc);
 
 /**
  * @brief Gracefully terminate the connected core. If this is not called, the
@@ -8,6 +8,8 @@
 #ifndef COM_H_
 #define COM_H_
 
+#include <sys/uio.h> /* struct iovec */
+
 /*
  * listens NONBLOCK for connections as a server
  * returns server address
@@ -40,6 +42,16 @@ int com_send(int conn, const void *data, unsigned int size);
  */
 int com_send_data(int conn, const char *data);
 
+/*
+ * optional
+ * gather send: all buffers go out as one write, in order
+ * (no interleaving with other sends on the same connection)
+ * @conn: connection id / socket
+ * @iov, iovcnt: buffers to be transmitted
+ * @return: number of bytes sent
+ */
+int com_sendv(int conn, const struct iovec *iov, int iovcnt);
+
 
 /*
  * register a handler to be called at incoming data
@@ -72,6 +84,50 @@ int com_is_valid_address(const char* full_address);
 
 int com_is_bridge(void);
 
+/*
+ * optional
+ * @return 1 if any bytes, including '\0', reach on_data unchanged;
+ * needed for binary framing. 0 or not defined for text only transports.
+ */
+int com_is_binary_safe(void);
+
+/*
+ * optional
+ * how far the peers of this module are; used to rank modules when mapping
+ * @return COM_LOCALITY_HOST for same host transports (unix, shm),
+ * COM_LOCALITY_NET for direct network ones, COM_LOCALITY_BROKER when
+ * messages go through a broker. Not defined means COM_LOCALITY_NET.
+ */
+#ifndef COM_LOCALITY_HOST
+#define COM_LOCALITY_HOST	0
+#define COM_LOCALITY_NET	1
+#define COM_LOCALITY_BROKER	2
+#endif
+
+int com_get_locality(void);
+
+/*
+ * optional
+ * passes an open fd along with some data (local transports only)
+ * the receiver gets the data through on_data as usual
+ * @return: number of bytes sent
+ */
+int com_send_fd(int conn, int fd, const void *data, unsigned int size);
+
+/*
+ * optional
+ * @return the oldest fd received on conn and not claimed yet, -1 if none
+ */
+int com_recv_fd(int conn);
+
+/*
+ * optional
+ * called in the forked child before it execs the peer (the core):
+ * lets the fds the peer inherits survive the exec, the module keeps
+ * them close on exec otherwise
+ */
+int com_before_exec(void);
+
 void (*on_data_handler)(void*, int, const void*, unsigned int);
 void (*on_connect_handler)(void*, int);
 void (*on_disconnect_handler)(void*, int);
@@ -377,6 +377,11 @@ int com_is_bridge(void)
 	return 0;
 }
 
+int com_get_locality(void)
+{
+	return COM_LOCALITY_BROKER;
+}
+
 
 
 /* mqtt functionality */
@@ -355,6 +355,11 @@ int com_is_bridge(void)
 	return 1;
 }
 
+int com_get_locality(void)
+{
+	return COM_LOCALITY_BROKER;
+}
+
 
 
 /* mqtt functionality */
@@ -0,0 +1,613 @@
+/*
+ * shm.c
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+
+#include <slog.h>
+
+#include "com.h"
+#include "shm.h"
+
+#include <json.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHM_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define SHM_CPU_RELAX() do {} while(0)
+#endif
+
+void* thismodule;
+
+/* the mapped region and its memfd, which is also the connection id */
+SHM_REGION* region = NULL;
+size_t region_size = 0;
+int shm_fd = -1;
+
+/* SHM_SIDE_APP for the party that creates the region, SHM_SIDE_CORE for the other */
+int my_side = -1;
+
+int busy_poll_us = SHM_BUSY_POLL_US;
+
+/* readable once the peer process exits, opened on first use; -1 if not */
+int peer_pidfd = -1;
+
+/* one producer per ring: serialises the sending threads of this process */
+pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* signals com_set_on_data to a receive thread holding bytes for it */
+pthread_mutex_t handler_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t handler_cond = PTHREAD_COND_INITIALIZER;
+
+/* address */
+char* address = NULL;
+
+/* com.h functions */
+
+#ifdef __linux__
+
+char* com_init(void* module, const char* config_json)
+{
+	/* parse configs */
+	JSON* args_json = json_new(config_json);
+	int is_server = json_get_int(args_json, "is_server");
+	int fd = json_get_int(args_json, "fd");
+	int ring_size = json_get_int(args_json, "ring_size");
+	int busy_poll = json_get_int(args_json, "busy_poll_us");
+	json_free(args_json);
+
+	thismodule = module;
+	if (busy_poll >= 0)
+		busy_poll_us = busy_poll;
+
+	if (is_server == 1)
+	{
+		/* ring sizes must be powers of 2 */
+		if (ring_size <= 0 || (ring_size & (ring_size-1)))
+			ring_size = SHM_RING_SIZE;
+
+		/* close on exec: only the core inherits them, see com_before_exec */
+		shm_fd = syscall(SYS_memfd_create, "mw_shm", MFD_CLOEXEC);
+		if (shm_fd < 0)
+		{
+			slog(SLOG_ERROR, "SHM: memfd_create failed: %s", strerror(errno));
+			return NULL;
+		}
+
+		region_size = sizeof(SHM_REGION) + 2 * (size_t)ring_size;
+		if (ftruncate(shm_fd, region_size) < 0)
+			goto err;
+
+		region = mmap(NULL, region_size, PROT_READ|PROT_WRITE, MAP_SHARED, shm_fd, 0);
+		if (region == MAP_FAILED)
+		{
+			region = NULL;
+			goto err;
+		}
+
+		memset(region, 0, sizeof(SHM_REGION));
+		region->magic = SHM_MAGIC;
+		region->ring_size = ring_size;
+
+		int i;
+		for (i = 0; i < 2; i++)
+		{
+			region->ring[i].data_efd = eventfd(0, EFD_CLOEXEC);
+			region->ring[i].space_efd = eventfd(0, EFD_CLOEXEC);
+			if (region->ring[i].data_efd < 0 || region->ring[i].space_efd < 0)
+				goto err;
+		}
+
+		my_side = SHM_SIDE_APP;
+	}
+	else
+	{
+		shm_fd = fd;
+
+		/* the header tells the size of the whole region */
+		SHM_REGION* head = mmap(NULL, sizeof(SHM_REGION), PROT_READ, MAP_SHARED, shm_fd, 0);
+		if (head == MAP_FAILED)
+			return NULL;
+		uint32_t magic = head->magic;
+		region_size = sizeof(SHM_REGION) + 2 * (size_t)head->ring_size;
+		munmap(head, sizeof(SHM_REGION));
+
+		if (magic != SHM_MAGIC)
+		{
+			slog(SLOG_ERROR, "SHM: fd %d is not a shm channel", shm_fd);
+			return NULL;
+		}
+
+		region = mmap(NULL, region_size, PROT_READ|PROT_WRITE, MAP_SHARED, shm_fd, 0);
+		if (region == MAP_FAILED)
+		{
+			region = NULL;
+			return NULL;
+		}
+
+		my_side = SHM_SIDE_CORE;
+
+		/* inherited; the core's own children do not get them */
+		shm_set_cloexec(1);
+	}
+
+	region->pid[my_side] = getpid();
+
+	shm_run_receive_thread(shm_fd);
+
+	address = (char*) malloc(24*sizeof(char));
+	sprintf(address, "%d:%d", my_side, shm_fd);
+	return address;
+
+err:
+	slog(SLOG_ERROR, "SHM: could not set up the shared memory channel: %s", strerror(errno));
+	if (region)
+		munmap(region, region_size);
+	region = NULL;
+	close(shm_fd);
+	shm_fd = -1;
+	return NULL;
+}
+
+void shm_set_cloexec(int on)
+{
+	int i;
+	fcntl(shm_fd, F_SETFD, on ? FD_CLOEXEC : 0);
+	for (i = 0; i < 2; i++)
+	{
+		fcntl(region->ring[i].data_efd, F_SETFD, on ? FD_CLOEXEC : 0);
+		fcntl(region->ring[i].space_efd, F_SETFD, on ? FD_CLOEXEC : 0);
+	}
+}
+
+int com_before_exec(void)
+{
+	if (region == NULL)
+		return -1;
+
+	shm_set_cloexec(0);
+	return 0;
+}
+
+#else
+
+char* com_init(void* module, const char* config_json)
+{
+	/* memfd and eventfd are linux only */
+	return NULL;
+}
+
+int com_before_exec(void)
+{
+	return -1;
+}
+
+#endif /* __linux__ */
+
+/*
+ * 1-1 channel: both sides and the fd passed to the core
+ * are the memfd, which the core inherits with the same number
+ */
+int com_connect(const char *addr)
+{
+	return shm_fd;
+}
+
+int com_connection_close(int conn)
+{
+	if (region == NULL || conn != shm_fd)
+		return -1;
+
+	/* wake up everybody, they will see the closed flag */
+	region->closed = 1;
+	shm_notify(region->ring[0].data_efd);
+	shm_notify(region->ring[0].space_efd);
+	shm_notify(region->ring[1].data_efd);
+	shm_notify(region->ring[1].space_efd);
+
+	return 0;
+}
+
+int com_sendv(int conn, const struct iovec *iov, int iovcnt)
+{
+	if (region == NULL || conn != shm_fd)
+	{
+		slog(SLOG_ERROR, "SHM: not established with (%d), can't send msg", conn);
+		return -1;
+	}
+
+	int i, sent = 0;
+
+	/* all the buffers of one call are contiguous in the ring */
+	pthread_mutex_lock(&send_lock);
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (shm_ring_write(my_side, iov[i].iov_base, iov[i].iov_len) < 0)
+			break;
+		sent += iov[i].iov_len;
+	}
+	pthread_mutex_unlock(&send_lock);
+
+	return sent;
+}
+
+int com_send(int conn, const void* msg, unsigned int size)
+{
+	struct iovec iov;
+	iov.iov_base = (void*) msg;
+	iov.iov_len = size;
+
+	return com_sendv(conn, &iov, 1);
+}
+
+int com_send_data(int conn, const char* msg)
+{
+	return com_send(conn, msg, strlen(msg));
+}
+
+int com_set_on_data( void (*handler)(void*, int, const void*, unsigned int) )
+{
+	pthread_mutex_lock(&handler_lock);
+	on_data_handler = handler;
+	pthread_cond_broadcast(&handler_cond);
+	pthread_mutex_unlock(&handler_lock);
+	return (on_data_handler != NULL);
+}
+
+int com_set_on_connect( void (*handler)(void*, int) )
+{
+	on_connect_handler = handler;
+	return (on_connect_handler != NULL);
+}
+
+int com_set_on_disconnect( void (*handler)(void*, int) )
+{
+	on_disconnect_handler = handler;
+	return (on_disconnect_handler != NULL );
+}
+
+int com_is_valid_address(const char* full_address)
+{
+	/* not addressable from outside */
+	return 0;
+}
+
+int com_is_bridge()
+{
+	return 1;
+}
+
+int com_get_locality(void)
+{
+	return COM_LOCALITY_HOST;
+}
+
+int com_is_binary_safe(void)
+{
+	return 1;
+}
+
+/* ring helpers */
+
+char* shm_ring_data(int ring)
+{
+	return (char*)(region + 1) + ring * (size_t)region->ring_size;
+}
+
+void shm_notify(int efd)
+{
+	uint64_t one = 1;
+	ssize_t res;
+	do {
+		res = write(efd, &one, sizeof(one));
+	} while (res < 0 && errno == EINTR);
+}
+
+/*
+ * a pidfd of the peer: it polls readable when the peer exits, zombie
+ * or not, without reaping the app's child. -1 before the core attached
+ * or without pidfd_open (linux < 5.3).
+ */
+int shm_peer_pidfd(void)
+{
+	int pidfd = __atomic_load_n(&peer_pidfd, __ATOMIC_ACQUIRE);
+	pid_t peer = region->pid[(my_side+1)%2];
+	if (pidfd >= 0 || peer == 0)
+		return pidfd;
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	pidfd = syscall(SYS_pidfd_open, peer, 0);
+	if (pidfd < 0)
+		return -1;
+	fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+
+	/* another thread may have opened it meanwhile */
+	int none = -1;
+	if (!__atomic_compare_exchange_n(&peer_pidfd, &none, pidfd, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		close(pidfd);
+		pidfd = none;
+	}
+	return pidfd;
+#else
+	return -1;
+#endif
+}
+
+int shm_peer_alive(void)
+{
+	if (region->closed)
+		return 0;
+
+	pid_t peer = region->pid[(my_side+1)%2];
+	/* the core may not have attached yet */
+	if (peer == 0)
+		return 1;
+
+#ifdef __linux__
+	int pidfd = shm_peer_pidfd();
+	if (pidfd >= 0)
+	{
+		struct pollfd pfd;
+		pfd.fd = pidfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		return !(poll(&pfd, 1, 0) > 0);
+	}
+#endif
+
+	/* no pidfd: an exited core is a zombie until reaped, the closed flag tells */
+	return !(kill(peer, 0) < 0 && errno == ESRCH);
+}
+
+/*
+ * sleeps on a doorbell until woken or the timeout;
+ * the caller re-checks its condition in both cases
+ */
+int shm_doorbell_wait(int efd)
+{
+#ifdef __linux__
+	/* the peer's exit wakes it too; poll skips a -1 pidfd */
+	struct pollfd pfd[2];
+	pfd[0].fd = efd;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = shm_peer_pidfd();
+	pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+
+	int res = poll(pfd, 2, SHM_WAIT_TIMEOUT);
+	if (res > 0 && (pfd[0].revents & POLLIN))
+	{
+		uint64_t val;
+		if (read(efd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+			return -1;
+	}
+	else if (res < 0 && errno != EINTR)
+		return -1;
+#endif
+	return shm_peer_alive() ? 0 : -1;
+}
+
+/*
+ * Flag then re-check before sleeping; the other side publishes then
+ * checks the flag. Both sequentially consistent, so a wake up is never lost.
+ */
+int shm_wait_data(SHM_RING* ring)
+{
+	__atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail)
+	{
+		__atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+
+	int res = shm_doorbell_wait(ring->data_efd);
+	__atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+	return res;
+}
+
+/* data is waiting in the ring: sleeps until there is an on_data to take it */
+int shm_wait_handler(void)
+{
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += SHM_WAIT_TIMEOUT / 1000;
+	until.tv_nsec += (SHM_WAIT_TIMEOUT % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L)
+	{
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&handler_lock);
+	while (on_data_handler == NULL)
+		if (pthread_cond_timedwait(&handler_cond, &handler_lock, &until) != 0)
+			break;
+	pthread_mutex_unlock(&handler_lock);
+
+	return shm_peer_alive() ? 0 : -1;
+}
+
+int shm_wait_space(SHM_RING* ring)
+{
+	__atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) < region->ring_size)
+	{
+		__atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+
+	int res = shm_doorbell_wait(ring->space_efd);
+	__atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+	return res;
+}
+
+/* producer side, called with send_lock held */
+int shm_ring_write(int ring_id, const void* src, uint32_t size)
+{
+	SHM_RING* ring = &region->ring[ring_id];
+	char* data = shm_ring_data(ring_id);
+	uint32_t mask = region->ring_size - 1;
+	uint32_t copied = 0, head, tail, space, n;
+
+	while (copied < size)
+	{
+		if (region->closed)
+			return -1;
+
+		head = ring->head;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		space = region->ring_size - (head - tail);
+		if (space == 0)
+		{
+			if (shm_wait_space(ring) < 0)
+				return -1;
+			continue;
+		}
+
+		/* contiguous part up to the end of the ring */
+		n = size - copied;
+		if (n > space)
+			n = space;
+		if (n > region->ring_size - (head & mask))
+			n = region->ring_size - (head & mask);
+
+		memcpy(data + (head & mask), (const char*)src + copied, n);
+		__atomic_store_n(&ring->head, head + n, __ATOMIC_SEQ_CST);
+		copied += n;
+
+		if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_SEQ_CST))
+			shm_notify(ring->data_efd);
+	}
+
+	return copied;
+}
+
+/* multithreading helper functions */
+
+void shm_run_receive_thread(int conn)
+{
+	pthread_t rcvthread;
+	int err;
+	int* conn_ptr = (int*)malloc(sizeof(int));
+	*conn_ptr = conn;
+
+	err = pthread_create(&rcvthread, NULL, &shm_receive_function, (void*)conn_ptr);
+	if (err != 0)
+	{
+		slog(SLOG_ERROR, "SHM: can't create receive thread for (%d).", conn);
+		return;
+	}
+	pthread_detach(rcvthread);
+}
+
+long shm_elapsed_us(struct timespec* since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+/*
+ * consumer of the peer's ring:
+ * hands the bytes to on_data straight from shared memory,
+ * spins for busy_poll_us when idle, then blocks on the doorbell
+ */
+void* shm_receive_function(void* conn)
+{
+	int _conn = *((int*)conn);
+	free(conn);
+
+	int ring_id = (my_side+1)%2;
+	SHM_RING* ring = &region->ring[ring_id];
+	char* data = shm_ring_data(ring_id);
+	uint32_t mask = region->ring_size - 1;
+	uint32_t head, tail, n;
+
+	struct timespec idle_since;
+	int spinning = 0, spins = 0;
+
+	while (1)
+	{
+		tail = ring->tail;
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		/* keep the bytes in the ring until someone can take them */
+		if (head != tail && on_data_handler != NULL)
+		{
+			n = head - tail;
+			if (n > region->ring_size - (tail & mask))
+				n = region->ring_size - (tail & mask);
+
+			(*on_data_handler)(thismodule, _conn, data + (tail & mask), n);
+
+			__atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_SEQ_CST))
+				shm_notify(ring->space_efd);
+
+			spinning = 0;
+			continue;
+		}
+
+		/* the data waits for on_data, not for the peer */
+		if (head != tail)
+		{
+			if (shm_wait_handler() < 0)
+				break;
+			continue;
+		}
+
+		/* busy-poll window, none when busy_poll_us is 0 */
+		if (busy_poll_us > 0)
+		{
+			if (!spinning)
+			{
+				spinning = 1;
+				spins = 0;
+				clock_gettime(CLOCK_MONOTONIC, &idle_since);
+			}
+			if ((++spins & 63) != 0 || shm_elapsed_us(&idle_since) < busy_poll_us)
+			{
+				SHM_CPU_RELAX();
+				continue;
+			}
+		}
+
+		/* blocking wait */
+		if (shm_wait_data(ring) < 0)
+			break;
+		spinning = 0;
+	}
+
+	slog(SLOG_WARN, "SHM: peer gone on (%d). closing connection ", _conn);
+	if (on_disconnect_handler)
+		(*on_disconnect_handler)(thismodule, _conn);
+	else
+		com_connection_close(_conn);
+
+	return NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ * shm.h
+ *
+ * Shared memory channel between an app and its core:
+ * two single producer / single consumer byte rings in a memfd,
+ * one per direction, with eventfd doorbells for blocking waits.
+ */
+
+#ifndef COM_SHM_H_
+#define COM_SHM_H_
+
+#include <stdint.h>
+
+#define SHM_MAGIC				0x53484d31 /* "SHM1" */
+#define SHM_RING_SIZE			(1<<20)	/* default, power of 2 */
+#define SHM_BUSY_POLL_US		50		/* default spin before blocking */
+#define SHM_WAIT_TIMEOUT		1000	/* ms between peer liveness checks */
+
+/* ring 0: app -> core; ring 1: core -> app */
+#define SHM_SIDE_APP			0
+#define SHM_SIDE_CORE			1
+
+typedef struct _SHM_RING{
+	/* bytes ever written/read, wrap around; head - tail = used */
+	volatile uint32_t head;
+	char pad_head[60];
+	volatile uint32_t tail;
+	char pad_tail[60];
+
+	/* set by a side before sleeping on its doorbell */
+	volatile uint32_t consumer_waiting;
+	volatile uint32_t producer_waiting;
+
+	int data_efd;	/* rung by the producer, consumer sleeps on it */
+	int space_efd;	/* rung by the consumer, producer sleeps on it */
+} SHM_RING;
+
+typedef struct _SHM_REGION{
+	uint32_t magic;
+	uint32_t ring_size;
+	volatile uint32_t closed;
+	int32_t pid[2]; /* per side, for liveness checks */
+
+	SHM_RING ring[2];
+	/* followed by the data of ring 0 then ring 1 */
+} SHM_REGION;
+
+/* ring helper functions */
+char* shm_ring_data(int ring);
+int   shm_ring_write(int ring, const void* src, uint32_t size);
+int   shm_wait_data(SHM_RING* ring);
+int   shm_wait_handler(void);
+int   shm_wait_space(SHM_RING* ring);
+void  shm_notify(int efd);
+int   shm_peer_alive(void);
+int   shm_peer_pidfd(void);
+void  shm_set_cloexec(int on);
+
+/* multithreading helper functions */
+void  shm_run_receive_thread(int conn);
+void* shm_receive_function(void* conn);
+
+#endif /* COM_SHM_H_ */
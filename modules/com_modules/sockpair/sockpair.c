@@ -24,6 +24,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <limits.h> /* IOV_MAX */
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
 #include <slog.h>
 #include <hashmap.h>
@@ -199,6 +205,58 @@ int com_send(int conn, const void* msg, unsigned int size)
 	return (int) allBytesSent;
 }
 
+int com_sendv(int conn, const struct iovec *iov, int iovcnt)
+{
+	if(conn <= 0 || iovcnt <= 0)
+	{
+		slog(SLOG_ERROR,
+			 "SOCKPAIR: not established with (%d), can't send msg", conn);
+		return -1;
+	}
+
+	/* local copy: partially sent vectors are advanced in place */
+	struct iovec vec[iovcnt];
+	memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+
+	struct msghdr msghdr;
+	memset(&msghdr, 0, sizeof(msghdr));
+
+	int allBytesSent = 0; /* sum of all sent sizes */
+	ssize_t sentSize; /* one shot sent size */
+	int idx = 0;
+
+	while(idx < iovcnt)
+	{
+		msghdr.msg_iov = vec + idx;
+		msghdr.msg_iovlen = (iovcnt - idx < IOV_MAX) ? iovcnt - idx : IOV_MAX;
+
+		sentSize = sendmsg(conn, &msghdr, MSG_NOSIGNAL);
+		if (sentSize < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			slog(SLOG_ERROR,
+				 "SOCKPAIR: error sending msg on sock (%d)",
+				 conn);
+			break;
+		}
+		allBytesSent += sentSize;
+
+		while(idx < iovcnt && (size_t)sentSize >= vec[idx].iov_len)
+		{
+			sentSize -= vec[idx].iov_len;
+			idx++;
+		}
+		if(idx < iovcnt)
+		{
+			vec[idx].iov_base = (char*)vec[idx].iov_base + sentSize;
+			vec[idx].iov_len -= sentSize;
+		}
+	}
+
+	return allBytesSent;
+}
+
 char* sockpair_receive_message(int _conn)
 {
 	uint32_t varSize;
@@ -378,6 +436,11 @@ int com_is_bridge()
 	return 1;
 }
 
+int com_get_locality(void)
+{
+	return COM_LOCALITY_HOST;
+}
+
 char* sockpair_receive_message_alt(int _conn)
 {
     uint32_t varSize;
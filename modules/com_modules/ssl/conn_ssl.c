@@ -234,6 +234,27 @@ int com_send(int conn, const void *data, unsigned int size) {
 	return (int) allBytesSent;
 }
 
+/* SSL_write has no gather form: join the buffers so they go out as one record */
+int com_sendv(int conn, const struct iovec *iov, int iovcnt) {
+	unsigned int size = 0, pos = 0;
+	int i;
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	char *data = (char*) malloc(size);
+	if (data == NULL)
+		return -1;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(data + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	int result = com_send(conn, data, size);
+	free(data);
+
+	return result;
+}
+
 int com_send_data(int conn, const char *msg) {
 	if (conn <= 0) {
 		slog(SLOG_ERROR,
@@ -24,6 +24,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <limits.h> /* IOV_MAX */
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
 
 
 #include "com.h"
@@ -34,6 +46,22 @@
 
 void* thismodule = NULL;
 
+/* io model: one receive thread per connection or a shared epoll reactor */
+int io_mode = TCP_IO_THREADS;
+#ifdef __linux__
+int epoll_fd = -1;
+int epoll_serversock = -1;
+#endif
+
+/*
+ * per connection send locks, indexed by the socket: a send goes out
+ * whole, waits for EAGAIN included. Kept for the next socket that
+ * gets the same number.
+ */
+pthread_mutex_t** send_locks = NULL;
+int send_locks_size = 0;
+pthread_mutex_t send_locks_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* com header implems */
 
 char* com_init(void* module, const char* config_json)
@@ -44,8 +72,14 @@ char* com_init(void* module, const char* config_json)
     /* parse the json args */
     JSON* args_json = json_new(config_json);
     char* server_address = json_get_str(args_json, "address");
+    char* io_mode_str = json_get_str(args_json, "io_mode");
+    int io_threads = json_get_int(args_json, "io_threads");
     json_free(args_json);
 
+    if (io_mode_str != NULL && strcmp(io_mode_str, "epoll") == 0)
+        io_mode = TCP_IO_EPOLL;
+    free(io_mode_str);
+
     /* init listen server on the specified address */
     char* server_addr = tcp_get_addr(server_address);
     int server_port = tcp_get_port(server_address);
@@ -75,7 +109,12 @@ char* com_init(void* module, const char* config_json)
 
     free(server_addr);
     listen(serversock, 3);
-    
+
+    if (io_mode == TCP_IO_EPOLL && tcp_run_reactor(serversock, io_threads) == 0)
+        return server_address;
+
+    /* reactor unavailable: fall back to a thread per connection */
+    io_mode = TCP_IO_THREADS;
     tcp_run_accept_thread(serversock);
 
     return server_address;
@@ -110,13 +149,22 @@ int com_connect(const char* server_address)
         return -3;
     }
     free(server_addr);
-    tcp_run_receive_thread(peersock);
+
+    if (io_mode == TCP_IO_EPOLL)
+    {
+        if (tcp_reactor_add(peersock) < 0)
+            return -4;
+    }
+    else
+        tcp_run_receive_thread(peersock);
 
     return peersock;
 }
 
 int com_connection_close(int conn)
 {
+    /* the fd number may be reused by a new connection */
+    tcp_send_lock_free(conn);
     return close(conn);
 }
 
@@ -130,23 +178,90 @@ int com_send(int conn, const void *data, unsigned int size)
     int allBytesSent; /* sum of all sent sizes */
     ssize_t sentSize; /* one shot sent size */
 
+    pthread_mutex_t* lock = tcp_send_lock(conn);
+    if (lock != NULL)
+        pthread_mutex_lock(lock);
+
     allBytesSent = 0;
     while (allBytesSent < size)
     {
-        sentSize = send(conn, data + allBytesSent, size - allBytesSent, 0);
+        sentSize = send(conn, data + allBytesSent, size - allBytesSent, MSG_NOSIGNAL);
         /*if(varSize - allBytesSent < 512)
                 sentSize = send(conn , data+allBytesSent , varSize - allBytesSent , 0);
         else
                 sentSize = send(conn , data+allBytesSent , 512 , 0);*/
         if (sentSize < 0)
         {
-        	break;
+            if (errno == EINTR)
+                continue;
+            /* non-blocking sockets in reactor mode */
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && tcp_wait_writable(conn) == 0)
+                continue;
+            break;
         }
         allBytesSent += sentSize;
     }
+
+    if (lock != NULL)
+        pthread_mutex_unlock(lock);
     return (int)allBytesSent;
 }
 
+int com_sendv(int conn, const struct iovec *iov, int iovcnt)
+{
+    if (conn <= 0 || iovcnt <= 0) {
+        return -1;
+    }
+
+    /* local copy: partially sent vectors are advanced in place */
+    struct iovec vec[iovcnt];
+    memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    int allBytesSent = 0;
+    int idx = 0;
+    ssize_t sentSize;
+
+    pthread_mutex_t* lock = tcp_send_lock(conn);
+    if (lock != NULL)
+        pthread_mutex_lock(lock);
+
+    while (idx < iovcnt)
+    {
+        msg.msg_iov = vec + idx;
+        msg.msg_iovlen = (iovcnt - idx < IOV_MAX) ? iovcnt - idx : IOV_MAX;
+
+        sentSize = sendmsg(conn, &msg, MSG_NOSIGNAL);
+        if (sentSize < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && tcp_wait_writable(conn) == 0)
+                continue;
+            break;
+        }
+        allBytesSent += sentSize;
+
+        /* skip the vectors fully sent, trim the partial one */
+        while (idx < iovcnt && (size_t)sentSize >= vec[idx].iov_len)
+        {
+            sentSize -= vec[idx].iov_len;
+            idx++;
+        }
+        if (idx < iovcnt)
+        {
+            vec[idx].iov_base = (char*)vec[idx].iov_base + sentSize;
+            vec[idx].iov_len -= sentSize;
+        }
+    }
+
+    if (lock != NULL)
+        pthread_mutex_unlock(lock);
+    return allBytesSent;
+}
+
 int com_send_data(int conn, const char* msg)
 {
     if (conn <= 0) {
@@ -185,6 +300,16 @@ int com_is_bridge(void)
 	return 1;
 }
 
+int com_get_locality(void)
+{
+	return COM_LOCALITY_NET;
+}
+
+int com_is_binary_safe(void)
+{
+	return 1;
+}
+
 /* com_tcp.h functions */
 
 int tcp_is_addr(const char* full_address)
@@ -249,7 +374,60 @@ int tcp_get_port(const char * full_address)
 	return port;
 }
 
-char* tcp_receive_message(int _conn)
+pthread_mutex_t* tcp_send_lock(int conn)
+{
+    pthread_mutex_t* lock = NULL;
+
+    pthread_mutex_lock(&send_locks_lock);
+    if (conn >= send_locks_size)
+    {
+        int size = send_locks_size ? send_locks_size : 64;
+        while (size <= conn)
+            size *= 2;
+        pthread_mutex_t** locks = (pthread_mutex_t**)realloc(send_locks, size * sizeof(pthread_mutex_t*));
+        if (locks == NULL)
+            goto end;
+        memset(locks + send_locks_size, 0, (size - send_locks_size) * sizeof(pthread_mutex_t*));
+        send_locks = locks;
+        send_locks_size = size;
+    }
+    if (send_locks[conn] == NULL)
+    {
+        send_locks[conn] = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
+        if (send_locks[conn] == NULL)
+            goto end;
+        pthread_mutex_init(send_locks[conn], NULL);
+    }
+    lock = send_locks[conn];
+
+end:
+    pthread_mutex_unlock(&send_locks_lock);
+    return lock;
+}
+
+void tcp_send_lock_free(int conn)
+{
+    pthread_mutex_t* lock = NULL;
+
+    pthread_mutex_lock(&send_locks_lock);
+    if (conn >= 0 && conn < send_locks_size)
+    {
+        lock = send_locks[conn];
+        send_locks[conn] = NULL;
+    }
+    pthread_mutex_unlock(&send_locks_lock);
+
+    if (lock == NULL)
+        return;
+
+    /* after a send in progress */
+    pthread_mutex_lock(lock);
+    pthread_mutex_unlock(lock);
+    pthread_mutex_destroy(lock);
+    free(lock);
+}
+
+char* tcp_receive_message(int _conn, int* size)
 {
     uint32_t varSize;
     //int allBytesRecv; /* sum af all received packets */
@@ -272,6 +450,7 @@ char* tcp_receive_message(int _conn)
                 com_connection_close(_conn);
             return NULL;
         }
+        *size = recvSize;
 
         //slog(SLOG_INFO, "TCP: received %d total bytes on sock (%d): *%s*", recvSize, _conn, buf);
 
@@ -353,9 +532,10 @@ void* tcp_receive_function(void* conn)
         return NULL;
     }
     char* buf;
+    int size = 0;
     do {
         /* read message */
-        buf = tcp_receive_message(_conn);
+        buf = tcp_receive_message(_conn, &size);
 
         /* recv failed or disconnected */
         if (buf == NULL)
@@ -363,7 +543,7 @@ void* tcp_receive_function(void* conn)
 
         /* apply message handler */
         if (on_data_handler != NULL)
-            (*on_data_handler)(thismodule,_conn, buf, strlen(buf));
+            (*on_data_handler)(thismodule,_conn, buf, size);
 
         free(buf); /* TODO: it can't be passed btw threads */
 
@@ -371,3 +551,205 @@ void* tcp_receive_function(void* conn)
     return NULL;
 }
 
+
+/* epoll reactor */
+
+#ifdef __linux__
+
+int tcp_set_nonblocking(int conn)
+{
+    int flags = fcntl(conn, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(conn, F_SETFL, flags | O_NONBLOCK);
+}
+
+int tcp_wait_writable(int conn)
+{
+    struct pollfd pfd;
+    pfd.fd = conn;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    int res;
+    do {
+        res = poll(&pfd, 1, TCP_SEND_TIMEOUT);
+    } while (res < 0 && errno == EINTR);
+
+    return (res > 0 && (pfd.revents & POLLOUT)) ? 0 : -1;
+}
+
+int tcp_run_reactor(int serversock, int nb_threads)
+{
+    if (nb_threads <= 0)
+        nb_threads = 1;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return -1;
+
+    if (tcp_set_nonblocking(serversock) < 0)
+        goto err;
+
+    /* the listen socket is oneshot too so only one worker accepts at a time */
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = serversock;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, serversock, &ev) < 0)
+        goto err;
+    epoll_serversock = serversock;
+
+    int i, started = 0;
+    for (i = 0; i < nb_threads; i++)
+    {
+        pthread_t iothread;
+        if (pthread_create(&iothread, NULL, &tcp_reactor_function, NULL) != 0)
+            continue;
+        pthread_detach(iothread);
+        started++;
+    }
+    if (started > 0)
+        return 0;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, serversock, NULL);
+    epoll_serversock = -1;
+err:
+    close(epoll_fd);
+    epoll_fd = -1;
+    fcntl(serversock, F_SETFL, fcntl(serversock, F_GETFL, 0) & ~O_NONBLOCK);
+    return -1;
+}
+
+int tcp_reactor_add(int conn)
+{
+    tcp_set_nonblocking(conn);
+
+    /* the state must exist before the first byte is dispatched */
+    if (on_connect_handler != NULL)
+        (*on_connect_handler)(thismodule, conn);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn, &ev) == 0)
+        return 0;
+
+    /* nobody would ever read it: undo the connect */
+    if (on_disconnect_handler)
+        (*on_disconnect_handler)(thismodule, conn);
+    else
+        com_connection_close(conn);
+    return -1;
+}
+
+/*
+ * Drains a connection (bounded, to stay fair to the others) and re-arms it.
+ * EPOLLONESHOT guarantees a single worker per connection at any time,
+ * so on_data_handler sees the bytes of one connection in order.
+ */
+int tcp_reactor_read(int conn, char* buf)
+{
+    ssize_t recv_size;
+    int i;
+
+    for (i = 0; i < TCP_READS_PER_WAKEUP; i++)
+    {
+        recv_size = recv(conn, buf, TCP_RECV_SIZE, 0);
+        if (recv_size > 0)
+        {
+            buf[recv_size] = '\0';
+            if (on_data_handler != NULL)
+                (*on_data_handler)(thismodule, conn, buf, recv_size);
+            continue;
+        }
+        if (recv_size < 0 && errno == EINTR)
+            continue;
+        if (recv_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        /* orderly shutdown or error */
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn, NULL);
+        if (on_disconnect_handler)
+            (*on_disconnect_handler)(thismodule, conn);
+        else
+            com_connection_close(conn);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.fd = conn;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn, &ev);
+}
+
+void tcp_reactor_accept(int serversock)
+{
+    int peersock;
+    struct sockaddr_in peerin;
+    socklen_t c = sizeof(struct sockaddr_in);
+
+    while (1)
+    {
+        peersock = accept(serversock, (struct sockaddr*)&peerin, &c);
+        if (peersock < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break; /* EAGAIN or a transient error */
+        }
+        /* closed by tcp_reactor_add on failure */
+        tcp_reactor_add(peersock);
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = serversock;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, serversock, &ev);
+}
+
+void* tcp_reactor_function(void* arg)
+{
+    struct epoll_event events[TCP_MAX_EVENTS];
+    char buf[TCP_RECV_SIZE + 1];
+    int nb_events, i;
+
+    while (1)
+    {
+        nb_events = epoll_wait(epoll_fd, events, TCP_MAX_EVENTS, -1);
+        if (nb_events < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+
+        for (i = 0; i < nb_events; i++)
+        {
+            if (events[i].data.fd == epoll_serversock)
+                tcp_reactor_accept(events[i].data.fd);
+            else
+                tcp_reactor_read(events[i].data.fd, buf);
+        }
+    }
+    return NULL;
+}
+
+#else
+
+int tcp_wait_writable(int conn)
+{
+    return -1;
+}
+
+int tcp_run_reactor(int serversock, int nb_threads)
+{
+    return -1;
+}
+
+int tcp_reactor_add(int conn)
+{
+    tcp_run_receive_thread(conn);
+    return 0;
+}
+
+#endif
@@ -8,6 +8,15 @@
 #ifndef COM_TCP_H_
 #define COM_TCP_H_
 
+/* io models, "io_mode" in the module config */
+#define TCP_IO_THREADS	0
+#define TCP_IO_EPOLL	1
+
+#define TCP_RECV_SIZE			4096
+#define TCP_MAX_EVENTS			64
+#define TCP_READS_PER_WAKEUP	16
+#define TCP_SEND_TIMEOUT		5000 /* ms */
+
 /* helper functions to figure out the address passed */
 int   tcp_get_port(const char *full_address);
 char* tcp_get_addr(const char *full_address);
@@ -20,7 +29,20 @@ void  tcp_run_receive_thread(int conn);
 void* tcp_receive_function(void* conn);
 /*void  tcp_stop_receive_thread(int conn);  <--not used / implemented */
 
+/* epoll reactor: io_threads workers share one epoll set */
+int   tcp_run_reactor(int serversock, int nb_threads);
+int   tcp_reactor_add(int conn); /* -1: the conn was torn down */
+void* tcp_reactor_function(void* arg);
+#ifdef __linux__
+int   tcp_set_nonblocking(int conn);
+int   tcp_reactor_read(int conn, char* buf);
+void  tcp_reactor_accept(int serversock);
+#endif
+int   tcp_wait_writable(int conn);
+pthread_mutex_t* tcp_send_lock(int conn);
+void  tcp_send_lock_free(int conn);
+
 /* the actual receive data: to be deleted */
-char* tcp_receive_message(int _conn);
+char* tcp_receive_message(int _conn, int* size);
 
 #endif
@@ -0,0 +1,533 @@
+/*
+ * com_unix.c
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h> /* IOV_MAX */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+#include "com.h"
+#include "com_unix.h"
+#include <json.h>
+
+void* thismodule = NULL;
+
+/* fds received and not yet claimed, per connection */
+typedef struct _UNIX_FD{
+    int conn;
+    int fd;
+    int reads; /* reads handed to on_data since it came */
+    struct _UNIX_FD* next;
+} UNIX_FD;
+
+UNIX_FD* received_fds = NULL;
+pthread_mutex_t fds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* com header implems */
+
+char* com_init(void* module, const char* config_json)
+{
+    /* set the handle */
+    thismodule = module;
+
+    /* parse the json args */
+    JSON* args_json = json_new(config_json);
+    char* server_address = json_get_str(args_json, "address");
+    json_free(args_json);
+
+    char* path = unix_get_path(server_address);
+    if (path == NULL)
+    {
+        free(server_address);
+        return NULL;
+    }
+
+    struct sockaddr_un serverun;
+    if (strlen(path) >= sizeof(serverun.sun_path))
+        goto err;
+
+    int serversock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (serversock == -1)
+        goto err;
+
+    memset(&serverun, 0, sizeof(serverun));
+    serverun.sun_family = AF_UNIX;
+    strcpy(serverun.sun_path, path);
+
+    /* a stale socket file from a previous run */
+    unlink(path);
+
+    if (bind(serversock, (struct sockaddr*)&serverun, sizeof(serverun)) < 0)
+    {
+        close(serversock);
+        goto err;
+    }
+
+    listen(serversock, 3);
+    free(path);
+
+    unix_run_accept_thread(serversock);
+
+    return server_address;
+
+err:
+    free(path);
+    free(server_address);
+    return NULL;
+}
+
+int com_connect(const char* server_address)
+{
+    if (!unix_is_addr(server_address))
+    {
+       return -1;
+    }
+
+    char* path = unix_get_path(server_address);
+
+    int peersock;
+    struct sockaddr_un peerun;
+
+    peersock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (peersock == -1)
+    {
+        free(path);
+        return -2;
+    }
+
+    memset(&peerun, 0, sizeof(peerun));
+    peerun.sun_family = AF_UNIX;
+    strcpy(peerun.sun_path, path);
+    free(path);
+
+    if (connect(peersock, (struct sockaddr*)&peerun, sizeof(peerun)) < 0)
+    {
+        close(peersock);
+        return -3;
+    }
+
+    unix_run_receive_thread(peersock);
+
+    return peersock;
+}
+
+int com_connection_close(int conn)
+{
+    unix_fd_drop(conn);
+    return close(conn);
+}
+
+int com_sendv(int conn, const struct iovec *iov, int iovcnt)
+{
+    if (conn <= 0 || iovcnt <= 0) {
+        return -1;
+    }
+
+    /* local copy: partially sent vectors are advanced in place */
+    struct iovec vec[iovcnt];
+    memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    int allBytesSent = 0;
+    int idx = 0;
+    ssize_t sentSize;
+
+    while (idx < iovcnt)
+    {
+        msg.msg_iov = vec + idx;
+        msg.msg_iovlen = (iovcnt - idx < IOV_MAX) ? iovcnt - idx : IOV_MAX;
+
+        sentSize = sendmsg(conn, &msg, MSG_NOSIGNAL);
+        if (sentSize < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        allBytesSent += sentSize;
+
+        /* skip the vectors fully sent, trim the partial one */
+        while (idx < iovcnt && (size_t)sentSize >= vec[idx].iov_len)
+        {
+            sentSize -= vec[idx].iov_len;
+            idx++;
+        }
+        if (idx < iovcnt)
+        {
+            vec[idx].iov_base = (char*)vec[idx].iov_base + sentSize;
+            vec[idx].iov_len -= sentSize;
+        }
+    }
+    return allBytesSent;
+}
+
+int com_send(int conn, const void *data, unsigned int size)
+{
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = size;
+
+    return com_sendv(conn, &iov, 1);
+}
+
+int com_send_data(int conn, const char* msg)
+{
+    if (conn <= 0) {
+        return -1;
+    }
+
+    return com_send(conn, (void*)msg, strlen(msg));
+}
+
+int com_send_fd(int conn, int fd, const void *data, unsigned int size)
+{
+    if (conn <= 0 || fd < 0 || size == 0) {
+        return -1;
+    }
+
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = size;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    /* the fd goes with the first byte; the rest is a plain send */
+    ssize_t sentSize;
+    do {
+        sentSize = sendmsg(conn, &msg, MSG_NOSIGNAL);
+    } while (sentSize < 0 && errno == EINTR);
+
+    if (sentSize <= 0)
+        return -1;
+    if ((unsigned int)sentSize < size)
+        return sentSize + com_send(conn, (const char*)data + sentSize, size - sentSize);
+
+    return sentSize;
+}
+
+int com_recv_fd(int conn)
+{
+    int fd = -1;
+    UNIX_FD **it, *elem;
+
+    pthread_mutex_lock(&fds_lock);
+    for (it = &received_fds; *it != NULL; it = &(*it)->next)
+    {
+        if ((*it)->conn == conn)
+        {
+            elem = *it;
+            fd = elem->fd;
+            *it = elem->next;
+            free(elem);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fds_lock);
+
+    return fd;
+}
+
+int com_set_on_data( void (*handler)(void*, int, const void*, unsigned int) )
+{
+    on_data_handler = handler;
+    return (on_data_handler != NULL);
+}
+
+int com_set_on_connect( void (*handler)(void*, int) )
+{
+    on_connect_handler = handler;
+    return (on_connect_handler != NULL);
+}
+
+int com_set_on_disconnect( void (*handler)(void*, int) )
+{
+    on_disconnect_handler = handler;
+    return (on_disconnect_handler != NULL );
+}
+
+int com_is_valid_address(const char* full_address)
+{
+    return unix_is_addr(full_address);
+}
+
+int com_is_bridge(void)
+{
+    return 1;
+}
+
+int com_get_locality(void)
+{
+    return COM_LOCALITY_HOST;
+}
+
+int com_is_binary_safe(void)
+{
+    return 1;
+}
+
+/* com_unix.h functions */
+
+int unix_is_addr(const char* full_address)
+{
+    if (full_address == NULL)
+        return 0;
+
+    size_t prefix_len = strlen(UNIX_ADDR_PREFIX);
+    if (strncmp(full_address, UNIX_ADDR_PREFIX, prefix_len) != 0)
+        return 0;
+
+    /* a non empty path that fits in sun_path */
+    size_t path_len = strlen(full_address + prefix_len);
+    return path_len > 0 && path_len < sizeof(((struct sockaddr_un*)0)->sun_path);
+}
+
+char* unix_get_path(const char* full_address)
+{
+    if (!unix_is_addr(full_address))
+        return NULL;
+
+    return strdup(full_address + strlen(UNIX_ADDR_PREFIX));
+}
+
+void unix_fd_push(int conn, int fd)
+{
+    UNIX_FD** it;
+    int pending = 0;
+
+    /* keep the arrival order */
+    pthread_mutex_lock(&fds_lock);
+    for (it = &received_fds; *it != NULL; it = &(*it)->next)
+        if ((*it)->conn == conn)
+            pending++;
+
+    if (pending >= UNIX_MAX_FDS)
+    {
+        pthread_mutex_unlock(&fds_lock);
+        close(fd);
+        return;
+    }
+
+    UNIX_FD* elem = (UNIX_FD*)malloc(sizeof(UNIX_FD));
+    elem->conn = conn;
+    elem->fd = fd;
+    elem->reads = 0;
+    elem->next = NULL;
+    *it = elem;
+    pthread_mutex_unlock(&fds_lock);
+}
+
+void unix_fd_age(int conn)
+{
+    UNIX_FD **it, *elem;
+
+    pthread_mutex_lock(&fds_lock);
+    it = &received_fds;
+    while (*it != NULL)
+    {
+        if ((*it)->conn == conn && ++(*it)->reads >= UNIX_FD_READS)
+        {
+            elem = *it;
+            *it = elem->next;
+            close(elem->fd);
+            free(elem);
+        }
+        else
+            it = &(*it)->next;
+    }
+    pthread_mutex_unlock(&fds_lock);
+}
+
+void unix_fd_drop(int conn)
+{
+    UNIX_FD **it, *elem;
+
+    pthread_mutex_lock(&fds_lock);
+    it = &received_fds;
+    while (*it != NULL)
+    {
+        if ((*it)->conn == conn)
+        {
+            elem = *it;
+            *it = elem->next;
+            close(elem->fd);
+            free(elem);
+        }
+        else
+            it = &(*it)->next;
+    }
+    pthread_mutex_unlock(&fds_lock);
+}
+
+char* unix_receive_message(int _conn, int* size)
+{
+    char* buf = (char*)malloc((UNIX_RECV_SIZE + 1) * sizeof(char));
+    char control[CMSG_SPACE(UNIX_MAX_FDS * sizeof(int))];
+
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = UNIX_RECV_SIZE;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t recvSize;
+    do {
+        recvSize = recvmsg(_conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (recvSize < 0 && errno == EINTR);
+
+    if (recvSize <= 0) {
+        free(buf);
+        if (on_disconnect_handler)
+            (*on_disconnect_handler)(thismodule,_conn);
+        else
+            com_connection_close(_conn);
+        return NULL;
+    }
+    buf[recvSize] = '\0';
+    *size = recvSize;
+
+    /*
+     * passed fds, before the bytes reach on_data. Truncated control
+     * data lost some of them: the ones that made it are not trusted
+     * to line up with the bytes and are closed.
+     */
+    int truncated = (msg.msg_flags & MSG_CTRUNC) != 0;
+    struct cmsghdr* cmsg;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int i, fd;
+        int nb_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < nb_fds; i++)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+            if (truncated)
+                close(fd);
+            else
+                unix_fd_push(_conn, fd);
+        }
+    }
+
+    return buf;
+}
+
+void unix_run_accept_thread(int serversock)
+{
+    int err;
+    int* serversock_ptr = (int*)malloc(sizeof(int));
+    *serversock_ptr = serversock;
+
+    pthread_t listenthread;
+    err = pthread_create(&listenthread, NULL, &unix_accept_function, (void*)serversock_ptr);
+    if (err != 0) {
+        return;
+    }
+    pthread_detach(listenthread);
+}
+
+void* unix_accept_function(void* serversock)
+{
+    int _serversock = *((int*)serversock);
+    free(serversock);
+
+    int peersock;
+    while (1) {
+        peersock = accept(_serversock, NULL, NULL);
+        if (peersock < 0) {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+        unix_run_receive_thread(peersock);
+    }
+    return NULL;
+}
+
+void unix_run_receive_thread(int conn)
+{
+    pthread_t rcvthread;
+    int err;
+    int* conn_ptr = (int*)malloc(sizeof(int));
+    *conn_ptr = conn;
+
+    if (on_connect_handler != NULL)
+        (*on_connect_handler)(thismodule,conn);
+
+    err = pthread_create(&rcvthread, NULL, &unix_receive_function, (void*)conn_ptr);
+    if (err != 0) {
+        return;
+    }
+    pthread_detach(rcvthread);
+}
+
+void* unix_receive_function(void* conn)
+{
+    int _conn = *((int*)conn);
+    free(conn);
+    if (_conn <= 0) {
+        return NULL;
+    }
+    char* buf;
+    int size = 0;
+    do {
+        /* read message */
+        buf = unix_receive_message(_conn, &size);
+
+        /* recv failed or disconnected */
+        if (buf == NULL)
+            return NULL;
+
+        /* apply message handler */
+        if (on_data_handler != NULL)
+            (*on_data_handler)(thismodule,_conn, buf, size);
+
+        /* fds nobody claimed with the bytes they came with */
+        unix_fd_age(_conn);
+
+        free(buf);
+
+    } while (1);
+    return NULL;
+}
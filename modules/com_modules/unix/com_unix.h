@@ -0,0 +1,37 @@
+/*
+ * com_unix.h
+ */
+
+#ifndef COM_UNIX_H_
+#define COM_UNIX_H_
+
+#define UNIX_ADDR_PREFIX	"unix:"
+#define UNIX_RECV_SIZE		4096
+#define UNIX_MAX_FDS		16 /* fds accepted with one read, and pending per conn */
+#define UNIX_FD_READS		2  /* reads an unclaimed fd is kept for */
+
+/*
+ * fd passing uses SCM_RIGHTS: the fd travels with the data bytes and
+ * is kept until com_recv_fd is called for that conn, from the on_data
+ * of those bytes or the next read's. Later it is closed.
+ */
+
+/* helper functions to figure out the address passed */
+int   unix_is_addr(const char *full_address);
+char* unix_get_path(const char *full_address);
+
+/* multithreading helper functions */
+void  unix_run_accept_thread(int serversock);
+void* unix_accept_function(void* conn);
+void  unix_run_receive_thread(int conn);
+void* unix_receive_function(void* conn);
+
+/* received fds waiting for com_recv_fd */
+void  unix_fd_push(int conn, int fd);
+void  unix_fd_age(int conn);
+void  unix_fd_drop(int conn);
+
+/* the actual receive data */
+char* unix_receive_message(int _conn, int* size);
+
+#endif
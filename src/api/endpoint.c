@@ -642,6 +642,22 @@ void endpoint_reset_accesss(ENDPOINT* endpoint, const char* subject)
             endpoint->id, subject, NULL);
 }
 
+void endpoint_set_validation(ENDPOINT* endpoint, const char* policy, int sample)
+{
+    char sample_str[12];
+    sprintf(sample_str, "%d", sample);
+    mw_call_module_function(
+            "core", "ep_set_validation", "voi",
+            endpoint->id, policy, sample_str, NULL);
+}
+
+char* endpoint_get_stats(ENDPOINT* endpoint)
+{
+    return mw_call_module_function_blocking(
+            "core", "ep_get_stats_____", "str",
+            endpoint->id, NULL);
+}
+
 JSON *ep_to_json(ENDPOINT* endpoint)
 {
 	if (!endpoint)
@@ -726,8 +742,8 @@ void endpoint_update_resp(ENDPOINT* ep, const char *resp_path)
 
 	/* endpoint update core */
 	mw_call_module_function(
-			"core", "update_resp", "voi",
-			ep->resp, NULL);
+			"core", "ep_update_resp___", "voi",
+			ep->id, ep->resp, NULL);
 }
 
 void endpoint_update_msg(ENDPOINT* ep, const char *msg_path)
@@ -740,8 +756,8 @@ void endpoint_update_msg(ENDPOINT* ep, const char *msg_path)
 
 	/* endpoint update core */
 	mw_call_module_function(
-			"core", "update_msg", "voi",
-			ep->msg, NULL);
+			"core", "ep_update_msg____", "voi",
+			ep->id, ep->msg, NULL);
 }
 
 
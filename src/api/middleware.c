@@ -18,6 +18,7 @@
 //#include "slog.h"
 #include "file.h"
 #include "sync.h"
+#include "frame_scan.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -54,6 +55,11 @@ int fds_blocking_call[2];
 
 /* main module to communicate with the core */
 COM_MODULE *sockpair_module;
+int ipc_mode = MW_IPC_SOCKPAIR;
+
+/* embedded core: library handle and its entry points */
+void* core_lib = NULL;
+char* (*core_call_fc)(const char*, const char*, const char*, const char**) = NULL;
 
 /* public app id to the core */
 char* app_name = NULL;
@@ -74,6 +80,12 @@ int stream_fd_global = 0;
 int core_spawn_addr(char* core_addr);
 int core_spawn_fd(int fds, char* core_addr);
 int core_spawn_fifo(char* app_name); // not used yet
+int core_load_embedded();
+char* mw_embedded_call(const char* module_id, const char* function_id,
+		const char* return_type, va_list arguments);
+
+int mw_send_call(const char* module_id, const char* function_id,
+		const char* return_type, const char* msg_id, va_list arguments);
 
 void api_on_data(COM_MODULE* module, int conn, const void * msg, unsigned int size);
 void api_on_connect(void* module, int conn);
@@ -81,6 +93,7 @@ void api_on_disconnect(void* module, int conn);
 
 void* api_on_message(void* data);
 void api_on_first_data(COM_MODULE* module, int conn, const void* msg, unsigned int size);
+void api_on_embedded_data(const void* msg, unsigned int size);
 
 /* message thread */
 typedef struct {
@@ -99,8 +112,7 @@ void api_thread_push(const char* msg_str);
 /* buffer stuff */
 
 typedef struct _BUFFER{
-	char* data;
-	int size;
+	FRAME_BUFFER frame;
 
 	int buffer_state;
 	int brackets;
@@ -108,17 +120,14 @@ typedef struct _BUFFER{
 
 BUFFER* api_buffer = NULL;
 
-void buffer_set(BUFFER* buffer, const void* new_buf, unsigned int new_start, unsigned int new_end);
-
 void buffer_update(BUFFER* buffer, const void* new_data, unsigned int new_size);
 
-void buffer_reset(BUFFER* buffer);
-
 /* functionality implementation */
 
 void atexit_cb()
 {
-	(*(sockpair_module->fc_connection_close))(app_core_conn);
+	if (sockpair_module != NULL)
+		(*(sockpair_module->fc_connection_close))(app_core_conn);
 
 #ifdef __ANDROID__
 	exit(0);
@@ -143,10 +152,11 @@ void int_handler(int sig)
 }
 
 
-char* mw_init(const char* cpt_name, int log_lvl, bool use_socketpair)
+char* mw_init(const char* cpt_name, int log_lvl, int ipc)
 {
 	//pthread_attr_setstacksize(1024);
 	app_name = strdup_null(cpt_name);
+	ipc_mode = ipc;
 	/* seed random for endpoint ids */
 	srand (time(NULL));
 
@@ -168,8 +178,7 @@ char* mw_init(const char* cpt_name, int log_lvl, bool use_socketpair)
 	}
 
 	api_buffer = (BUFFER*) malloc(sizeof(BUFFER));
-	api_buffer->data = NULL;
-	api_buffer->size = 0;
+	frame_buffer_init(&api_buffer->frame);
 	api_buffer->buffer_state = 0;
 	api_buffer->brackets = 0;
 
@@ -200,29 +209,40 @@ char* mw_init(const char* cpt_name, int log_lvl, bool use_socketpair)
 		exit(1);
 	}
 #else // __ANDROID__
-	if (use_socketpair)
+	if (ipc == MW_IPC_EMBEDDED)
+	{
+		if (core_load_embedded())
+			return NULL;
+		return app_name;
+	}
+	else if (ipc != MW_IPC_FIFO)
 	{
 		//int fds[2];
 		init_com_wrapper();
 
 #ifdef __linux__
-		sockpair_module = com_module_new(
-				"/usr/local/etc/middleware/com_modules/libcommodulesockpair.so",
-				"{\"is_server\":1}");
+		if (ipc == MW_IPC_SHM)
+			sockpair_module = com_module_new(
+					"/usr/local/etc/middleware/com_modules/libcommoduleshm.so",
+					"{\"is_server\":1}");
+		else
+			sockpair_module = com_module_new(
+					"/usr/local/etc/middleware/com_modules/libcommodulesockpair.so",
+					"{\"is_server\":1}");
 #elif __APPLE__
 		sockpair_module = com_module_new(
 				"/usr/local/etc/middleware/com_modules/libcommodulesockpair.so",
 				"{\"is_server\":1}");
 #endif
 
-		(*(sockpair_module->fc_set_on_data))((void (*)(void *, int, const void *, unsigned int))api_on_first_data);
-		(*(sockpair_module->fc_set_on_connect))(api_on_connect);
-		(*(sockpair_module->fc_set_on_disconnect))(api_on_disconnect);
-
 		if (sockpair_module == NULL)
 		{
 			return NULL;
 		}
+
+		(*(sockpair_module->fc_set_on_data))((void (*)(void *, int, const void *, unsigned int))api_on_first_data);
+		(*(sockpair_module->fc_set_on_connect))(api_on_connect);
+		(*(sockpair_module->fc_set_on_disconnect))(api_on_disconnect);
 		app_core_conn =(*(sockpair_module->fc_connect))(NULL);
 
 		core_spawn_fd(app_core_conn, app_name);
@@ -317,15 +337,77 @@ int mw_call_module_function2(
 	return result;
 }
 
-const char delim1 = '{';
-const char delim2 = '}';
-//const char delim_a = ' ';
-//const char delim_b = ',';
-const char* delim21 = "}{";
 const char* cmd = "15";
-const char* arg_start = "\"a\":{";
 
-char str[14];
+/*
+ * sends a call to the core as one vectored write:
+ * {{15}{module_id}{function_id}{return_type}{msg_id}{{size}arg...{0000000000}}}
+ */
+int mw_send_call(
+		const char* module_id,
+		const char* function_id,
+		const char* return_type,
+		const char* msg_id,
+		va_list arguments)
+{
+	va_list count_args;
+	int nb_args = 0;
+	va_copy(count_args, arguments);
+	while(va_arg(count_args, const char*) != NULL)
+		nb_args++;
+	va_end(count_args);
+
+	char head[64];
+	char sizes[nb_args > 0 ? nb_args : 1][14];
+	struct iovec iov[2*nb_args + 2];
+	int i, iovcnt = 0;
+
+	iov[iovcnt].iov_base = head;
+	iov[iovcnt].iov_len = sprintf(head, "{{%s}{%.4s}{%.17s}{%.3s}{%.10s}{",
+			cmd, module_id, function_id, return_type, msg_id);
+	iovcnt++;
+
+	for(i=0; i<nb_args; i++)
+	{
+		const char *tmp = va_arg(arguments, const char*);
+		iov[iovcnt].iov_base = sizes[i];
+		iov[iovcnt].iov_len = sprintf(sizes[i], "{%010lu}", strlen(tmp));
+		iovcnt++;
+		iov[iovcnt].iov_base = (void*)tmp;
+		iov[iovcnt].iov_len = strlen(tmp);
+		iovcnt++;
+	}
+
+	iov[iovcnt].iov_base = "{0000000000}}}";
+	iov[iovcnt].iov_len = 14;
+	iovcnt++;
+
+	return com_module_sendv(sockpair_module, app_core_conn, iov, iovcnt);
+}
+
+/* calls the in process core with the NULL terminated string arguments */
+char* mw_embedded_call(
+		const char* module_id,
+		const char* function_id,
+		const char* return_type,
+		va_list arguments)
+{
+	va_list count_args;
+	int nb_args = 0;
+	va_copy(count_args, arguments);
+	while(va_arg(count_args, const char*) != NULL)
+		nb_args++;
+	va_end(count_args);
+
+	const char* args[nb_args+1];
+	int i;
+	for(i=0; i<nb_args; i++)
+		args[i] = va_arg(arguments, const char*);
+	args[nb_args] = NULL;
+
+	return (*core_call_fc)(module_id, function_id, return_type, args);
+}
+
 int mw_call_module_function(
 		const char* module_id,
 		const char* function_id_,
@@ -339,42 +421,17 @@ int mw_call_module_function(
 
 	printf("Function ID: %s\n", function_id);
 
-	char *msg_id = message_generate_id();
-	(*(sockpair_module->fc_send))(app_core_conn, &delim1, 1);
-
-	(*(sockpair_module->fc_send))(app_core_conn, &delim1, 1);
-	(*(sockpair_module->fc_send))(app_core_conn, cmd, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, module_id, 4);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, function_id, 17);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, return_type, 3);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, msg_id, 10);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-
-
-	//(*(sockpair_module->fc_send))(app_core_conn, delim, 5);
-
 	va_list arguments;
 	va_start(arguments, return_type);
-	const char *tmp=va_arg(arguments, const char*);
-	while(tmp!=NULL){
-		sprintf(str, "{%010lu}", strlen(tmp));
-		(*(sockpair_module->fc_send))(app_core_conn, str, 12);
-		(*(sockpair_module->fc_send))(app_core_conn, tmp, strlen(tmp));
-
-		tmp=va_arg(arguments, const char*);
-		//if(tmp)
-		//	(*(sockpair_module->fc_send))(app_core_conn, &delim_b, 1);
+	if (core_call_fc != NULL)
+	{
+		free(mw_embedded_call(module_id, function_id, return_type, arguments));
+		va_end(arguments);
+		return 0;
 	}
 
-	sprintf(str, "{%010d}", 0);
-	(*(sockpair_module->fc_send))(app_core_conn, str, 12);
-	(*(sockpair_module->fc_send))(app_core_conn, &delim2, 1);
-	(*(sockpair_module->fc_send))(app_core_conn, &delim2, 1);
-
+	char *msg_id = message_generate_id();
+	mw_send_call(module_id, function_id, return_type, msg_id, arguments);
 	va_end(arguments);
 
 	free(msg_id);
@@ -445,41 +502,18 @@ void* mw_call_module_function_blocking(
 	char function_id[18] = {[0 ...sizeof(function_id)-2]='_', [sizeof(function_id)-1] = '\0'}; // Length 17
 	strncpy(function_id, function_id_, strlen(function_id_) < strlen(function_id) ? strlen(function_id_) : strlen(function_id));
 
-	char *msg_id = message_generate_id();
-	(*(sockpair_module->fc_send))(app_core_conn, &delim1, 1);
-
-	(*(sockpair_module->fc_send))(app_core_conn, &delim1, 1);
-	(*(sockpair_module->fc_send))(app_core_conn, cmd, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, module_id, 4);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, function_id, 17);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, return_type, 3);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_core_conn, msg_id, 10);
-	(*(sockpair_module->fc_send))(app_core_conn, delim21, 2);
-
-	//(*(sockpair_module->fc_send))(app_core_conn, arg_start, 5);
-
 	va_list arguments;
 	va_start(arguments, return_type);
-	const char *tmp=va_arg(arguments, const char*);
-	while(tmp!=NULL){
-		sprintf(str, "{%010lu}", strlen(tmp));
-		(*(sockpair_module->fc_send))(app_core_conn, str, 12);
-		(*(sockpair_module->fc_send))(app_core_conn, tmp, strlen(tmp));
-
-		tmp=va_arg(arguments, const char*);
-		//if(tmp)
-		//	(*(sockpair_module->fc_send))(app_core_conn, &delim_b, 1);
+	if (core_call_fc != NULL)
+	{
+		/* the result comes back directly: nothing to wait for */
+		char* result = mw_embedded_call(module_id, function_id, return_type, arguments);
+		va_end(arguments);
+		return result;
 	}
 
-	sprintf(str, "{%010d}", 0);
-	(*(sockpair_module->fc_send))(app_core_conn, str, 12);
-	(*(sockpair_module->fc_send))(app_core_conn, &delim2, 1);
-	(*(sockpair_module->fc_send))(app_core_conn, &delim2, 1);
-
+	char *msg_id = message_generate_id();
+	mw_send_call(module_id, function_id, return_type, msg_id, arguments);
 	va_end(arguments);
 
 	strcpy(blocking_msg_id, msg_id);
@@ -667,12 +701,20 @@ int core_spawn_fd(int fds, char* app_name)
 		char fd_str[11];
 		snprintf(fd_str, 11, "%d", core_fd);
 
+		/* tell the core which module to attach to the fd with */
+		char* ipc_name = (ipc_mode == MW_IPC_SHM) ? "shm" : "sockpair";
+
+		/* the fds the core inherits, close on exec elsewhere */
+		if (sockpair_module->fc_before_exec != NULL)
+			(*(sockpair_module->fc_before_exec))();
+
 		char* args[] = {"core",
 		//char* args[] = {"valgrind", "--leak-check=yes", "core",
 				"-f", fd_str,
 				"-a", app_name,
 				"-k", rand_key,
 				"-c", config_get_absolute_path(),
+				"-i", ipc_name,
 				NULL};
 		const char* path = "core";
 		//const char* path = "/usr/bin/valgrind";
@@ -700,6 +742,49 @@ int core_spawn_fd(int fds, char* app_name)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * loads the core library into this process instead of spawning it.
+ * RTLD_DEEPBIND keeps the core's globals (endpoints, buffers, handlers)
+ * apart from the ones with the same names in the api.
+ */
+int core_load_embedded()
+{
+	int flags = RTLD_NOW | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+	flags |= RTLD_DEEPBIND;
+#endif
+
+	core_lib = dlopen(CORE_LIB, flags);
+	if (core_lib == NULL)
+	{
+		printf("MW: Could not load the core library: %s\n", dlerror());
+		return EXIT_FAILURE;
+	}
+
+	int (*init_fc)(const char*, const char*, const char*, void (*)(const void*, unsigned int));
+	*(void**)(&init_fc) = dlsym(core_lib, "core_embedded_init");
+	*(void**)(&core_call_fc) = dlsym(core_lib, "core_embedded_call");
+	if (init_fc == NULL || core_call_fc == NULL)
+	{
+		printf("MW: Bad core library: %s\n", CORE_LIB);
+		core_call_fc = NULL;
+		dlclose(core_lib);
+		core_lib = NULL;
+		return EXIT_FAILURE;
+	}
+
+	if ((*init_fc)(app_name, rand_key, config_get_absolute_path(), api_on_embedded_data))
+	{
+		core_call_fc = NULL;
+		return EXIT_FAILURE;
+	}
+
+	atexit(atexit_app);
+	api_thread_create();
+
+	return EXIT_SUCCESS;
+}
+
 int core_spawn_fifo(char* app_name)
 {
 	int core_pid = fork();
@@ -842,155 +927,33 @@ void api_on_data(COM_MODULE* module, int conn, const void* data, unsigned int si
 	buffer_update(api_buffer, data, size);
 }
 
-
-#define BUFFER_FINAL 	0
-#define BUFFER_JSON  	1
-#define BUFFER_STR_2 	2
-#define BUFFER_ESC_2 	3
-#define BUFFER_STR_1 	4
-#define BUFFER_ESC_1 	5
-
-void buffer_set(BUFFER* buffer, const void* new_buf, unsigned int new_start, unsigned int new_end)
+/* embedded core: whole frames, already serialised by the core */
+void api_on_embedded_data(const void* data, unsigned int size)
 {
-	char* old_buf = buffer->data;
-	int new_size = new_end-new_start;
-	buffer->data = (char*) malloc(buffer->size + new_size + 1);
-	memcpy(buffer->data,             old_buf,           buffer->size);
-	memcpy(buffer->data+buffer->size, new_buf+new_start, new_size   );
-	buffer->size = buffer->size + new_size;
-	buffer->data[buffer->size] = '\0';
-
-	//printf("----buffer set %d %d %d: %s\n\n", new_start, new_end, buffer->size, buffer->data);
-	free(old_buf);
+	buffer_update(api_buffer, data, size);
 }
 
-void buffer_reset(BUFFER* buffer)
-{
-	if(buffer->data)
-		free(buffer->data);
-
-	buffer->data = (char*)(malloc(1));
-	buffer->data[0]='\0';
-}
 
 void buffer_update(BUFFER* buffer, const void* new_data, unsigned int new_size)
 {
-	unsigned int i=0;
-	unsigned int word_start = i;
-	unsigned int word_end = i;
-	for(i=0; i<new_size; i++)
+	unsigned int i = 0;
+	unsigned int word_start = 0;
+
+	while(i < new_size)
 	{
-		switch(buffer->buffer_state){
-			case BUFFER_FINAL:
-				switch (((char*)new_data)[i])
-				{
-					case '{':
-						buffer->brackets += 1;
-						word_start = i;
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					/* ignore spaces and new lines */
-					case ' ': case '\n': case '\r':
-						break;
-					default:
-						//slog(SLOG_ERROR, "%c", new_data[i]);
-						continue;
-
-				}
-				break;
-
-			case BUFFER_JSON:
-				switch (((char*)new_data)[i])
-				{
-					case '{':
-						buffer->brackets += 1;
-						//data->buffer_state = 1;
-						break;
-					case '}':
-						buffer->brackets -= 1;
-
-						if(buffer->brackets == 0) // finished 1 word
-					 	{
-							buffer->buffer_state = BUFFER_FINAL;
-							word_end = i+1;
-							buffer_set(buffer, new_data, word_start, word_end);
-							/* apply the callback for this connection */
-
-
-							/*char* new_data = strdup(buffer->data);
-							pthread_t cbthread;
-							int err;
-							err = pthread_create(&cbthread, NULL, &api_on_message, new_data);
-							if(err != 0) {
-								slog(SLOG_ERROR, "CONN buffer_update: can't create receive thread");
-								goto skip;
-							}
-							err = pthread_detach(cbthread);
-							if(err != 0) {
-								slog(SLOG_ERROR, "CONN buffer_update: Could not detach cb thread");
-								goto skip;
-							}
-							skip:*/
-
-							api_on_message(buffer->data);
-
-							buffer_reset(buffer);
-
-							buffer->size = 0;
-							word_start = i+1;
-						}
-
-						break;
-					case '\"':
-						buffer->buffer_state = BUFFER_STR_2;
-						break;
-					case '\'':
-						buffer->buffer_state = BUFFER_STR_1;
-						break;
-
-					default:
-						continue;
-				}
-				break;
-			case BUFFER_STR_1:
-				switch (((char*)new_data)[i])
-				{
-					case '\\':
-						buffer->buffer_state = BUFFER_ESC_1;
-						break;
-					case '\'':
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					default:
-						continue;
-				}
-				break;
-			case BUFFER_ESC_1:
-				buffer->buffer_state = BUFFER_STR_1;
-				break;
-			case BUFFER_STR_2:
-				switch (((char*)new_data)[i])
-				{
-					case '\\':
-						buffer->buffer_state = BUFFER_ESC_2;
-						break;
-					case '\"':
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					default:
-						continue;
-				}
-				break;
-			case BUFFER_ESC_2:
-				buffer->buffer_state = BUFFER_STR_2;
-				break;
-			default: //impossible
-				return;
-		}
+		if(frame_scan(&buffer->buffer_state, &buffer->brackets, new_data,
+				&i, new_size, &word_start, FRAME_SCAN_NO_STOP) != FRAME_SCAN_FRAME)
+			break;
+
+		/* finished 1 word: apply the callback */
+		frame_buffer_append(&buffer->frame, new_data, word_start, i);
+		api_on_message(buffer->frame.data);
+		frame_buffer_reset(&buffer->frame);
+		word_start = i;
 	}
 
 	if(word_start<new_size && buffer->buffer_state != BUFFER_FINAL)
-		buffer_set(buffer, new_data, word_start, new_size);
+		frame_buffer_append(&buffer->frame, new_data, word_start, new_size);
 }
 
 void api_thread_create() {
@@ -26,10 +26,12 @@
 #elif __APPLE__ // __ANDROID_
 #define ETC "/usr/local/etc/middleware/"
 #define BIN "/usr/local/bin/"
+#define CORE_LIB "/usr/local/lib/libmiddleware_core.dylib"
 
 #else // __APPLE__
 #define ETC "/usr/local/etc/middleware/"
 #define BIN "/usr/local/bin/"
+#define CORE_LIB "/usr/local/lib/libmiddleware_core.so"
 #endif // __ANDROID__
 
 
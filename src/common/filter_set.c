@@ -0,0 +1,262 @@
+/*
+ * filter_set.c
+ */
+
+#include "filter_set.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+FILTER_SET* filter_set_new()
+{
+	FILTER_SET* set = (FILTER_SET*)malloc(sizeof(FILTER_SET));
+	pthread_mutex_init(&set->lock, NULL);
+	set->members = array_new(ELEM_TYPE_PTR);
+	set->props = map_new(KEY_TYPE_STR);
+	set->prop_list = array_new(ELEM_TYPE_PTR);
+	set->filtered = 0;
+
+	return set;
+}
+
+void filter_prop_free(FILTER_PROP* fprop)
+{
+	int i, j;
+	Array* tests;
+	Array* values = map_get_values(fprop->equals);
+	for(i=0; values != NULL && i<array_size(values); i++)
+	{
+		tests = array_get(values, i);
+		for(j=0; j<array_size(tests); j++)
+			free(array_get(tests, j));
+		array_free(tests);
+	}
+	array_free(values);
+	map_free(fprop->equals);
+
+	for(i=0; i<array_size(fprop->tests); i++)
+		free(array_get(fprop->tests, i));
+	array_free(fprop->tests);
+
+	free(fprop);
+}
+
+/* drops the property index; with set->lock held */
+void filter_set_reset_props(FILTER_SET* set)
+{
+	int i;
+	for(i=0; i<array_size(set->prop_list); i++)
+		filter_prop_free(array_get(set->prop_list, i));
+	array_free(set->prop_list);
+	map_free(set->props);
+
+	set->props = map_new(KEY_TYPE_STR);
+	set->prop_list = array_new(ELEM_TYPE_PTR);
+}
+
+/* indexes the filters of one member; with set->lock held */
+void filter_set_index(FILTER_SET* set, FILTER_MEMBER* fmember)
+{
+	int i;
+	JSON_FILTER* filter;
+	FILTER_PROP* fprop;
+	FILTER_TEST* test;
+	Array* tests;
+
+	for(i=0; fmember->filters != NULL && i<array_size(fmember->filters); i++)
+	{
+		filter = array_get(fmember->filters, i);
+		/* unparsed filters are never hit */
+		if(filter == NULL || filter->type == JSON_FILTER_NONE || filter->prop == NULL)
+			continue;
+
+		fprop = map_get(set->props, (void*)filter->prop);
+		if(fprop == NULL)
+		{
+			fprop = (FILTER_PROP*)malloc(sizeof(FILTER_PROP));
+			fprop->prop = filter->prop;
+			fprop->equals = map_new(KEY_TYPE_STR);
+			fprop->tests = array_new(ELEM_TYPE_PTR);
+			map_insert(set->props, (void*)filter->prop, fprop);
+			array_add(set->prop_list, fprop);
+		}
+
+		test = (FILTER_TEST*)malloc(sizeof(FILTER_TEST));
+		test->filter = filter;
+		test->member = fmember;
+
+		if(filter->type == JSON_FILTER_STRING && filter->sign == '=')
+		{
+			tests = map_get(fprop->equals, filter->value);
+			if(tests == NULL)
+			{
+				tests = array_new(ELEM_TYPE_PTR);
+				map_insert(fprop->equals, filter->value, tests);
+			}
+			array_add(tests, test);
+		}
+		else
+			array_add(fprop->tests, test);
+	}
+}
+
+void filter_set_free(FILTER_SET* set)
+{
+	if(set == NULL)
+		return;
+
+	filter_set_clear(set);
+	pthread_mutex_lock(&set->lock);
+	array_free(set->members);
+	array_free(set->prop_list);
+	map_free(set->props);
+	pthread_mutex_unlock(&set->lock);
+	pthread_mutex_destroy(&set->lock);
+
+	free(set);
+}
+
+int filter_set_add(FILTER_SET* set, void* member, Array* filters)
+{
+	if(set == NULL || member == NULL)
+		return -1;
+
+	FILTER_MEMBER* fmember = (FILTER_MEMBER*)malloc(sizeof(FILTER_MEMBER));
+	fmember->member = member;
+	fmember->filters = filters;
+	fmember->needed = filters ? array_size(filters) : 0;
+	fmember->hits = 0;
+
+	pthread_mutex_lock(&set->lock);
+	array_add(set->members, fmember);
+	if(fmember->needed > 0)
+		set->filtered++;
+	filter_set_index(set, fmember);
+	pthread_mutex_unlock(&set->lock);
+
+	return 0;
+}
+
+int filter_set_remove(FILTER_SET* set, void* member)
+{
+	if(set == NULL || member == NULL)
+		return -1;
+
+	int i;
+	FILTER_MEMBER* fmember = NULL;
+
+	pthread_mutex_lock(&set->lock);
+	for(i=0; i<array_size(set->members); i++)
+	{
+		fmember = array_get(set->members, i);
+		if(fmember->member == member)
+		{
+			array_remove_index(set->members, i);
+			break;
+		}
+		fmember = NULL;
+	}
+	if(fmember == NULL)
+	{
+		pthread_mutex_unlock(&set->lock);
+		return -1;
+	}
+
+	if(fmember->needed > 0)
+	{
+		/* mappings change rarely, rebuild the index of the rest */
+		set->filtered--;
+		filter_set_reset_props(set);
+		for(i=0; i<array_size(set->members); i++)
+			filter_set_index(set, array_get(set->members, i));
+	}
+	free(fmember);
+	pthread_mutex_unlock(&set->lock);
+
+	return 0;
+}
+
+void filter_set_clear(FILTER_SET* set)
+{
+	if(set == NULL)
+		return;
+
+	int i;
+	pthread_mutex_lock(&set->lock);
+	filter_set_reset_props(set);
+	for(i=0; i<array_size(set->members); i++)
+		free(array_get(set->members, i));
+	array_free(set->members);
+	set->members = array_new(ELEM_TYPE_PTR);
+	set->filtered = 0;
+	pthread_mutex_unlock(&set->lock);
+}
+
+int filter_set_filtered(FILTER_SET* set)
+{
+	if(set == NULL)
+		return 0;
+
+	pthread_mutex_lock(&set->lock);
+	int filtered = set->filtered > 0;
+	pthread_mutex_unlock(&set->lock);
+
+	return filtered;
+}
+
+Array* filter_set_match(FILTER_SET* set, JSON* json)
+{
+	if(set == NULL)
+		return NULL;
+
+	int i, j;
+	FILTER_MEMBER* fmember;
+	FILTER_PROP* fprop;
+	FILTER_TEST* test;
+	Array* tests;
+	const char* str;
+	double number = 0;
+	int has_number;
+	Array* matches = array_new(ELEM_TYPE_PTR);
+
+	pthread_mutex_lock(&set->lock);
+	for(i=0; i<array_size(set->members); i++)
+	{
+		fmember = array_get(set->members, i);
+		fmember->hits = 0;
+	}
+
+	for(i=0; json != NULL && i<array_size(set->prop_list); i++)
+	{
+		fprop = array_get(set->prop_list, i);
+		str = json_peek_str(json, fprop->prop);
+		has_number = (str == NULL) && json_peek_number(json, fprop->prop, &number);
+
+		if(str != NULL)
+		{
+			tests = map_get(fprop->equals, (void*)str);
+			for(j=0; tests != NULL && j<array_size(tests); j++)
+			{
+				test = array_get(tests, j);
+				test->member->hits++;
+			}
+		}
+
+		for(j=0; j<array_size(fprop->tests); j++)
+		{
+			test = array_get(fprop->tests, j);
+			if(json_filter_match_value(test->filter, str, has_number, number))
+				test->member->hits++;
+		}
+	}
+
+	for(i=0; i<array_size(set->members); i++)
+	{
+		fmember = array_get(set->members, i);
+		if(fmember->needed == 0 || (json != NULL && fmember->hits == fmember->needed))
+			array_add(matches, fmember->member);
+	}
+	pthread_mutex_unlock(&set->lock);
+
+	return matches;
+}
@@ -0,0 +1,61 @@
+/*
+ * filter_set.h
+ */
+
+#ifndef COMMON_FILTER_SET_H_
+#define COMMON_FILTER_SET_H_
+
+#include "json_filter.h"
+#include "array.h"
+#include "hashmap.h"
+
+#include <pthread.h>
+
+/*
+ * The compiled filters of many members (the mappings of an endpoint)
+ * grouped by property: string equalities on a value lookup, the other
+ * tests in a list per property. One pass over a message reads each
+ * property once and yields every member whose filters all hold.
+ */
+
+typedef struct _FILTER_MEMBER{
+	void* member;
+	Array* filters;		/* JSON_FILTER*, owned by the caller */
+	unsigned int needed;	/* filters to satisfy */
+	unsigned int hits;	/* satisfied in the current pass */
+}FILTER_MEMBER;
+
+typedef struct _FILTER_TEST{
+	JSON_FILTER* filter;
+	FILTER_MEMBER* member;
+}FILTER_TEST;
+
+typedef struct _FILTER_PROP{
+	const char* prop;	/* borrowed from one of its filters */
+	HashMap* equals;	/* value -> Array of FILTER_TEST* */
+	Array* tests;		/* FILTER_TEST*, everything but string equality */
+}FILTER_PROP;
+
+typedef struct _FILTER_SET{
+	pthread_mutex_t lock;
+	Array* members;		/* FILTER_MEMBER* */
+	HashMap* props;		/* prop name -> FILTER_PROP* */
+	Array* prop_list;	/* the same FILTER_PROP*, walked on match */
+	unsigned int filtered;	/* members with at least one filter */
+}FILTER_SET;
+
+FILTER_SET* filter_set_new();
+void filter_set_free(FILTER_SET* set);
+
+/* @filters: Array of JSON_FILTER*, kept until the member is removed; may be NULL */
+int filter_set_add(FILTER_SET* set, void* member, Array* filters);
+int filter_set_remove(FILTER_SET* set, void* member);
+void filter_set_clear(FILTER_SET* set);
+
+/* does any member have filters; if not every member matches everything */
+int filter_set_filtered(FILTER_SET* set);
+
+/* the members @json satisfies, Array of void*; to be array_free'd */
+Array* filter_set_match(FILTER_SET* set, JSON* json);
+
+#endif /* COMMON_FILTER_SET_H_ */
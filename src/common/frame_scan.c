@@ -0,0 +1,253 @@
+/*
+ * frame_scan.c
+ */
+
+#include "frame_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FRAME_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* bytes that may change the scanner state */
+static int is_special(unsigned char c, int stop_byte)
+{
+	return c == '{' || c == '}' || c == '"' || c == '\'' || c == '\\'
+			|| c == stop_byte;
+}
+
+static unsigned int scan_skip_scalar(const unsigned char* data,
+		unsigned int i, unsigned int end, int stop_byte)
+{
+	while(i < end && !is_special(data[i], stop_byte))
+		i++;
+	return i;
+}
+
+#ifdef FRAME_SCAN_X86
+
+#ifdef __SSE2__
+static unsigned int scan_skip_sse2(const unsigned char* data,
+		unsigned int i, unsigned int end, int stop_byte)
+{
+	const __m128i lb = _mm_set1_epi8('{');
+	const __m128i rb = _mm_set1_epi8('}');
+	const __m128i dq = _mm_set1_epi8('"');
+	const __m128i sq = _mm_set1_epi8('\'');
+	const __m128i bs = _mm_set1_epi8('\\');
+	/* with no stop byte repeat one of the others */
+	const __m128i sb = _mm_set1_epi8(stop_byte < 0 ? '{' : (char)stop_byte);
+
+	while(i + 16 <= end)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i m = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, lb), _mm_cmpeq_epi8(v, rb)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, dq), _mm_cmpeq_epi8(v, sq)));
+		m = _mm_or_si128(m,
+				_mm_or_si128(_mm_cmpeq_epi8(v, bs), _mm_cmpeq_epi8(v, sb)));
+
+		int mask = _mm_movemask_epi8(m);
+		if(mask)
+			return i + __builtin_ctz(mask);
+		i += 16;
+	}
+	return scan_skip_scalar(data, i, end, stop_byte);
+}
+#endif
+
+__attribute__((target("avx2")))
+static unsigned int scan_skip_avx2(const unsigned char* data,
+		unsigned int i, unsigned int end, int stop_byte)
+{
+	const __m256i lb = _mm256_set1_epi8('{');
+	const __m256i rb = _mm256_set1_epi8('}');
+	const __m256i dq = _mm256_set1_epi8('"');
+	const __m256i sq = _mm256_set1_epi8('\'');
+	const __m256i bs = _mm256_set1_epi8('\\');
+	const __m256i sb = _mm256_set1_epi8(stop_byte < 0 ? '{' : (char)stop_byte);
+
+	while(i + 32 <= end)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i m = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, lb), _mm256_cmpeq_epi8(v, rb)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, dq), _mm256_cmpeq_epi8(v, sq)));
+		m = _mm256_or_si256(m,
+				_mm256_or_si256(_mm256_cmpeq_epi8(v, bs), _mm256_cmpeq_epi8(v, sb)));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+		if(mask)
+			return i + __builtin_ctz(mask);
+		i += 32;
+	}
+	return scan_skip_scalar(data, i, end, stop_byte);
+}
+
+#endif /* FRAME_SCAN_X86 */
+
+/* picks the widest kernel the cpu supports, once */
+static unsigned int scan_skip(const unsigned char* data,
+		unsigned int i, unsigned int end, int stop_byte)
+{
+#ifdef FRAME_SCAN_X86
+	static int has_avx2 = -1;
+	if(has_avx2 < 0)
+	{
+		__builtin_cpu_init();
+		has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	if(has_avx2)
+		return scan_skip_avx2(data, i, end, stop_byte);
+#ifdef __SSE2__
+	return scan_skip_sse2(data, i, end, stop_byte);
+#endif
+#endif
+	return scan_skip_scalar(data, i, end, stop_byte);
+}
+
+int frame_scan(int* state, int* brackets, const void* buf,
+		unsigned int* pos, unsigned int end,
+		unsigned int* frame_start, int stop_byte)
+{
+	const unsigned char* data = (const unsigned char*)buf;
+	unsigned int i = *pos;
+	unsigned char c;
+
+	while(i < end)
+	{
+		/* the escaped byte is consumed whatever it is */
+		if(*state == BUFFER_ESC_1 || *state == BUFFER_ESC_2)
+		{
+			*state = (*state == BUFFER_ESC_1) ? BUFFER_STR_1 : BUFFER_STR_2;
+			i++;
+			continue;
+		}
+
+		i = scan_skip(data, i, end, stop_byte);
+		if(i >= end)
+			break;
+
+		c = data[i];
+		switch(*state)
+		{
+			case BUFFER_FINAL:
+				if(c == '{')
+				{
+					*brackets += 1;
+					*frame_start = i;
+					*state = BUFFER_JSON;
+				}
+				else if(c == stop_byte)
+				{
+					*pos = i;
+					return FRAME_SCAN_STOP;
+				}
+				break;
+
+			case BUFFER_JSON:
+				switch(c)
+				{
+					case '{':
+						*brackets += 1;
+						break;
+					case '}':
+						*brackets -= 1;
+						if(*brackets == 0) /* finished 1 word */
+						{
+							*state = BUFFER_FINAL;
+							*pos = i+1;
+							return FRAME_SCAN_FRAME;
+						}
+						break;
+					case '"':
+						*state = BUFFER_STR_2;
+						break;
+					case '\'':
+						*state = BUFFER_STR_1;
+						break;
+				}
+				break;
+
+			case BUFFER_STR_1:
+				if(c == '\\')
+					*state = BUFFER_ESC_1;
+				else if(c == '\'')
+					*state = BUFFER_JSON;
+				break;
+
+			case BUFFER_STR_2:
+				if(c == '\\')
+					*state = BUFFER_ESC_2;
+				else if(c == '"')
+					*state = BUFFER_JSON;
+				break;
+
+			default: /* impossible */
+				*pos = end;
+				return FRAME_SCAN_END;
+		}
+		i++;
+	}
+
+	*pos = end;
+	return FRAME_SCAN_END;
+}
+
+void frame_buffer_init(FRAME_BUFFER* frame)
+{
+	frame->data = NULL;
+	frame->size = 0;
+	frame->capacity = 0;
+}
+
+void frame_buffer_free(FRAME_BUFFER* frame)
+{
+	free(frame->data);
+	frame_buffer_init(frame);
+}
+
+/* grows the buffer by doubling */
+int frame_buffer_reserve(FRAME_BUFFER* frame, unsigned int size)
+{
+	if(size < frame->capacity)
+		return 0;
+
+	unsigned int capacity = frame->capacity ? frame->capacity : FRAME_BUFFER_INIT_CAPACITY;
+	while(capacity <= size)
+		capacity *= 2;
+
+	char* data = (char*) realloc(frame->data, capacity);
+	if(data == NULL)
+		return -1;
+
+	frame->data = data;
+	frame->capacity = capacity;
+	return 0;
+}
+
+void frame_buffer_append(FRAME_BUFFER* frame, const void* data,
+		unsigned int start, unsigned int end)
+{
+	unsigned int size = end - start;
+	if(frame_buffer_reserve(frame, frame->size + size) != 0)
+		return;
+
+	memcpy(frame->data + frame->size, (const char*)data + start, size);
+	frame->size += size;
+	frame->data[frame->size] = '\0';
+}
+
+void frame_buffer_reset(FRAME_BUFFER* frame)
+{
+	/* give back what an unusually large frame took */
+	if(frame->capacity > FRAME_BUFFER_MAX_IDLE_CAPACITY)
+		frame_buffer_free(frame);
+
+	frame->size = 0;
+	if(frame_buffer_reserve(frame, 0) == 0)
+		frame->data[0] = '\0';
+}
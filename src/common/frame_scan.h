@@ -0,0 +1,62 @@
+/*
+ * frame_scan.h
+ *
+ * Brace/quote/escape scanner used to cut json messages out of a stream.
+ * Shared by the core (state.c) and the api (middleware.c) buffers.
+ */
+
+#ifndef FRAME_SCAN_H_
+#define FRAME_SCAN_H_
+
+/* scanner states, kept in BUFFER.buffer_state */
+#define BUFFER_FINAL 	0
+#define BUFFER_JSON  	1
+#define BUFFER_STR_2 	2
+#define BUFFER_ESC_2 	3
+#define BUFFER_STR_1 	4
+#define BUFFER_ESC_1 	5
+
+/* frame_scan results */
+#define FRAME_SCAN_END		0 /* all data consumed, no frame completed */
+#define FRAME_SCAN_FRAME	1 /* a top level object closed just before *pos */
+#define FRAME_SCAN_STOP		2 /* stop_byte found at *pos between frames */
+
+#define FRAME_SCAN_NO_STOP	-1
+
+#define FRAME_BUFFER_INIT_CAPACITY		1024
+#define FRAME_BUFFER_MAX_IDLE_CAPACITY	(1024*1024)
+
+/* the bytes of the frame being cut, kept '\0' terminated */
+typedef struct _FRAME_BUFFER{
+	char* data;
+	int size;
+	unsigned int capacity; /* allocated, doubles as needed */
+}FRAME_BUFFER;
+
+/*
+ * Runs the state machine over data[*pos..end).
+ * Bytes that cannot change the state are skipped 16 or 32 at a time
+ * with SSE2/AVX2 when available.
+ * @state, brackets: scanner state, carried between calls
+ * @frame_start: set to the position of the '{' opening a new frame
+ * @stop_byte: byte that ends scanning in BUFFER_FINAL, or FRAME_SCAN_NO_STOP
+ * @return: FRAME_SCAN_*; *pos is updated accordingly
+ */
+int frame_scan(int* state, int* brackets, const void* data,
+		unsigned int* pos, unsigned int end,
+		unsigned int* frame_start, int stop_byte);
+
+void frame_buffer_init(FRAME_BUFFER* frame);
+void frame_buffer_free(FRAME_BUFFER* frame);
+
+/* room for @size bytes plus '\0'; 0 or -1 if out of memory */
+int frame_buffer_reserve(FRAME_BUFFER* frame, unsigned int size);
+
+/* appends data[start..end) */
+void frame_buffer_append(FRAME_BUFFER* frame, const void* data,
+		unsigned int start, unsigned int end);
+
+/* empties the buffer and keeps its memory for the next frame */
+void frame_buffer_reset(FRAME_BUFFER* frame);
+
+#endif /* FRAME_SCAN_H_ */
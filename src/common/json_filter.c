@@ -12,78 +12,222 @@
 #include <string.h>
 #include <utils.h>
 
-typedef struct __json_path{
-	int type;
-	char* prop;
-	char* sign;
-	char* value;
-}_json_path;
+#include <stdlib.h>
+#include <pthread.h>
 
-_json_path* _json_path_new(const char* path)
+/* property names of the local compiled filters, each stored once */
+HashMap* filter_props = NULL;
+pthread_mutex_t filter_props_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char* json_filter_intern(const char* prop)
 {
-	_json_path* jp = (_json_path*)malloc(sizeof(_json_path));
-	char* path_dup = strdup_null(path);
+	pthread_mutex_lock(&filter_props_lock);
+	if(filter_props == NULL)
+		filter_props = map_new(KEY_TYPE_STR);
 
-	jp->prop = strdup_null(strtok (path_dup, " "));
+	char* interned = map_get(filter_props, (void*)prop);
+	if(interned == NULL)
+	{
+		interned = strdup(prop);
+		map_insert(filter_props, interned, interned);
+	}
+	pthread_mutex_unlock(&filter_props_lock);
 
-	jp->sign = strdup_null(strtok (NULL, " "));
+	return interned;
+}
 
-	jp->value = strdup_null(strtok (NULL, " "));
-	free(path_dup);
+/* "prop sign value"; a quoted value is a string, otherwise a number */
+JSON_FILTER* json_filter_compile_prop(const char* path, int intern)
+{
+	JSON_FILTER* filter = (JSON_FILTER*)malloc(sizeof(JSON_FILTER));
+	filter->type = JSON_FILTER_NONE;
+	filter->prop = NULL;
+	filter->interned = intern;
+	filter->sign = 0;
+	filter->number = 0;
+	filter->value = NULL;
+
+	if(path == NULL)
+		return filter;
+
+	char* path_dup = strdup(path);
+	char* saveptr = NULL;
+	char* prop = strtok_r(path_dup, " ", &saveptr);
+	char* sign = strtok_r(NULL, " ", &saveptr);
+	char* value = saveptr;
+
+	while(value != NULL && *value == ' ')
+		value++;
+	if(prop == NULL || sign == NULL || value == NULL || *value == '\0')
+		goto final;
+
+	/* trailing spaces */
+	int n = strlen(value);
+	while(n > 0 && value[n-1] == ' ')
+		n--;
+	value[n] = '\0';
+
+	filter->prop = intern ? json_filter_intern(prop) : strdup(prop);
+	filter->sign = sign[0];
+
+	if(n >= 2 && value[0] == '\'' && value[n-1] == '\'')
+	{
+		value[n-1] = '\0';
+		filter->value = strdup(value+1);
+		filter->type = JSON_FILTER_STRING;
+	}
+	else
+	{
+		filter->number = strtod(value, NULL);
+		filter->type = JSON_FILTER_NUMBER;
+	}
 
-	jp->type = 0;
-	int n = strlen(jp->value);
-	if(n>=2)
-		if((jp->value)[0] == '\'' && (jp->value)[n-1] == '\'')
-		{
-			char* temp = jp->value;
-			jp->value = malloc(n-1);
-			strncpy(jp->value, temp+1, n-2);
-			jp->value[n-2] = '\0';
-			jp->type = 1;
-			free(temp);
-		}
+	final:
+	{
+		free(path_dup);
+		return filter;
+	}
+}
+
+JSON_FILTER* json_filter_compile(const char* path)
+{
+	return json_filter_compile_prop(path, 0);
+}
 
-	return jp;
+JSON_FILTER* json_filter_compile_local(const char* path)
+{
+	return json_filter_compile_prop(path, 1);
 }
 
-void _json_path_free(_json_path* jp)
+void json_filter_free(JSON_FILTER* filter)
 {
-	if(jp == NULL)
+	if(filter == NULL)
 		return;
 
-	free(jp->prop);
-	free(jp->sign);
-	free(jp->value);
-	free(jp);
+	if(!filter->interned)
+		free((char*)filter->prop);
+	free(filter->value);
+	free(filter);
 }
 
-int _has_path(JSON* json, _json_path* path)
+Array* json_filter_compile_array_prop(Array* paths, int intern)
 {
-	/* if number */
-	if(path->type == 0)
+	Array* filters = array_new(ELEM_TYPE_PTR);
+	if(paths == NULL)
+		return filters;
+
+	int i;
+	for(i = 0; i< array_size(paths); i++)
+		array_add(filters, json_filter_compile_prop(array_get(paths, i), intern));
+
+	return filters;
+}
+
+Array* json_filter_compile_array(Array* paths)
+{
+	return json_filter_compile_array_prop(paths, 0);
+}
+
+Array* json_filter_compile_array_local(Array* paths)
+{
+	return json_filter_compile_array_prop(paths, 1);
+}
+
+void json_filter_free_array(Array* filters)
+{
+	if(filters == NULL)
+		return;
+
+	int i;
+	for(i = 0; i< array_size(filters); i++)
+		json_filter_free(array_get(filters, i));
+	array_free(filters);
+}
+
+int json_filter_match_value(JSON_FILTER *filter,
+		const char *str, int has_number, double number)
+{
+	if(filter->type == JSON_FILTER_NUMBER)
+	{
+		if(!has_number)
+			return 0;
+
+		switch(filter->sign)
+		{
+		case '=': return (number == filter->number);
+		case '>': return (number > filter->number);
+		case '<': return (number < filter->number);
+		case '!': return (number != filter->number);
+		}
+		return 0;
+	}
+
+	if(filter->type == JSON_FILTER_STRING)
 	{
-		double ref;
-		sscanf(path->value, "%lf", &ref);
-		float value = json_get_float(json, path->prop);
-		if(path->sign[0] == '=')
-			return (value == ref);
-		if(path->sign[0] == '>')
-			return (value > ref);
-		if(path->sign[0] == '<')
-			return (value < ref);
-		if(path->sign[0] == '!')
-			return (value != ref);
+		if(str == NULL)
+			return 0;
+
+		int cmp = strcmp(str, filter->value);
+		return filter->sign == '!' ? (cmp != 0) : (cmp == 0);
+	}
+
+	/* could not be parsed */
+	return 0;
+}
+
+int json_filter_match(JSON *json, JSON_FILTER *filter)
+{
+	if (json == NULL)
 		return 0;
+	if (filter == NULL)
+		return 1;
+
+	double number = 0;
+	int has_number = 0;
+	const char* str = NULL;
+
+	if(filter->type == JSON_FILTER_NUMBER)
+		has_number = json_peek_number(json, filter->prop, &number);
+	else if(filter->type == JSON_FILTER_STRING)
+		str = json_peek_str(json, filter->prop);
+
+	return json_filter_match_value(filter, str, has_number, number);
+}
+
+int json_filter_match_array(JSON *json, Array *filters)
+{
+	if (json == NULL)
+		return 0;
+	if (filters == NULL)
+		return 1;
+
+	int i;
+	for(i = 0; i< array_size(filters); i++)
+	{
+		/* check if one filter failed */
+		if (json_filter_match(json, array_get(filters, i)) == 0)
+			return 0;
 	}
+	/* all filters succeeded */
+	return 1;
+}
 
-	/* if string */
-	char* value = json_get_str(json, path->prop);
+int json_filter_equality(const char *path, char **prop, char **value)
+{
+	if (path == NULL)
+		return 0;
 
-	int cmp = strcmp(value, path->value);
-	free(value);
+	JSON_FILTER* filter = json_filter_compile(path);
+	int is_equality = filter->type == JSON_FILTER_STRING && filter->sign == '=';
+	if (is_equality)
+	{
+		*prop = strdup(filter->prop);
+		*value = filter->value;
+		filter->value = NULL;
+	}
+	json_filter_free(filter);
 
-	return (cmp == 0);
+	return is_equality;
 }
 
 /* one json; one query */
@@ -94,26 +238,25 @@ int json_filter_validate_one(JSON *json, char *path)
 	if (path == NULL)
 		return 1;
 
-	_json_path*  jp = _json_path_new(path);
-
-	int validate_value = _has_path(json, jp);
-	_json_path_free(jp);
+	JSON_FILTER* filter = json_filter_compile(path);
+	int validate_value = json_filter_match(json, filter);
+	json_filter_free(filter);
 
 	return validate_value;
 }
 
 /* one json; many queries in conjunction  from an array*/
-int json_filter_validate_array(JSON *json, Array *filters)
+int json_filter_validate_array(JSON *json, Array *paths)
 {
 	if (json == NULL)
 		return 0;
-	if (filters == NULL)
+	if (paths == NULL)
 		return 1;
 
 	int i;
-	for(i = 0; i< array_size(filters); i++)
+	for(i = 0; i< array_size(paths); i++)
 	{
-		char *path = array_get(filters, i);
+		char *path = array_get(paths, i);
 		/* check if one filter failed */
 		if (json_filter_validate_one(json, path) == 0)
 			return 0;
@@ -10,9 +10,57 @@
 
 #include "json.h"
 
+/*
+ * A filter "prop sign value" parsed once. Quoted values compare as
+ * strings (= or !=), others as numbers (=, <, >, !=).
+ */
+#define JSON_FILTER_NONE	0 /* could not be parsed, matches nothing */
+#define JSON_FILTER_NUMBER	1
+#define JSON_FILTER_STRING	2
+
+typedef struct _JSON_FILTER{
+	int type;
+	const char* prop; /* interned for local filters, owned otherwise */
+	int interned;
+	char sign;
+	double number;
+	char* value;
+}JSON_FILTER;
+
+JSON_FILTER* json_filter_compile(const char* filter);
+void json_filter_free(JSON_FILTER* filter);
+
+/*
+ * the same with the property name interned: for the filters of the
+ * local eps only, whose names are few. Remote ones (map queries,
+ * lookups, a peer's filters) keep their own copy, freed with them.
+ */
+JSON_FILTER* json_filter_compile_local(const char* filter);
+
+/* an array of compiled filters from an array of strings */
+Array* json_filter_compile_array(Array* filters);
+Array* json_filter_compile_array_local(Array* filters);
+void json_filter_free_array(Array* filters);
+
+/* does @json satisfy the compiled @filter? no allocations */
+int json_filter_match(JSON *json, JSON_FILTER *filter);
+
+/* the same on the property already read: @str if a string, @number if @has_number */
+int json_filter_match_value(JSON_FILTER *filter,
+		const char *str, int has_number, double number);
+
+/* does @json satisfy all the compiled @filters? */
+int json_filter_match_array(JSON *json, Array *filters);
+
 /* does @json satisfy the @filter? */
 int json_filter_validate_one(JSON *json, char *filter);
 
+/*
+ * is @filter a string equality, prop = 'value'?
+ * if so @prop and @value are set, to be freed by the caller
+ */
+int json_filter_equality(const char *filter, char **prop, char **value);
+
 /* does @json satisfy each psth in array @filters? */
 int json_filter_validate_array(JSON *json, Array *filters);
 
@@ -8,18 +8,29 @@
 #include "message.h"
 
 #include "hashmap.h"
+#include "json_pack.h"
+#include "json_codec.h"
+#include "message_scan.h"
 #include "endpoint.h"
 #include <utils.h>
 
 #include <stdio.h>
+#include <string.h>
 
 extern HashMap* endpoints;
 
+MESSAGE* message_alloc()
+{
+	MESSAGE* message = (MESSAGE*)calloc(1, sizeof(MESSAGE));
+	message->refs = 1;
+	return message;
+}
+
 MESSAGE* message_new(const char* msg_, unsigned int status_)
 {
 	const char* msg = (msg_ != NULL) ? msg_ : "";
 
-	MESSAGE* message = (MESSAGE*)malloc(sizeof(MESSAGE));
+	MESSAGE* message = message_alloc();
 	message->_msg_json = json_new(msg);
 	//message->msg_str = NULL;//strdup_null(msg_);
 	message->status = status_;
@@ -38,7 +49,7 @@ MESSAGE* message_new(const char* msg_, unsigned int status_)
 
 MESSAGE* message_new_json(JSON* msg_, unsigned int status_)
 {
-	MESSAGE* message = (MESSAGE*)malloc(sizeof(MESSAGE));
+	MESSAGE* message = message_alloc();
 	message->_msg_json = msg_;
 	//message->msg_str = NULL;//json_to_str(msg_);
 	message->status = status_;
@@ -59,7 +70,7 @@ MESSAGE* message_new_json(JSON* msg_, unsigned int status_)
 
 MESSAGE* message_new_id(const char* msg_id, const char* msg_, unsigned int status_)
 {
-	MESSAGE* message = (MESSAGE*)malloc(sizeof(MESSAGE));
+	MESSAGE* message = message_alloc();
 	message->msg_id = strdup_null(msg_id);
 	message->_msg_json = json_new(msg_);
 	//message->msg_str = NULL;//strdup_null(msg_);
@@ -78,9 +89,52 @@ MESSAGE* message_new_id(const char* msg_id, const char* msg_, unsigned int statu
 	return message;
 }
 
+MESSAGE* message_new_raw(const char* msg_id, const char* msg_, unsigned int len,
+		JSON* json, unsigned int status_)
+{
+	MESSAGE* message = message_alloc();
+	message->msg_id = strdup_null(msg_id);
+	message->status = status_;
+
+	message->raw = (char*)malloc(len+1);
+	memcpy(message->raw, msg_, len);
+	message->raw[len] = '\0';
+
+	/* spliced only if it is exactly one object or array */
+	unsigned int start = 0, end = len;
+	while(start < end && strchr(" \t\r\n", message->raw[start]))
+		start++;
+	while(end > start && strchr(" \t\r\n", message->raw[end-1]))
+		end--;
+	if(message_scan_value(message->raw + start, end - start) == 0)
+	{
+		message->body_start = start;
+		message->body_len = end - start;
+	}
+	else if(json == NULL)
+		json = json_new_len(msg_, len);
+
+	/* what json-c cannot read is not sent, as message_to_json does */
+	if(json != NULL && json->elem_json == NULL)
+	{
+		json_free(json);
+		json = NULL;
+		message->body_len = 0;
+	}
+
+	message->_msg_json = json;
+	message->lazy = (json == NULL && message->body_len > 0);
+	message->owns_json = 1;
+
+	message->data = message->raw;
+	message->size = len;
+
+	return message;
+}
+
 MESSAGE* message_new_id_json(const char* msg_id, JSON* msg_, unsigned int status_)
 {
-	MESSAGE* message = (MESSAGE*)malloc(sizeof(MESSAGE));
+	MESSAGE* message = message_alloc();
 	message->msg_id = strdup_null(msg_id);
 	message->_msg_json = msg_;
 	//message->msg_str = NULL;//json_to_str(msg_);
@@ -96,18 +150,29 @@ MESSAGE* message_new_id_json(const char* msg_id, JSON* msg_, unsigned int status
 	return message;
 }
 
+MESSAGE* message_ref(MESSAGE* msg)
+{
+	if(msg != NULL)
+		__sync_fetch_and_add(&msg->refs, 1);
+	return msg;
+}
+
 void message_free(MESSAGE* msg)
 {
 	if(msg == NULL)
 		return;
+	if(__sync_sub_and_fetch(&msg->refs, 1) > 0)
+		return;
 
 	if(msg->_msg_json)
 	{
-		//wjson_free(msg->_msg_json);
+		if(msg->owns_json)
+			json_free(msg->_msg_json);
 		msg->_msg_json = NULL;
 	}
 
 	//free(msg->msg_str);
+	free(msg->raw);
 	free(msg->msg_id);
 	free(msg->module);
 	free(msg);
@@ -131,7 +196,7 @@ MESSAGE* message_parse_json(JSON* json_msg)
 	if(json_msg == NULL)
 		return NULL;
 
-	MESSAGE* ret_msg = malloc(sizeof(MESSAGE));
+	MESSAGE* ret_msg = message_alloc();
 	char* ep_id = json_get_str(json_msg, "ep_id");
 	if (ep_id != NULL)
 	{
@@ -162,36 +227,205 @@ MESSAGE* message_parse_json(JSON* json_msg)
 	return ret_msg;
 }
 
-JSON* message_to_json(MESSAGE* msg)
+MESSAGE* message_parse_lazy(const char* msg, unsigned int size)
 {
-	JSON *msg_json = json_new(NULL);
+	if(msg == NULL)
+		return NULL;
 
-	json_set_int(msg_json, "status", (int)(msg->status));
+	/* what our cores write is read at known places, without scanning msg_json */
+	MESSAGE_SCAN scan;
+	if(message_scan_head(msg, size, &scan) != 0
+			&& message_scan(msg, size, &scan) != 0)
+		return NULL;
 
-	if(msg->_msg_json)
-		json_set_json(msg_json, "msg_json", msg->_msg_json);
+	MESSAGE* ret_msg = message_alloc();
+	ret_msg->raw = (char*)malloc(size+1);
+	memcpy(ret_msg->raw, msg, size);
+	ret_msg->raw[size] = '\0';
+
+	long long status, conn;
+	char *ep_id = NULL, *module = NULL;
+	if(message_scan_int(ret_msg->raw, &scan, MESSAGE_SCAN_STATUS, &status)
+			|| message_scan_int(ret_msg->raw, &scan, MESSAGE_SCAN_CONN, &conn)
+			|| message_scan_str(ret_msg->raw, &scan, MESSAGE_SCAN_MSG_ID, &ret_msg->msg_id)
+			|| message_scan_str(ret_msg->raw, &scan, MESSAGE_SCAN_EP_ID, &ep_id)
+			|| message_scan_str(ret_msg->raw, &scan, MESSAGE_SCAN_MODULE, &module))
+	{
+		/* not in the shape we write, json-c reads it */
+		char* raw = ret_msg->raw;
+		ret_msg->raw = NULL;
+		free(ep_id);
+		free(module);
+		message_free(ret_msg);
+
+		ret_msg = message_parse(raw);
+		ret_msg->raw = raw;
+		ret_msg->data = raw;
+		ret_msg->owns_json = 1;
+		return ret_msg;
+	}
 
-	//if(msg->msg_str)
-	//	json_set_str(msg_json, "msg", msg->msg_str);
+	ret_msg->status = (unsigned int)status;
+	ret_msg->ep = ep_id ? (ENDPOINT*)map_get(endpoints, ep_id) : NULL;
+	free(ep_id);
+	if (module != NULL && conn != 0)
+	{
+		ret_msg->conn = conn;
+		ret_msg->module = module;
+	}
+	else
+		free(module);
 
-	if (msg->ep)
-		json_set_str(msg_json, "ep_id", msg->ep->id);
+	ret_msg->body_start = scan.start[MESSAGE_SCAN_MSG_JSON];
+	ret_msg->body_len = scan.len[MESSAGE_SCAN_MSG_JSON];
+	ret_msg->lazy = 1;
+	ret_msg->owns_json = 1;
+
+	ret_msg->data = ret_msg->raw;
+	ret_msg->size = size;
+
+	return ret_msg;
+}
+
+JSON* message_json(MESSAGE* msg)
+{
+	if(msg == NULL)
+		return NULL;
+
+	if(msg->lazy)
+	{
+		/* as json_get_json: objects and arrays only */
+		char first = msg->body_len ? msg->raw[msg->body_start] : '\0';
+		if(first == '{' || first == '[')
+			msg->_msg_json = json_new_len(msg->raw + msg->body_start, msg->body_len);
+		/* json_get_json gives NULL for what does not parse */
+		if(msg->_msg_json && msg->_msg_json->elem_json == NULL)
+		{
+			json_free(msg->_msg_json);
+			msg->_msg_json = NULL;
+		}
+		msg->lazy = 0;
+	}
+
+	return msg->_msg_json;
+}
+
+/*
+ * the header, in the order message_scan_head expects it:
+ * status, msg_id, ep_id, conn, module; msg_json goes last
+ */
+void message_to_json_head(MESSAGE* msg, JSON* msg_json)
+{
+	json_set_int(msg_json, "status", (int)(msg->status));
 
 	if(msg->msg_id)
 		json_set_str(msg_json, "msg_id", msg->msg_id);
 
+	if (msg->ep)
+		json_set_str(msg_json, "ep_id", msg->ep->id);
 
 	if(msg->conn)
 		json_set_int(msg_json, "conn", msg->conn);
 
 	if(msg->module)
 		json_set_str(msg_json, "module", msg->module);
+}
+
+JSON* message_to_json(MESSAGE* msg)
+{
+	JSON *msg_json = json_new(NULL);
+
+	message_to_json_head(msg, msg_json);
+
+	if(message_json(msg))
+		json_set_json(msg_json, "msg_json", msg->_msg_json);
+
+	//if(msg->msg_str)
+	//	json_set_str(msg_json, "msg", msg->msg_str);
 
 	return msg_json;
 }
 
+/* msg_json as text, kept from where the message came from */
+int message_has_raw_body(MESSAGE* msg)
+{
+	return msg->raw != NULL && msg->body_len > 0 &&
+			(msg->raw[msg->body_start] == '{' || msg->raw[msg->body_start] == '[');
+}
+
+/* header strings that go in the template as they are */
+int message_plain_str(const char* str)
+{
+	for(; *str; str++)
+		if(*str == '"' || *str == '\\' || (unsigned char)*str < 0x20)
+			return 0;
+	return 1;
+}
+
+/*
+ * the header written around the body bytes, in the layout of
+ * message_to_json_head; json-c only for strings that need escaping
+ */
+char* message_to_str_raw(MESSAGE* msg)
+{
+	const char* ep_id = msg->ep ? msg->ep->id : NULL;
+	char* head = NULL;
+	unsigned int head_len;
+
+	if((msg->msg_id == NULL || message_plain_str(msg->msg_id))
+			&& (ep_id == NULL || message_plain_str(ep_id))
+			&& (msg->module == NULL || message_plain_str(msg->module)))
+	{
+		/* status and conn fit in 64 */
+		head_len = 64 + (msg->msg_id ? strlen(msg->msg_id) + 16 : 0)
+				+ (ep_id ? strlen(ep_id) + 16 : 0)
+				+ (msg->module ? strlen(msg->module) + 16 : 0);
+		head = (char*)malloc(head_len);
+		head_len = sprintf(head, "{ \"status\": %u", msg->status);
+		if(msg->msg_id)
+			head_len += sprintf(head + head_len, ", \"msg_id\": \"%s\"", msg->msg_id);
+		if(ep_id)
+			head_len += sprintf(head + head_len, ", \"ep_id\": \"%s\"", ep_id);
+		if(msg->conn)
+			head_len += sprintf(head + head_len, ", \"conn\": %d", msg->conn);
+		if(msg->module)
+			head_len += sprintf(head + head_len, ", \"module\": \"%s\"", msg->module);
+	}
+	else
+	{
+		JSON *head_json = json_new(NULL);
+		message_to_json_head(msg, head_json);
+		head = json_to_str(head_json);
+		json_free(head_json);
+
+		/* there is at least status before the closing brace */
+		head_len = strrchr(head, '}') - head;
+		while(head_len > 0 && head[head_len-1] == ' ')
+			head_len--;
+	}
+
+	static const char key[] = ", \"msg_json\": ";
+
+	char* js = (char*)malloc(head_len + sizeof(key)-1 + msg->body_len + 3);
+	char* p = js;
+	memcpy(p, head, head_len);
+	p += head_len;
+	memcpy(p, key, sizeof(key)-1);
+	p += sizeof(key)-1;
+	memcpy(p, msg->raw + msg->body_start, msg->body_len);
+	p += msg->body_len;
+	memcpy(p, " }", 3);
+
+	free(head);
+	return js;
+}
+
 char* message_to_str(MESSAGE* msg)
 {
+	/* the body goes out as it came, parsed or not */
+	if(message_has_raw_body(msg))
+		return message_to_str_raw(msg);
+
 	JSON *msg_json = message_to_json(msg);
 
 	char* js = json_to_str(msg_json);
@@ -199,6 +433,176 @@ char* message_to_str(MESSAGE* msg)
 	return js;
 }
 
+#define MESSAGE_BIN_FIELDS	6
+
+JSON_CODEC* message_codec(unsigned int status, JSON_CODEC *msg_codec, JSON_CODEC *resp_codec)
+{
+	switch(status)
+	{
+	case MSG_MSG:
+	case MSG_REQ:
+	case MSG_STREAM:
+		return msg_codec;
+	case MSG_RESP_NEXT:
+	case MSG_RESP_LAST:
+		return resp_codec;
+	default:
+		return NULL;
+	}
+}
+
+void message_pack_head(MESSAGE* msg, JSON_PACK* pack)
+{
+	json_pack_array_head(pack, MESSAGE_BIN_FIELDS);
+	json_pack_int(pack, msg->status);
+	json_pack_str(pack, msg->msg_id);
+	json_pack_str(pack, msg->ep ? msg->ep->id : NULL);
+	json_pack_int(pack, msg->conn);
+	json_pack_str(pack, msg->module);
+}
+
+void* message_to_bin(MESSAGE* msg, unsigned int *size)
+{
+	JSON_PACK pack;
+	json_pack_init(&pack);
+
+	message_pack_head(msg, &pack);
+	/* json text as a str: the receiver keeps it unparsed too */
+	if(message_has_raw_body(msg))
+		json_pack_str_len(&pack, msg->raw + msg->body_start, msg->body_len);
+	else
+		json_pack(&pack, message_json(msg));
+
+	*size = pack.size;
+	return pack.data;
+}
+
+void* message_to_bin_codec(MESSAGE* msg, JSON_CODEC* codec, unsigned int *size)
+{
+	JSON_PACK body;
+	json_pack_init(&body);
+	if(codec == NULL || message_json(msg) == NULL
+			|| json_codec_encode(codec, msg->_msg_json, &body) != 0)
+	{
+		json_pack_free(&body);
+		return NULL;
+	}
+
+	JSON_PACK pack;
+	json_pack_init(&pack);
+	message_pack_head(msg, &pack);
+	json_pack_bin(&pack, body.data, body.size);
+	json_pack_free(&body);
+
+	*size = pack.size;
+	return pack.data;
+}
+
+MESSAGE* message_parse_bin(const void* data_, unsigned int size,
+		JSON_CODEC *msg_codec, JSON_CODEC *resp_codec)
+{
+	const unsigned char* data = (const unsigned char*)data_;
+	unsigned int pos, used, fields;
+	long long status, conn;
+	char *msg_id = NULL, *ep_id = NULL, *module = NULL;
+	JSON* msg_json = NULL;
+
+	if(data == NULL)
+		return NULL;
+
+	pos = json_unpack_array_head(data, size, &fields);
+	if(pos == 0 || fields < MESSAGE_BIN_FIELDS)
+		return NULL;
+
+	if(!(used = json_unpack_int(data+pos, size-pos, &status)))
+		goto error;
+	pos += used;
+	if(!(used = json_unpack_str(data+pos, size-pos, &msg_id)))
+		goto error;
+	pos += used;
+	if(!(used = json_unpack_str(data+pos, size-pos, &ep_id)))
+		goto error;
+	pos += used;
+	if(!(used = json_unpack_int(data+pos, size-pos, &conn)))
+		goto error;
+	pos += used;
+	if(!(used = json_unpack_str(data+pos, size-pos, &module)))
+		goto error;
+	pos += used;
+
+	/* bin: the payload in the mapping's compact encoding */
+	const void* body;
+	unsigned int body_size;
+	char* raw = NULL;
+	if(json_unpack_bin(data+pos, size-pos, &body, &body_size))
+	{
+		JSON_CODEC* codec = message_codec(status, msg_codec, resp_codec);
+		if(json_codec_decode(codec, body, body_size, &msg_json) != (int)body_size)
+		{
+			json_free(msg_json);
+			goto error;
+		}
+	}
+	/* str: json text, parsed on demand */
+	else if(json_unpack_str(data+pos, size-pos, &raw))
+		;
+	else if(!(used = json_unpack(data+pos, size-pos, &msg_json)))
+		goto error;
+
+	MESSAGE* ret_msg = message_alloc();
+	ret_msg->ep = ep_id ? (ENDPOINT*)map_get(endpoints, ep_id) : NULL;
+	free(ep_id);
+	ret_msg->msg_id = msg_id;
+	ret_msg->_msg_json = msg_json;
+	ret_msg->owns_json = 1;
+	if(raw != NULL)
+	{
+		/* kept as text only if it is one value; else json-c, as message_parse */
+		ret_msg->raw = raw;
+		ret_msg->body_len = strlen(raw);
+		if(message_scan_value(raw, ret_msg->body_len) == 0)
+			ret_msg->lazy = 1;
+		else
+		{
+			msg_json = json_new_len(raw, ret_msg->body_len);
+			if(msg_json != NULL && msg_json->elem_json == NULL)
+			{
+				json_free(msg_json);
+				msg_json = NULL;
+			}
+			ret_msg->_msg_json = msg_json;
+			ret_msg->body_len = 0;
+		}
+	}
+	ret_msg->status = (unsigned int)status;
+
+	if (module != NULL && conn != 0)
+	{
+		ret_msg->conn = conn;
+		ret_msg->module = module;
+	}
+	else
+	{
+		ret_msg->conn = 0;
+		ret_msg->module = NULL;
+		free(module);
+	}
+
+	/* @data_ is the receive buffer, reused after this frame */
+	ret_msg->data = NULL;
+	ret_msg->size = 0;
+
+	return ret_msg;
+
+	error:
+	{
+		free(msg_id);
+		free(ep_id);
+		free(module);
+		return NULL;
+	}
+}
+
 char* message_generate_id()
 {
 	static unsigned long counter_messages=1;
@@ -9,6 +9,7 @@
 #define MESSAGE_H_
 
 #include "json.h"
+#include "json_codec.h"
 #include "endpoint_base.h"
 #include <slog.h>
 
@@ -54,6 +55,19 @@ typedef struct _MESSAGE{
 	/* original source */
 	void* data;
 	unsigned int size;
+
+	/*
+	 * message_parse_lazy: the text received, owned, and where msg_json is
+	 * in it; msg_json is only parsed by message_json
+	 */
+	char* raw;
+	unsigned int body_start;
+	unsigned int body_len;
+	unsigned int lazy		:1; /* _msg_json not parsed yet */
+	unsigned int owns_json	:1; /* _msg_json freed with the message */
+
+	/* message_ref; message_free releases one */
+	int refs;
 } MESSAGE;
 
 
@@ -61,15 +75,56 @@ MESSAGE* message_new(const char *msg_, unsigned int status_);
 MESSAGE* message_new_json(JSON *msg_, unsigned int status_);
 MESSAGE* message_new_id(const char* msg_id, const char *msg_, unsigned int status_);
 MESSAGE* message_new_id_json(const char* msg_id, JSON *msg_, unsigned int status_);
+/*
+ * msg_json given as text, msg_[0..len), copied and sent as it is.
+ * @json: the same already parsed, or NULL to parse on demand; the message
+ * owns both.
+ */
+MESSAGE* message_new_raw(const char* msg_id, const char *msg_, unsigned int len,
+		JSON *json, unsigned int status_);
 
+/* one more holder of msg, e.g. a queue; each calls message_free */
+MESSAGE* message_ref(MESSAGE *msg);
 void message_free(MESSAGE *msg);
 
 MESSAGE* message_parse(const char *msg);
 MESSAGE* message_parse_json(JSON *msg);
 
+/*
+ * keeps a copy of msg[0..size) and reads the header from it without a
+ * json tree; msg_json is parsed on the first message_json and forwarded
+ * as it came by message_to_str until then.
+ */
+MESSAGE* message_parse_lazy(const char *msg, unsigned int size);
+
+/* msg_json, parsed now if it was not yet */
+JSON* message_json(MESSAGE *msg);
+
 JSON* message_to_json(MESSAGE *msg);
 char* message_to_str(MESSAGE *msg);
 
+/*
+ * binary envelope, MessagePack:
+ * [status, msg_id, ep_id, conn, module, msg_json]
+ * msg_json is a str with the json text for messages that have it (raw)
+ * used between cores that both advertised it, see protocol.c
+ */
+void* message_to_bin(MESSAGE *msg, unsigned int *size);
+/*
+ * the same with msg_json in the codec's compact encoding, as bin.
+ * NULL if msg_json does not fit the codec.
+ */
+void* message_to_bin_codec(MESSAGE *msg, JSON_CODEC *codec, unsigned int *size);
+/*
+ * the codecs decode a compact msg_json: resp for MSG_RESP_*, msg otherwise.
+ * @data is not kept: the message has no data, only what it copied
+ */
+MESSAGE* message_parse_bin(const void *data, unsigned int size,
+		JSON_CODEC *msg_codec, JSON_CODEC *resp_codec);
+
+/* the codec that applies to a message of this status */
+JSON_CODEC* message_codec(unsigned int status, JSON_CODEC *msg_codec, JSON_CODEC *resp_codec);
+
 /*
  * These functions concern message ordering across the application.
  */
@@ -0,0 +1,275 @@
+/*
+ * message_scan.c
+ */
+
+#include "message_scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* message_scan_names[MESSAGE_SCAN_FIELDS] = {
+		"status", "msg_id", "ep_id", "conn", "module", "msg_json"};
+
+static unsigned int scan_space(const char* data, unsigned int i, unsigned int size)
+{
+	while(i < size && (data[i] == ' ' || data[i] == '\t'
+			|| data[i] == '\n' || data[i] == '\r'))
+		i++;
+	return i;
+}
+
+/* data[i] is the opening quote; the position after the closing one, 0 if none */
+static unsigned int scan_string(const char* data, unsigned int i, unsigned int size)
+{
+	for(i++; i < size; i++)
+	{
+		if(data[i] == '\\')
+			i++;
+		else if(data[i] == '"')
+			return i+1;
+	}
+	return 0;
+}
+
+/* deeper values are left to json-c */
+#define SCAN_MAX_DEPTH 256
+
+/* the position after the value starting at data[i], 0 if malformed */
+static unsigned int scan_value(const char* data, unsigned int i, unsigned int size)
+{
+	if(i >= size)
+		return 0;
+
+	if(data[i] == '"')
+		return scan_string(data, i, size);
+
+	if(data[i] == '{' || data[i] == '[')
+	{
+		/* the open brackets, to match each closing one */
+		char open[SCAN_MAX_DEPTH];
+		int depth = 0;
+		while(i < size)
+		{
+			switch(data[i])
+			{
+			case '"':
+				if(!(i = scan_string(data, i, size)))
+					return 0;
+				continue;
+			case '{':
+			case '[':
+				if(depth == SCAN_MAX_DEPTH)
+					return 0;
+				open[depth++] = data[i];
+				break;
+			case '}':
+			case ']':
+				if(open[--depth] != (data[i] == '}' ? '{' : '['))
+					return 0;
+				if(depth == 0)
+					return i+1;
+				break;
+			}
+			i++;
+		}
+		return 0;
+	}
+
+	/* number, true, false, null */
+	unsigned int start = i;
+	while(i < size && data[i] != ',' && data[i] != '}' && data[i] != ']'
+			&& data[i] != ' ' && data[i] != '\t' && data[i] != '\n' && data[i] != '\r')
+		i++;
+	return i > start ? i : 0;
+}
+
+int message_scan_value(const char* data, unsigned int size)
+{
+	if(size == 0 || (data[0] != '{' && data[0] != '['))
+		return -1;
+	return scan_value(data, 0, size) == size ? 0 : -1;
+}
+
+int message_scan(const char* data, unsigned int size, MESSAGE_SCAN* scan)
+{
+	unsigned int i, key_start, key_end, field;
+
+	memset(scan, 0, sizeof(MESSAGE_SCAN));
+
+	i = scan_space(data, 0, size);
+	if(i >= size || data[i] != '{')
+		return -1;
+	i = scan_space(data, i+1, size);
+	if(i < size && data[i] == '}')
+		return scan_space(data, i+1, size) == size ? 0 : -1;
+
+	while(i < size)
+	{
+		if(data[i] != '"' || !(key_end = scan_string(data, i, size)))
+			return -1;
+		key_start = i+1;
+
+		i = scan_space(data, key_end, size);
+		if(i >= size || data[i] != ':')
+			return -1;
+		i = scan_space(data, i+1, size);
+
+		unsigned int value_start = i;
+		if(!(i = scan_value(data, i, size)))
+			return -1;
+
+		for(field = 0; field < MESSAGE_SCAN_FIELDS; field++)
+		{
+			const char* name = message_scan_names[field];
+			if(strlen(name) == key_end-1 - key_start
+					&& !memcmp(data + key_start, name, key_end-1 - key_start))
+			{
+				scan->start[field] = value_start;
+				scan->len[field] = i - value_start;
+				break;
+			}
+		}
+
+		i = scan_space(data, i, size);
+		if(i >= size)
+			return -1;
+		if(data[i] == '}')
+			return scan_space(data, i+1, size) == size ? 0 : -1;
+		if(data[i] != ',')
+			return -1;
+		i = scan_space(data, i+1, size);
+	}
+
+	return -1;
+}
+
+/* data[i] starts "name" followed by a colon: the position after the colon, 0 if not */
+static unsigned int scan_key(const char* data, unsigned int i, unsigned int size, const char* name)
+{
+	unsigned int len = strlen(name);
+	if(i + len + 2 > size || data[i] != '"'
+			|| memcmp(data + i+1, name, len) || data[i+1 + len] != '"')
+		return 0;
+
+	i = scan_space(data, i + len + 2, size);
+	if(i >= size || data[i] != ':')
+		return 0;
+	return scan_space(data, i+1, size);
+}
+
+int message_scan_head(const char* data, unsigned int size, MESSAGE_SCAN* scan)
+{
+	unsigned int i, next, field = 0;
+
+	memset(scan, 0, sizeof(MESSAGE_SCAN));
+
+	i = scan_space(data, 0, size);
+	if(i >= size || data[i] != '{')
+		return -1;
+	i = scan_space(data, i+1, size);
+
+	while(i < size && data[i] != '}')
+	{
+		/* the next property is one of those left, in order */
+		for(next = 0; field < MESSAGE_SCAN_FIELDS; field++)
+			if((next = scan_key(data, i, size, message_scan_names[field])))
+				break;
+		if(field == MESSAGE_SCAN_FIELDS)
+			return -1;
+		i = next;
+
+		if(field == MESSAGE_SCAN_MSG_JSON)
+		{
+			/* exactly one value, then the closing brace and nothing else;
+			 * anything else (older cores wrote properties after msg_json,
+			 * or a body that does not end where it seems to) gets the full scan */
+			if(data[i] != '{' && data[i] != '[')
+				return -1;
+			if(!(next = scan_value(data, i, size)))
+				return -1;
+			scan->start[field] = i;
+			scan->len[field] = next - i;
+
+			i = scan_space(data, next, size);
+			if(i >= size || data[i] != '}')
+				return -1;
+			return scan_space(data, i+1, size) == size ? 0 : -1;
+		}
+
+		scan->start[field] = i;
+		if(!(next = scan_value(data, i, size)))
+			return -1;
+		scan->len[field] = next - i;
+		field++;
+
+		i = scan_space(data, next, size);
+		if(i < size && data[i] == ',')
+			i = scan_space(data, i+1, size);
+		else if(i >= size || data[i] != '}')
+			return -1;
+	}
+
+	if(i >= size)
+		return -1;
+	return scan_space(data, i+1, size) == size ? 0 : -1;
+}
+
+int message_scan_int(const char* data, MESSAGE_SCAN* scan, int field, long long* value)
+{
+	*value = 0;
+	if(scan->len[field] == 0)
+		return 0;
+
+	const char* p = data + scan->start[field];
+	char* end;
+	*value = strtoll(p, &end, 10);
+	/* "1.0", "1e3" and the like are left to json-c */
+	if(end != p + scan->len[field])
+		return -1;
+
+	return 0;
+}
+
+int message_scan_str(const char* data, MESSAGE_SCAN* scan, int field, char** value)
+{
+	*value = NULL;
+	if(scan->len[field] == 0)
+		return 0;
+
+	const char* p = data + scan->start[field];
+	unsigned int len = scan->len[field];
+	if(len == 4 && !memcmp(p, "null", 4))
+		return 0;
+	if(len < 2 || p[0] != '"')
+		return -1;
+
+	char* str = (char*)malloc(len-1);
+	unsigned int i, j = 0;
+	for(i = 1; i < len-1; i++)
+	{
+		if(p[i] != '\\')
+		{
+			str[j++] = p[i];
+			continue;
+		}
+		switch(p[++i])
+		{
+		case '"':	str[j++] = '"'; break;
+		case '\\':	str[j++] = '\\'; break;
+		case '/':	str[j++] = '/'; break;
+		case 'b':	str[j++] = '\b'; break;
+		case 'f':	str[j++] = '\f'; break;
+		case 'n':	str[j++] = '\n'; break;
+		case 'r':	str[j++] = '\r'; break;
+		case 't':	str[j++] = '\t'; break;
+		default:
+			/* \u */
+			free(str);
+			return -1;
+		}
+	}
+	str[j] = '\0';
+
+	*value = str;
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * message_scan.h
+ *
+ * Finds the top level properties of a message's json text without
+ * building a json tree: only where each value starts and ends.
+ */
+
+#ifndef MESSAGE_SCAN_H_
+#define MESSAGE_SCAN_H_
+
+/* the message properties, in the order message_to_json writes them */
+#define MESSAGE_SCAN_STATUS		0
+#define MESSAGE_SCAN_MSG_ID		1
+#define MESSAGE_SCAN_EP_ID		2
+#define MESSAGE_SCAN_CONN		3
+#define MESSAGE_SCAN_MODULE		4
+#define MESSAGE_SCAN_MSG_JSON	5
+#define MESSAGE_SCAN_FIELDS		6
+
+typedef struct _MESSAGE_SCAN{
+	/* value of each property in the text; len 0 if absent */
+	unsigned int start[MESSAGE_SCAN_FIELDS];
+	unsigned int len[MESSAGE_SCAN_FIELDS];
+}MESSAGE_SCAN;
+
+/*
+ * 0 if data[0..size) is exactly one object or array with balanced
+ * brackets and strings, -1 otherwise. Scalars inside are not checked.
+ */
+int message_scan_value(const char* data, unsigned int size);
+
+/* 0, or -1 if data[0..size) is not one json object */
+int message_scan(const char* data, unsigned int size, MESSAGE_SCAN* scan);
+
+/*
+ * the same for text message_to_json wrote: the header properties in
+ * their order and msg_json last, followed only by the closing brace.
+ * -1 if the text is laid out otherwise; message_scan reads any object.
+ */
+int message_scan_head(const char* data, unsigned int size, MESSAGE_SCAN* scan);
+
+/*
+ * the value of a property, as json_get_int/json_get_str would give it.
+ * -1 if it cannot be read here (not a number, \u escapes beyond ascii):
+ * parse the whole text instead.
+ */
+int message_scan_int(const char* data, MESSAGE_SCAN* scan, int field, long long* value);
+int message_scan_str(const char* data, MESSAGE_SCAN* scan, int field, char** value);
+
+#endif /* MESSAGE_SCAN_H_ */
@@ -20,8 +20,10 @@
 #include "com_wrapper.h"
 #include "access_wrapper.h"
 #include "rdcs.h"
+#include "session.h"
 #include "slog.h"
 #include "utils.h"
+#include "json.h"
 
 #include "manifest.h"
 #include "core_callbacks.h"
@@ -29,12 +31,11 @@
 #include <signal.h>
 #include <pthread.h>
 #include <dlfcn.h>
+#include <limits.h> //for PATH_MAX
 
 #include <sys/types.h>
 #include <sys/socket.h>
 
-/* passing messages between threads to sync during mapping protocol */
-int map_sync_pipe[2];
 int rdc_register_pipe[2];
 
 char *app_name, *app_key;
@@ -43,6 +44,65 @@ STATE* app_state;
 
 void register_default_endpoints();
 
+int load_core_config(const char* config_file)
+{
+	int error = 0; //no error
+	JSON* core_json = NULL;
+
+	int log_lvl = 0;
+	char* log_file = NULL;
+
+	JSON* config_json = json_load_from_file(config_file);
+
+	if (config_json == NULL)
+	{
+		error = -1;
+		goto final;
+	}
+
+	core_json = json_get_json(config_json, "core_config");
+	if(core_json == NULL)// TODO: validate against a schema
+	{
+		error = -2;
+		goto final;
+	}
+
+	log_lvl = json_get_int(core_json, "log_level");
+	log_file = json_get_str(core_json, "log_file");
+
+	/* optional, on by default */
+	if(json_get_int(core_json, "optimistic_handshake") == 0)
+		core_proto_optimistic_enabled = 0;
+
+	/* optional, binary envelope by default where framing is binary */
+	char* envelope = json_get_str(core_json, "envelope");
+	if(envelope != NULL && strcmp(envelope, "json") == 0)
+		core_proto_envelope_enabled = 0;
+	free(envelope);
+
+	/* optional, validate every message by default */
+	char* validation = json_get_str(core_json, "validation");
+	int validation_sample = json_get_int(core_json, "validation_sample");
+	ep_set_validation_default(ep_validation_policy(validation),
+			validation_sample > 0 ? validation_sample : 0);
+	free(validation);
+
+	if(log_file == NULL)
+	{
+		log_file = malloc(PATH_MAX+1);
+		sprintf(log_file, "log/core_%s_%s", app_name, app_key);
+	}
+
+	slog_init_args(log_lvl, log_lvl, 1, 1, NULL);//, log_file);
+
+	final:{
+		json_free(core_json);
+		json_free(config_json);
+		free(log_file);
+		return error;
+	}
+}
+
 void int_handler(int sig)
 {
 	printf("SIGINT: Terminating core...\n");
@@ -59,6 +119,7 @@ int core_init(const char* _app_name, const char* _app_key)
 
 	/* init state functionality */
 	init_states();
+	sessions_init();
 
 	/* init endpoints */
 	eps_init();
@@ -89,7 +150,7 @@ int core_init(const char* _app_name, const char* _app_key)
 	return EXIT_SUCCESS;
 }
 
-int core_init_fd(int fd, const char* _app_name, const char* _app_key)
+int core_init_fd(int fd, const char* _app_name, const char* _app_key, const char* lib_path)
 {
 	//slog(SLOG_INFO, "CORE: init_fd: %d, %s", fd, _app_name);
 
@@ -103,15 +164,12 @@ int core_init_fd(int fd, const char* _app_name, const char* _app_key)
 	char sockpair_config[100];
 	sprintf(sockpair_config, "{\"is_server\":0, \"fd\": %d }", fd);
 
-#ifdef __linux__
-	fd_module = com_module_new(
-			"/usr/local/etc/middleware/com_modules/libcommodulesockpair.so",
-			sockpair_config);
-#elif __APPLE__
-	fd_module = com_module_new(
-			"/usr/local/etc/middleware/com_modules/libcommodulesockpair.so",
-			sockpair_config);
-#endif
+	if (lib_path == NULL)
+		lib_path = "/usr/local/etc/middleware/com_modules/libcommodulesockpair.so";
+
+	fd_module = com_module_new(lib_path, sockpair_config);
+	if (fd_module == NULL)
+		return EXIT_FAILURE;
 
 	(*(fd_module->fc_set_on_data))((void (*)(void *, int, const void *, unsigned int))core_on_data);
 	(*(fd_module->fc_set_on_connect))((void (*)(void *, int))core_on_connect);
@@ -9,12 +9,23 @@
 #define CORE_CORE_H_
 
 
+/*
+ * Reads the "core_config" section of config_file and sets up logging
+ * and the core options. Used by both the core process and the embedded core.
+ * Returns 0 on success, <0 if the file or section is missing.
+ */
+int load_core_config(const char* config_file);
+
 /*
  * Initialises core. Starts app server.
  * Sets up the addr variables.
  * starts the server and the client. (because the api is already running)
  */
 int core_init(const char* app_name, const char* app_key);
-int core_init_fd(int fd, const char* app_name, const char* app_key);
+/*
+ * Connects to the app over the inherited fd.
+ * lib_path is the ipc com module; NULL for sockpair.
+ */
+int core_init_fd(int fd, const char* app_name, const char* app_key, const char* lib_path);
 
 #endif /* CORE_CORE_H_ */
@@ -18,6 +18,8 @@
 #include <conn_fifo.h>
 
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 #include <unistd.h> // for write
 
 /* to check*/
@@ -35,7 +37,6 @@ void core_on_data(COM_MODULE* module, int conn, const void* data, unsigned int s
 	buffer_update(state_ptr->buffer, data, size);
 }
 
-extern int map_sync_pipe[2];
 void core_on_connect(COM_MODULE* module, int conn)
 {
 	/*
@@ -73,6 +74,9 @@ void core_on_connect(COM_MODULE* module, int conn)
 		json_set_str(manifest, "address", module->address);
 
 		JSON *hello_json = json_build_hello(manifest);
+		core_proto_advertise(state_ptr, hello_json);
+		core_proto_offer_session(state_ptr, hello_json);
+		core_proto_optimistic(state_ptr, hello_json);
 		state_send_json(state_ptr, NULL, hello_json, MSG_HELLO);
 		json_free(hello_json);
 		json_free(manifest);
@@ -82,8 +86,9 @@ void core_on_connect(COM_MODULE* module, int conn)
 		state_ptr->on_message = &core_on_message;
 
 		state_ptr->state = STATE_MAP; //wating for map
-		sync_trigger(map_sync_pipe[0], "mapped");
-		sync_trigger(map_sync_pipe[0], "mapped");
+		/* no hello and auth to wait for */
+		state_sync_trigger(state_ptr);
+		state_sync_trigger(state_ptr);
 	}
 }
 
@@ -105,12 +110,22 @@ void core_on_disconnect(COM_MODULE* module, int conn)
 		exit(EXIT_FAILURE);
 	}
 
+	/* the receive thread and a core_map giving up may both get here:
+	 * the one that takes it out of conn_state tears it down.
+	 * the conn number can be reused by a new connection after close */
+	if(states_remove(module, conn) != 0)
+		return;
+
+	/* the mappings carried on channels of this connection go with it */
+	state_free_channels(state_ptr);
+
 	ep_unmap_final(state_ptr->lep, state_ptr);
 
 	if(state_ptr->access_module)
 		(*(state_ptr->access_module->fc_disconnect))(state_ptr);
 
-	state_free(state_ptr);
+	/* a core_map opening a channel on it may still hold it */
+	state_put(state_ptr);
 
 
 	(*module->fc_connection_close)(conn);
@@ -147,10 +162,15 @@ void core_on_proto_message(STATE* state_ptr, MESSAGE* _msg)
 	case MSG_HELLO:
 		if(state_ptr->state == STATE_HELLO_S || state_ptr->state == STATE_HELLO_2)
 			core_proto_hello(state_ptr, _msg);
+		/* optimistic handshake: authenticated and mapped in one go */
+		if(state_ptr->am_auth && state_ptr->is_auth)
+			state_ptr->on_message = &core_on_message;
 		break;
 	case MSG_HELLO_ACK:
 		if(state_ptr->state == STATE_HELLO_S || state_ptr->state == STATE_HELLO_ACK_S)
 			core_proto_hello_ack(state_ptr, _msg);
+		if(state_ptr->am_auth && state_ptr->is_auth)
+			state_ptr->on_message = &core_on_message;
 		break;
 	case MSG_AUTH:
 		if(state_ptr->state == STATE_AUTH || state_ptr->state == STATE_AUTH_2)
@@ -204,6 +224,8 @@ void core_on_message(STATE* state_ptr, MESSAGE* _msg)
 	case MSG_MAP:
 		if(state_ptr->state == STATE_MAP)
 			core_proto_map(state_ptr, _msg);
+		else if(state_ptr->state == STATE_EXT_MSG)
+			core_proto_map_filters(state_ptr, message_json(_msg));
 		break;
 	case MSG_MAP_ACK:
 		if(state_ptr->state == STATE_MAP_ACK)
@@ -216,6 +238,12 @@ void core_on_message(STATE* state_ptr, MESSAGE* _msg)
 	case MSG_UNMAP_ACK:
 		ep_unmap_final(state_ptr->lep, state_ptr);
 		break;
+	/* after an optimistic handshake: the token the initiator issued us */
+	case MSG_AUTH_ACK:
+		if(state_ptr->session_issued != NULL && state_ptr->session_key == NULL
+				&& json_validate_auth_ack(message_json(_msg)) == 0)
+			core_proto_session_key(state_ptr, message_json(_msg));
+		break;
 
 	/* endpoint messages */
 	case MSG_MSG:
@@ -234,7 +262,7 @@ void core_on_message(STATE* state_ptr, MESSAGE* _msg)
 		break;
 	case MSG_STREAM_CMD:
 		_msg->ep = state_ptr->lep->ep;
-		recv_stream_cmd(_msg);
+		recv_stream_cmd(state_ptr, _msg);
 		break;
 
 	case MSG_NONE:
@@ -248,11 +276,6 @@ void core_on_message(STATE* state_ptr, MESSAGE* _msg)
 /* core_on_component_message handles messages from the component.
  * This handler is assigned only to the app_state */
 
-const char delim1 = '{';
-const char delim2 = '}';
-const char* delim21 = "}{";
-const char a = 'a', b = 'b';
-
 void core_on_component_message(STATE* state_ptr, const char* msg_id,
 		const char* module_id, const char* function_id, const char* return_type,
 		Array *args)
@@ -262,24 +285,20 @@ void core_on_component_message(STATE* state_ptr, const char* msg_id,
 	/* get the result back to the component*/
 	if(return_msg != NULL)
 	{
-		char str[11];
-		sprintf(str, "%010lu", strlen(return_msg));
-
-		COM_MODULE* sockpair_module = app_state->module;
-		(*(sockpair_module->fc_send))(app_state->conn, &delim1, 1);
+		/* {b{msg_id}{ret}{size}{return_msg}} in one write */
+		char head[40];
+		int head_len = sprintf(head, "{b{%.10s}{%.3s}{%010lu}{",
+				msg_id, return_type, strlen(return_msg));
 
-		(*(sockpair_module->fc_send))(app_state->conn, &b, 1);
-		(*(sockpair_module->fc_send))(app_state->conn, &delim1, 1);
-		(*(sockpair_module->fc_send))(app_state->conn, msg_id, 10);
-		(*(sockpair_module->fc_send))(app_state->conn, delim21, 2);
-		(*(sockpair_module->fc_send))(app_state->conn, return_type, 3);
-		(*(sockpair_module->fc_send))(app_state->conn, delim21, 2);
-		(*(sockpair_module->fc_send))(app_state->conn, str, 10);
-		(*(sockpair_module->fc_send))(app_state->conn, delim21, 2);
-		(*(sockpair_module->fc_send))(app_state->conn, return_msg, strlen(return_msg));
+		struct iovec iov[3];
+		iov[0].iov_base = head;
+		iov[0].iov_len = head_len;
+		iov[1].iov_base = return_msg;
+		iov[1].iov_len = strlen(return_msg);
+		iov[2].iov_base = "}}";
+		iov[2].iov_len = 2;
 
-		(*(sockpair_module->fc_send))(app_state->conn, &delim2, 1);
-		(*(sockpair_module->fc_send))(app_state->conn, &delim2, 1);
+		com_module_sendv(app_state->module, app_state->conn, iov, 3);
 
 		free(return_msg);
 
@@ -332,7 +351,9 @@ void call_external_command_handler(STATE* state_ptr, MESSAGE* msg)
 	if(msg->status == MSG_UNMAP)
 	{
 		ep_unmap_recv(state_ptr->lep, state_ptr); //TODO:state
-		(*(state_ptr->module->fc_connection_close))(state_ptr->conn);
+		/* other mappings may still use the connection */
+		if(state_ptr->parent == NULL && state_ptr->channels == NULL)
+			(*(state_ptr->module->fc_connection_close))(state_ptr->conn);
 		return;
 	}
 	else if (state_ptr->lep->ep->type == EP_STR_SNK &&
@@ -363,7 +384,69 @@ void call_external_command_handler(STATE* state_ptr, MESSAGE* msg)
 	{	}
 }
 
-void recv_stream_cmd(MESSAGE* msg)
+/* a stream passed as an fd, copied into the ep's fifo until it ends */
+typedef struct _STREAM_COPY{
+	int in;
+	int out;
+}STREAM_COPY;
+
+void* recv_stream_copy(void* arg)
+{
+	STREAM_COPY* copy = (STREAM_COPY*)arg;
+	char buf[4096];
+	ssize_t size, written, result;
+
+	while(1)
+	{
+		size = read(copy->in, buf, sizeof(buf));
+		if(size < 0 && errno == EINTR)
+			continue;
+		if(size <= 0)
+			break;
+
+		for(written = 0; written < size; written += result)
+		{
+			result = write(copy->out, buf + written, size - written);
+			if(result < 0 && errno == EINTR)
+				result = 0;
+			else if(result < 0)
+				goto end;
+		}
+	}
+
+end:
+	close(copy->in);
+	close(copy->out);
+	free(copy);
+	return NULL;
+}
+
+void recv_stream_fd(STATE* state_ptr, LOCAL_EP* lep)
+{
+	pthread_t thread;
+
+	if(state_ptr->module->fc_recv_fd == NULL)
+		return;
+	int fd = (*(state_ptr->module->fc_recv_fd))(state_ptr->conn);
+	if(fd < 0)
+		return;
+
+	/* its own fifo fd: a stop command closes lep->fifo under it */
+	STREAM_COPY* copy = (STREAM_COPY*)malloc(sizeof(STREAM_COPY));
+	copy->in = fd;
+	copy->out = lep->fifo > 0 ? dup(lep->fifo) : -1;
+	if(copy->out < 0 || pthread_create(&thread, NULL, recv_stream_copy, copy) != 0)
+	{
+		if(copy->out >= 0)
+			close(copy->out);
+		close(fd);
+		free(copy);
+		return;
+	}
+	pthread_detach(thread);
+}
+
+void recv_stream_cmd(STATE* state_ptr, MESSAGE* msg)
 {
 	if (msg->status != MSG_STREAM_CMD)
 		return;
@@ -378,15 +461,21 @@ void recv_stream_cmd(MESSAGE* msg)
 
 	LOCAL_EP* lep = (LOCAL_EP*)msg->ep->data;
 
-	JSON* msg_json = msg->_msg_json;
+	JSON* msg_json = message_json(msg);
 	int command = json_get_int(msg_json, "command");
-	if(command == 1 && lep->fifo <= 0)
+	if(command == 1)
 	{
-		sprintf(lep->fifo_name, "/tmp/%s", randstring(5));
-		lep->fifo = fifo_init_server(lep->fifo_name);
+		if(lep->fifo <= 0)
+		{
+			sprintf(lep->fifo_name, "/tmp/%s", randstring(5));
+			lep->fifo = fifo_init_server(lep->fifo_name);
 
-		msg->msg_id = strdup_null(lep->fifo_name); //was str
-		state_send_message(app_state, msg);
+			msg->msg_id = strdup_null(lep->fifo_name); //was str
+			state_send_message(app_state, msg);
+		}
+		/* the source passed the stream's fd with the command */
+		if(json_get_int(msg_json, "fd") == 1)
+			recv_stream_fd(state_ptr, lep);
 		return;
 	}
 	if(command == 0 && lep->fifo != 0)
@@ -408,7 +497,7 @@ void recv_stream_msg(MESSAGE* msg)
 		return;
 
 	LOCAL_EP* lep = (LOCAL_EP*)msg->ep->data;
-	char* data = json_get_str(msg->_msg_json, "stream");
+	char* data = json_get_str(message_json(msg), "stream");
 	int data_size = strlen(data);
 	//fifo_send_message(lep->fifo, data);//was str
 	int tot = 0;
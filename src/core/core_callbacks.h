@@ -53,7 +53,7 @@ void call_module_function_handler(COM_MODULE* module, int conn, const char *data
 /* external command */
 void call_external_command_handler(STATE* state, MESSAGE* msg);
 
-void recv_stream_cmd(MESSAGE* msg);
+void recv_stream_cmd(STATE* state, MESSAGE* msg);
 void recv_stream_msg(MESSAGE* msg);
 
 /* to send an error message to a state *
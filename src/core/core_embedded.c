@@ -0,0 +1,140 @@
+/*
+ * core_embedded.c
+ */
+
+#include "core_embedded.h"
+#include "core.h"
+#include "core_module_api.h"
+#include "environment.h"
+#include "state.h"
+#include "com_wrapper.h"
+#include "array.h"
+#include "utils.h"
+
+#include <slog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+extern STATE* app_state;
+
+int core_embedded = 0;
+
+/* app side receiver */
+core_embedded_to_app embedded_to_app = NULL;
+
+/* one frame at a time to the app, whichever core thread sends it */
+pthread_mutex_t embedded_send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* calls from the app were serialised by the ipc receive thread; keep that */
+pthread_mutex_t embedded_call_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* in process com module standing in for the app connection */
+
+int embedded_send(int conn, const void* data, unsigned int size)
+{
+	pthread_mutex_lock(&embedded_send_lock);
+	(*embedded_to_app)(data, size);
+	pthread_mutex_unlock(&embedded_send_lock);
+	return size;
+}
+
+int embedded_send_data(int conn, const char* msg)
+{
+	return embedded_send(conn, msg, strlen(msg));
+}
+
+int embedded_sendv(int conn, const struct iovec* iov, int iovcnt)
+{
+	int i, size = 0;
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	/* frames go up to 64MB: not on the stack */
+	char* frame = malloc(size);
+	if (frame == NULL)
+		return -1;
+
+	size = 0;
+	for (i = 0; i < iovcnt; i++)
+	{
+		memcpy(frame + size, iov[i].iov_base, iov[i].iov_len);
+		size += iov[i].iov_len;
+	}
+
+	int ret = embedded_send(conn, frame, size);
+	free(frame);
+	return ret;
+}
+
+int embedded_connection_close(int conn)
+{
+	return 0;
+}
+
+int embedded_is_bridge(void)
+{
+	return 1;
+}
+
+COM_MODULE* embedded_module_new()
+{
+	COM_MODULE* module = (COM_MODULE*) malloc(sizeof(COM_MODULE));
+	memset(module, 0, sizeof(COM_MODULE));
+
+	module->name = strdup_null("embedded");
+	module->fc_send = embedded_send;
+	module->fc_send_data = embedded_send_data;
+	module->fc_sendv = embedded_sendv;
+	module->fc_connection_close = embedded_connection_close;
+	module->fc_is_bridge = embedded_is_bridge;
+
+	return module;
+}
+
+int core_embedded_init(const char* _app_name, const char* _app_key,
+		const char* config_file, core_embedded_to_app to_app)
+{
+	if (to_app == NULL)
+		return EXIT_FAILURE;
+
+	embedded_to_app = to_app;
+	core_embedded = 1;
+
+	if (load_core_config(config_file))
+		return EXIT_FAILURE;
+
+	/* SIGINT stays with the app */
+	struct sigaction app_int_action;
+	sigaction(SIGINT, NULL, &app_int_action);
+
+	int ret = core_init(_app_name, _app_key);
+
+	sigaction(SIGINT, &app_int_action, NULL);
+
+	if (ret != EXIT_SUCCESS)
+		return ret;
+
+	/* the app is registered from the start: no key exchange */
+	app_state = state_new(embedded_module_new(), 0, STATE_APP_MSG);
+
+	return EXIT_SUCCESS;
+}
+
+char* core_embedded_call(const char* module_id, const char* function_id,
+		const char* return_type, const char** args)
+{
+	Array *arg_array = array_new(ELEM_TYPE_STR);
+	for (; args != NULL && *args != NULL; args++)
+		array_add(arg_array, strdup_null(*args));
+
+	pthread_mutex_lock(&embedded_call_lock);
+	char* result = _core_call_array(module_id, function_id, return_type, arg_array);
+	pthread_mutex_unlock(&embedded_call_lock);
+
+	return result;
+}
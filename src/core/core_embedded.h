@@ -0,0 +1,36 @@
+/*
+ * core_embedded.h
+ */
+
+#ifndef CORE_CORE_EMBEDDED_H_
+#define CORE_CORE_EMBEDDED_H_
+
+/*
+ * The core built as a shared library and run inside the app process.
+ * The app dlopens it and resolves the two entry points below;
+ * no process is spawned and no socket is involved.
+ */
+
+/* non zero when running inside the app process */
+extern int core_embedded;
+
+/* receives the core to app frames, the same bytes the sockpair would carry */
+typedef void (*core_embedded_to_app)(const void* data, unsigned int size);
+
+/*
+ * initialises the core in this process, with the same config file the
+ * spawned core would get.
+ * to_app is called with one whole frame at a time.
+ */
+int core_embedded_init(const char* app_name, const char* app_key,
+		const char* config_file, core_embedded_to_app to_app);
+
+/*
+ * calls a core function directly.
+ * args is NULL terminated; returns the same string the app would
+ * get back over ipc, or NULL for void functions.
+ */
+char* core_embedded_call(const char* module_id, const char* function_id,
+		const char* return_type, const char** args);
+
+#endif /* CORE_CORE_EMBEDDED_H_ */
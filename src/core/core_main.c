@@ -6,6 +6,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -23,52 +24,10 @@ char* config_file;
 void print_usage_exit()
 {
 	printf("CORE: Bad arguments formatting. Exiting ...");
-	printf("Usage: core -f SOCKET_FD -a APP_NAME -k KEY -c CONFIG_FILE");
+	printf("Usage: core -f SOCKET_FD -a APP_NAME -k KEY -c CONFIG_FILE [-i sockpair|shm]");
 	exit(1);
 }
 
-int load_core_config(const char* config_file)
-{
-	int error = 0; //no error
-	JSON* core_json = NULL;
-
-	int log_lvl = 0;
-	char* log_file = NULL;
-
-	JSON* config_json = json_load_from_file(config_file);
-
-	if (config_json == NULL)
-	{
-		error = -1;
-		goto final;
-	}
-
-	core_json = json_get_json(config_json, "core_config");
-	if(core_json == NULL)// TODO: validate against a schema
-	{
-		error = -2;
-		goto final;
-	}
-
-	log_lvl = json_get_int(core_json, "log_level");
-	log_file = json_get_str(core_json, "log_file");
-
-	if(log_file == NULL)
-	{
-		log_file = malloc(PATH_MAX+1);
-		sprintf(log_file, "log/core_%s_%s", app_name, app_key);
-	}
-
-	slog_init_args(log_lvl, log_lvl, 1, 1, NULL);//, log_file);
-
-	final:{
-		json_free(core_json);
-		json_free(config_json);
-		free(log_file);
-		return error;
-	}
-}
-
 #ifdef __ANDROID__ /* On Android we build as a library (and I can't
 					  figure out how exclude this file). */
 int main_(int argc, char *argv[])
@@ -109,6 +68,18 @@ int main(int argc, char *argv[])
 	if(load_core_config(argv[8]))
 		print_usage_exit();
 
+	/* optional: the ipc module the app connected with */
+	const char* ipc_lib = NULL;
+	if(argc >= 11)
+	{
+		if(strcmp(argv[9], "-i"))
+			print_usage_exit();
+		if(!strcmp(argv[10], "shm"))
+			ipc_lib = "/usr/local/etc/middleware/com_modules/libcommoduleshm.so";
+		else if(strcmp(argv[10], "sockpair"))
+			print_usage_exit();
+	}
+
 	// We have at least the correct number of params.
 	/*slog(SLOG_INFO, "CORE MAIN: Starting core with args:\n"
 			"\t%s %s \n"
@@ -120,7 +91,7 @@ int main(int argc, char *argv[])
 
 	if(fd != 0)
 	{
-		if (core_init_fd(fd, argv[4], argv[6]))
+		if (core_init_fd(fd, argv[4], argv[6], ipc_lib))
 			return EXIT_FAILURE;
 	}
 
@@ -14,6 +14,9 @@
 #include "message.h"
 #include "state.h"
 #include "rdcs.h"
+#include "session.h"
+#include "core_callbacks.h"
+#include "json_filter.h"
 #include "sync.h"
 
 #include "com_wrapper.h"
@@ -23,12 +26,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
 
 //TODO: REMOVE:
 #include "manifest.h"
+#include "core_embedded.h"
 
 extern HashMap* locales;
 
@@ -36,7 +41,15 @@ extern STATE* app_state;
 
 extern HashMap* rdcs;
 
-extern int map_sync_pipe[2];
+/* cost recorded for a module when a map over it fails (ms) */
+#define CORE_MAP_FAIL_COST	5000.0
+
+double elapsed_ms(struct timespec* since)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
 
 extern void core_on_data(COM_MODULE* module, int conn, const void* data, unsigned int size);
 extern void core_on_connect(COM_MODULE* module, int conn);
@@ -71,45 +84,126 @@ int core_map(LOCAL_EP* lep, COM_MODULE* com_module, const char* addr, JSON* ep_q
     if (!lep)
         return EP_NO_EXIST;
 
-    /* result from thread sync */
-    char* result = NULL;
+    /* result from the protocol steps */
+    int result;
     /* new connection */
     int map_conn = -1;
     /* the new connection state */
     STATE* state_ptr = NULL;
+    /* a session token was sent in hello */
+    int offered = 0;
 
-    /* init sync between threads */
-    sync_init(map_sync_pipe);
+    /* time the whole map to rank the module */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    /* attempt to connect; response is in another thread */
-    map_conn = (*(com_module->fc_connect))(addr);
+    /* already connected to this peer: only a map, on a new channel.
+     * a connection on its way out takes no channels: connect anew */
+    STATE* peer = states_get_peer(com_module, addr);
+    if (peer != NULL)
+    {
+        state_ptr = state_open_channel(peer);
+        state_put(peer);
+        if (state_ptr != NULL)
+            goto map;
+    }
 
-    /* wait for hello response from on_connect */
-    result = sync_wait(map_sync_pipe[1]);
+    /* attempt to connect; the protocol runs in the receive thread.
+     * the map goes out with hello if on_connect runs in this thread */
+    char* session_pair;
+    char* session = session_find(com_module, addr, &session_pair);
+    offered = session != NULL;
+    core_proto_set_pending_map(lep, ep_query, cpt_query);
+    core_proto_set_pending_session(session, session_pair);
+    map_conn = (*(com_module->fc_connect))(addr);
+    core_proto_set_pending_map(NULL, NULL, NULL);
+    core_proto_set_pending_session(NULL, NULL);
+    free(session);
+    free(session_pair);
 
     if (map_conn <= 0)
+    {
+        /* unreachable this way: push the module down */
+        com_module_add_cost(com_module, CORE_MAP_FAIL_COST);
         return EP_ERROR; // TODO: better return value
+    }
 
-    /* wait for access ok from auth message */
-    result = sync_wait(map_sync_pipe[1]);
-
-    /* at this moment there must be a connection state instantiated */
-    state_ptr = states_get(com_module, map_conn);
+    /* the state is instantiated in on_connect, maybe in another thread */
+    state_ptr = states_wait(com_module, map_conn, STATE_SYNC_DEADLINE);
     if(state_ptr == NULL)
     {
-    	return -1;
+        /* a state made after this goes with the connection */
+        (*(com_module->fc_connection_close))(map_conn);
+        com_module_add_cost(com_module, CORE_MAP_FAIL_COST);
+        return -1;
+    }
+
+    /* wait for hello ack, then for access ok from auth */
+    result = state_sync_wait(state_ptr, 1, STATE_SYNC_DEADLINE);
+    if (result == STATE_SYNC_OK)
+        result = state_sync_wait(state_ptr, 2, STATE_SYNC_DEADLINE);
+    if (result != STATE_SYNC_OK)
+    {
+        /* closed states are freed by on_disconnect, do not touch;
+         * a peer that stalled: close the connection and free the state */
+        if (result == STATE_SYNC_TIMEOUT)
+            core_on_disconnect(com_module, map_conn);
+        com_module_add_cost(com_module, CORE_MAP_FAIL_COST);
+        return EP_ERROR;
+    }
+    /* channels opened from this side are odd, the peer's even */
+    state_ptr->next_channel = 1;
+
+    /* the peer mapped in its answer to our hello */
+    if (state_ptr->optimistic)
+    {
+        result = state_sync_wait(state_ptr, 3, STATE_SYNC_DEADLINE);
+        goto mapped;
     }
 
+map:
+    result = STATE_SYNC_OK;
+    unsigned int events = state_sync_events(state_ptr);
     core_proto_map_to(state_ptr, lep, ep_query, cpt_query);
-    result = sync_wait(map_sync_pipe[1]);
+    /* only transport modules answer with a map ack */
+    if ((*com_module->fc_is_bridge)())
+        result = state_sync_wait(state_ptr, events+1, STATE_SYNC_DEADLINE);
+
+mapped:
+    if (result == STATE_SYNC_CLOSED)
+    {
+        com_module_add_cost(com_module, CORE_MAP_FAIL_COST);
+        return EP_ERROR;
+    }
+
+    if (result == STATE_SYNC_TIMEOUT && state_ptr->flag == 0)
+        state_ptr->flag = EP_ERROR;
 
     if (state_ptr->flag != 0 || state_ptr->state == STATE_BAD)
     {
-        ;
+        com_module_add_cost(com_module, CORE_MAP_FAIL_COST);
+        int flag = state_ptr->flag ? state_ptr->flag : -1;
+        if (state_ptr->parent != NULL)
+            state_close_channel(state_ptr);
+        else
+            core_on_disconnect(com_module, state_ptr->conn);
+        return flag;
     }
     else
     {
+        free(state_ptr->addr);
         state_ptr->addr = strdup(addr);
+        com_module_add_cost(com_module, elapsed_ms(&start));
+
+        /* resume next time without credentials */
+        if (state_ptr->parent == NULL && !state_ptr->resumed)
+        {
+            if (state_ptr->session_key != NULL && state_ptr->session_issued != NULL)
+                session_remember(com_module, addr, state_ptr->session_key,
+                        state_ptr->session_issued, state_ptr->cpt_manifest);
+            else if (offered)
+                session_forget(com_module, addr);
+        }
     }
 
     return state_ptr->flag;
@@ -122,18 +216,19 @@ int core_map_all_modules(LOCAL_EP* lep, const char* addr, JSON* ep_query, JSON*
 
     int i;
     COM_MODULE* com_module;
-    char* com_module_name;
-    Array* com_modules_names = map_get_keys(com_modules);
+    /* same host transports first, then network, then brokers */
+    Array* ranked = com_get_ranked_modules();
     // change with ep->modules
-    for (i = 0; i < map_size(com_modules); i++) {
-        com_module_name = array_get(com_modules_names, i);
-        com_module = map_get(com_modules, (void*)com_module_name);
+    for (i = 0; i < array_size(ranked); i++) {
+        com_module = array_get(ranked, i);
+        if (!(*(com_module->fc_is_valid_address))(addr))
+            continue;
         result = core_map(lep, com_module, addr, ep_query, cpt_query);
         if (result == 0)
             break;
     }
 
-    array_free(com_modules_names);
+    array_free(ranked);
     return result;
 }
 
@@ -172,17 +267,49 @@ void core_map_lookup(LOCAL_EP* lep, JSON* ep_query, JSON* cpt_query, int max_map
         {
         	JSON* ep = array_get(r->lookup_result, j);
         	Array* all_addrs = json_get_jsonarray(ep, "com_modules");
-        	int k;
-			for (k = 0; k < array_size(all_addrs); k++)
+        	/* a unix path or shm name means this host only */
+        	int same_host = manifest_same_host(ep);
+        	int k, n = 0;
+        	int nb_addrs = array_size(all_addrs);
+        	COM_MODULE* modules[nb_addrs > 0 ? nb_addrs : 1];
+        	char* addrs[nb_addrs > 0 ? nb_addrs : 1];
+
+        	/* the modules both sides have, best first */
+			for (k = 0; k < nb_addrs; k++)
 			{
 				JSON* module_addr = array_get(all_addrs, k);
 				char* module_name = json_get_str(module_addr, "name");
 				COM_MODULE* module = com_get_module(module_name);
+				free(module_name);
 				char* addr = json_get_str(module_addr, "address");
-				if (core_map(lep, module, addr, ep_query, cpt_query) == 0)
-					return;
+				if (module == NULL || !(*(module->fc_is_valid_address))(addr)
+						|| (module->locality == COM_LOCALITY_HOST && !same_host))
+				{
+					free(addr);
+					continue;
+				}
+
+				int pos;
+				for (pos = n; pos > 0 && com_module_compare(modules[pos-1], module) > 0; pos--)
+				{
+					modules[pos] = modules[pos-1];
+					addrs[pos] = addrs[pos-1];
+				}
+				modules[pos] = module;
+				addrs[pos] = addr;
+				n++;
 			}
 
+			int mapped = 0;
+			for (k = 0; k < n; k++)
+			{
+				if (!mapped && core_map(lep, modules[k], addrs[k], ep_query, cpt_query) == 0)
+					mapped = 1;
+				free(addrs[k]);
+			}
+			if (mapped)
+				return;
+
             // core_map(lep, tcp_module, addr, ep_query, cpt_query);
             //core_map_all_modules(lep, addr, ep_query, cpt_query);
 
@@ -254,17 +381,27 @@ int core_ep_send_message(LOCAL_EP* lep, const char* msg_id, const char* msg)
     if (!ep_can_send(lep->ep))
         return EP_NO_SEND;
 
-    JSON* msg_json = json_new(msg);
-    if (json_validate_message(lep, msg_json))
-        return EP_NO_VALID;
+    /*
+     * the app's text is the body as it is, spliced into the envelope;
+     * a json tree only for a message the policy validates
+     */
+    if (msg == NULL)
+        msg = "{}";
 
-    MESSAGE* msg_msg = message_new_id_json(msg_id, msg_json, MSG_MSG);
-    char* msg_to_send = message_to_str(msg_msg);
+    JSON* msg_json = NULL;
+    if (lep->msg_validator != NULL && ep_validate_due(lep))
+    {
+        msg_json = json_new(msg);
+        /* as json_validate_message: logged and counted, still sent */
+        ep_validate_now(lep, lep->msg_validator, msg_json);
+    }
 
-		slog(SLOG_DEBUG, "CORE_EP_SEND_MESSAGE: %s", msg_to_send);
-    ep_send(lep, msg_to_send, strlen(msg_to_send));
+    MESSAGE* msg_msg = message_new_raw(msg_id, msg, strlen(msg), msg_json, MSG_MSG);
 
-    json_free(msg_json);
+    /* serialised once per encoding the mappings use */
+    ep_send_message(lep, msg_msg);
+
+    message_free(msg_msg);
 
     return 0;
 }
@@ -438,10 +575,7 @@ void core_ep_stream_start(LOCAL_EP* lep)
     if(lep->ep->type != EP_STR_SRC && lep->ep->type != EP_STR_SNK)
     	return;
 
-    //build a MSG_STR_CMD message with flag set on STOP
-    JSON* msg_json = json_new(NULL);
-    json_set_int(msg_json, "command", 1);
-    ep_send_json(lep, msg_json, message_generate_id(), MSG_STREAM_CMD);
+    ep_stream_command(lep, 1);
 
     lep->flag = 1;
 }
@@ -455,10 +589,7 @@ void core_ep_stream_stop(LOCAL_EP* lep)
     if(lep->ep->type != EP_STR_SRC && lep->ep->type != EP_STR_SNK)
     	return;
 
-    //build a MSG_STR_CMD message with flag set on STOP
-    JSON* msg_json = json_new(NULL);
-    json_set_int(msg_json, "command", 0);
-    ep_send_json(lep, msg_json, message_generate_id(), MSG_STREAM_CMD);
+    ep_stream_command(lep, 0);
 
     lep->flag = 0;
 }
@@ -473,23 +604,7 @@ void core_ep_stream_send(LOCAL_EP* lep, const char* msg)
     	return;
 
 
-    //build a MSG_STREAM message
-    JSON* msg_json = json_new(NULL);
-    json_set_str(msg_json, "stream", msg);
-
-    MESSAGE* msg_msg = message_new_json(msg_json, MSG_STREAM);
-
-    ep_send_message(lep, msg_msg);
-    printf("sent\n\n");
-
-    json_free(msg_json);
-    message_free(msg_msg);
-
-
-    //ep_send_json(lep, msg_json, message_generate_id(), MSG_STREAM);
-
-
-    //lep->flag = 1;
+    ep_stream_send(lep, msg);
 }
 
 void core_ep_set_access(LOCAL_EP* lep, const char* subject)
@@ -596,6 +711,8 @@ void core_add_filter(LOCAL_EP* lep, const char* filter)
 {
 	slog(SLOG_DEBUG, "CORE: %s", __func__);
     array_add(lep->filters, strdup_null(filter));
+    array_add(lep->filters_compiled, json_filter_compile_local(filter));
+    ep_send_filters(lep);
 }
 
 void core_reset_filter(LOCAL_EP* lep, Array* new_filters)
@@ -607,6 +724,48 @@ void core_reset_filter(LOCAL_EP* lep, Array* new_filters)
         lep->filters = new_filters;
     else
         lep->filters = array_new(ELEM_TYPE_STR);
+
+    json_filter_free_array(lep->filters_compiled);
+    lep->filters_compiled = json_filter_compile_array_local(lep->filters);
+    ep_send_filters(lep);
+}
+
+void core_ep_update_msg(LOCAL_EP* lep, const char* msg_schema)
+{
+	slog(SLOG_DEBUG, "CORE: %s", __func__);
+    JSON* schema_json = json_new(msg_schema);
+    ep_local_set_schema(lep, schema_json, 0);
+    json_free(schema_json);
+}
+
+void core_ep_update_resp(LOCAL_EP* lep, const char* resp_schema)
+{
+	slog(SLOG_DEBUG, "CORE: %s", __func__);
+    JSON* schema_json = json_new(resp_schema);
+    ep_local_set_schema(lep, schema_json, 1);
+    json_free(schema_json);
+}
+
+void core_ep_set_validation(LOCAL_EP* lep, const char* policy, int sample)
+{
+	slog(SLOG_DEBUG, "CORE: %s", __func__);
+    int validation = ep_validation_policy(policy);
+    if (lep == NULL || validation < 0)
+        return;
+
+    ep_set_validation(lep, validation, sample > 0 ? sample : 0);
+}
+
+char* core_ep_get_stats(LOCAL_EP* lep)
+{
+	slog(SLOG_DEBUG, "CORE: %s", __func__);
+    JSON* stats_json = ep_stats_to_json(lep);
+    if (stats_json == NULL)
+        return NULL;
+
+    char* result = json_to_str(stats_json);
+    json_free(stats_json);
+    return result;
 }
 
 void core_terminate()
@@ -646,6 +805,10 @@ void core_terminate()
     (*(app_state->module->fc_connection_close))(app_state->conn);
 
 		eps_free();
+
+    /* inside the app process the app decides when to exit */
+    if (core_embedded)
+        return;
     exit(0);
 }
 
@@ -669,6 +832,7 @@ int core_load_com_module(const char* lib_path, const char* config_json)
     (*(com_module->fc_set_on_disconnect))((void (*)(void *, int))core_on_disconnect);
 
     map_update(com_modules, (void*)com_module->name, (void*)com_module);
+    manifest_invalidate();
 
     printf("ok\n\n");
     return 0;
@@ -677,7 +841,9 @@ int core_load_com_module(const char* lib_path, const char* config_json)
 int core_load_access_module(const char* path, const char* config_json)
 {
 	slog(SLOG_DEBUG, "CORE: %s", __func__);
-    return access_load_module(path, config_json);
+    int ret = access_load_module(path, config_json);
+    manifest_invalidate();
+    return ret;
 }
 
 /* connections */
@@ -101,6 +101,17 @@ void core_add_filter(LOCAL_EP* lep, const char *filter);
 
 void core_reset_filter(LOCAL_EP* lep, Array* new_filters);
 
+/* ep schemas */
+void core_ep_update_msg(LOCAL_EP* lep, const char* msg_schema);
+
+void core_ep_update_resp(LOCAL_EP* lep, const char* resp_schema);
+
+/* policy: always, sampled or trusted; sample: N for sampled, 0 for default */
+void core_ep_set_validation(LOCAL_EP* lep, const char* policy, int sample);
+
+/* validation counters of the ep, json */
+char* core_ep_get_stats(LOCAL_EP* lep);
+
 void core_ep_set_access(LOCAL_EP* lep, const char* subject);
 
 void core_ep_reset_access(LOCAL_EP* lep, const char* subject);
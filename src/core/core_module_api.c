@@ -457,6 +457,65 @@ void core_reset_filter_array(Array* argv)
 	json_free(new_filters_json);
 }
 
+void core_ep_update_msg_array(Array* argv)
+{
+	if (array_size(argv) < 2)
+		return;
+
+	char* ep_id = (char*)array_get( argv, 0 );
+	char* msg_schema = (char*)array_get( argv, 1 );
+
+	LOCAL_EP *lep = map_get(locales, ep_id);
+
+	if (!lep)
+		return;
+
+	core_ep_update_msg(lep, msg_schema);
+}
+
+void core_ep_update_resp_array(Array* argv)
+{
+	if (array_size(argv) < 2)
+		return;
+
+	char* ep_id = (char*)array_get( argv, 0 );
+	char* resp_schema = (char*)array_get( argv, 1 );
+
+	LOCAL_EP *lep = map_get(locales, ep_id);
+
+	if (!lep)
+		return;
+
+	core_ep_update_resp(lep, resp_schema);
+}
+
+void core_ep_set_validation_array(Array* argv)
+{
+	if (array_size(argv) < 2)
+		return;
+
+	char* ep_id = (char*)array_get( argv, 0 );
+	char* policy = (char*)array_get( argv, 1 );
+	int sample = 0;
+	if (array_size(argv) >= 3)
+		sample = atoi((char*)array_get( argv, 2 ));
+
+	LOCAL_EP *lep = map_get(locales, ep_id);
+
+	core_ep_set_validation(lep, policy, sample);
+}
+
+char* core_ep_get_stats_array(Array* argv)
+{
+	if (array_size(argv) < 1)
+		return NULL;
+
+	char* ep_id = (char*)array_get( argv, 0 );
+	LOCAL_EP *lep = map_get(locales, ep_id);
+
+	return core_ep_get_stats(lep);
+}
+
 void core_ep_set_access_array(Array* argv)
 {
 	if (array_size(argv) < 2)
@@ -598,7 +657,11 @@ char* _core_call_array(const char* module_id, const char* function_id, const cha
 			return NULL;
 		}
 		MESSAGE * result = (MESSAGE*) (*fc)(args);
+		if(result == NULL)
+			return NULL;
 		return_value=message_to_str(result);
+		/* the queue's ref */
+		message_free(result);
 		//return result;
 	}
 
@@ -660,6 +723,10 @@ int _core_init()
 
 	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_add_filter",     "voi"), core_add_filter_array);
 	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_reset_filter",   "voi"), core_reset_filter_array);
+	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_update_msg",     "voi"), core_ep_update_msg_array);
+	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_update_resp",    "voi"), core_ep_update_resp_array);
+	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_set_validation", "voi"), core_ep_set_validation_array);
+	map_insert(str_function_table_array,  _core_get_id(id, "core", "ep_get_stats",      "str"), core_ep_get_stats_array);
 	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_set_access",     "voi"), core_ep_set_access_array);
 	map_insert(void_function_table_array, _core_get_id(id, "core", "ep_reset_access",   "voi"), core_ep_reset_access_array);
 
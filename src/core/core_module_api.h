@@ -94,6 +94,16 @@ void core_add_filter_array(Array* argv);
 
 void core_reset_filter_array(Array* argv);
 
+/* endpoint schemas */
+void core_ep_update_msg_array(Array* argv);
+
+void core_ep_update_resp_array(Array* argv);
+
+/* validation policy and counters */
+void core_ep_set_validation_array(Array* argv);
+
+char* core_ep_get_stats_array(Array* argv);
+
 void core_ep_set_access_array(Array* argv);
 
 void core_ep_reset_access_array(Array* argv);
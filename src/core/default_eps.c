@@ -15,6 +15,7 @@
 #include "json.h"
 #include "json_builds.h"
 #include "manifest.h"
+#include "environment.h"
 #include "state.h"
 #include <utils.h>
 
@@ -40,7 +41,7 @@ extern HashMap* rdcs;
 
 void map_handler(MESSAGE* msg)
 {
-	JSON* map_json = msg->_msg_json;
+	JSON* map_json = message_json(msg);
 
 	printf("map_handler: %s\n", json_to_str(map_json));
 
@@ -75,7 +76,7 @@ void map_handler(MESSAGE* msg)
 
 void map_lookup_handler(MESSAGE* msg)
 {
-	JSON *map_json = msg->_msg_json;
+	JSON *map_json = message_json(msg);
 
 	Array* ep_array = json_get_array(map_json, "endpoint");
 	JSON* ep_json = json_new(NULL);
@@ -109,7 +110,7 @@ void map_lookup_handler(MESSAGE* msg)
 void unmap_handler(MESSAGE* msg)
 {
 	//slog(SLOG_DEBUG, "CORE: map handler");
-	JSON *unmap_json = msg->_msg_json;
+	JSON *unmap_json = message_json(msg);
 	JSON *ep_json = json_get_json(unmap_json, "endpoint");
 	char* ep_name = json_get_str(ep_json, "ep_name");
 	//char* address = json_get_str(map_json, "address");
@@ -154,7 +155,7 @@ void lookup_handler(MESSAGE* msg)
 		return;
 	}
 
-	JSON* lookup_json = msg->_msg_json;
+	JSON* lookup_json = message_json(msg);
 	Array *results_array  = json_get_jsonarray(lookup_json, "results");
 
 
@@ -187,7 +188,7 @@ void md_handler(MESSAGE* msg)
 
 	//ep_send_str_message(default_ep_md, resp_str); //TODO: check
 	int r = ep_send_json(default_ep_md,
-			resp_msg->_msg_json,
+			message_json(resp_msg),
 			resp_msg->msg_id,
 			MSG_RESP_LAST);
 
@@ -202,7 +203,7 @@ void md_handler(MESSAGE* msg)
 void add_rdc_handler(MESSAGE* msg)
 {
 	//slog(SLOG_DEBUG, "CORE: add rdc handler %s", message_to_str(msg));
-	JSON *add_rdc_json = msg->_msg_json;
+	JSON *add_rdc_json = message_json(msg);
 	char* rdc_module_name = strdup_null(json_get_str(add_rdc_json, "module"));
 	char* rdc_addr = strdup_null(json_get_str(add_rdc_json, "address"));
 
@@ -219,7 +220,7 @@ void terminate_handler(MESSAGE* msg)
 
 void load_com_module_ep_handler(MESSAGE* msg)
 {
-	JSON* msg_json = msg->_msg_json;
+	JSON* msg_json = message_json(msg);
 	char* module_path = json_get_str(msg_json, "module_path");
 	char* config_path = json_get_str(msg_json, "config_path");
 
@@ -228,7 +229,7 @@ void load_com_module_ep_handler(MESSAGE* msg)
 
 void load_access_module_ep_handler(MESSAGE* msg)
 {
-	JSON* msg_json = msg->_msg_json;
+	JSON* msg_json = message_json(msg);
 	char* module_path = json_get_str(msg_json, "module_path");
 	char* config_pth = json_get_str(msg_json, "config_pth");
 
@@ -245,57 +246,57 @@ void register_default_endpoints()
 {
 	JSON* from_file_json;
 
-	from_file_json = json_load_from_file("default_eps/reg_rdc.json");
+	from_file_json = json_load_from_file(ETC "default_eps/reg_rdc.json");
 	ep_reg_rdc = ep_local_new(from_file_json, NULL);
 	ep_reg_rdc->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/lookup_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/lookup_ep.json");
 	ep_lookup = ep_local_new(from_file_json, &lookup_handler);
 	ep_lookup->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/map_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/map_ep.json");
 	default_ep_map = ep_local_new(from_file_json, &map_handler);
 	default_ep_map->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/map_lookup_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/map_lookup_ep.json");
 	default_ep_map_lookup = ep_local_new(from_file_json, &map_lookup_handler);
 	default_ep_map_lookup->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/unmap_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/unmap_ep.json");
 	ep_local_new(from_file_json, &unmap_handler)->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/add_rdc_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/add_rdc_ep.json");
 	ep_local_new(from_file_json, &add_rdc_handler)->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/md_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/md_ep.json");
 	default_ep_md = ep_local_new(from_file_json, &md_handler);
 	default_ep_md->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/terminate.json");
+	from_file_json = json_load_from_file(ETC "default_eps/terminate.json");
 	default_ep_terminate = ep_local_new(from_file_json, &terminate_handler);
 	default_ep_terminate->is_default = 1;
 	json_free(from_file_json);
 
 	/* new endpoint for modules */
 
-	from_file_json = json_load_from_file("default_eps/load_com_module_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/load_com_module_ep.json");
 	load_com_module_ep = ep_local_new(from_file_json, &load_com_module_ep_handler);
 	load_com_module_ep->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/load_access_module_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/load_access_module_ep.json");
 	load_access_module_ep = ep_local_new(from_file_json, &load_access_module_ep_handler);
 	load_access_module_ep->is_default = 1;
 	json_free(from_file_json);
 
-	from_file_json = json_load_from_file("default_eps/set_credentials_ep.json");
+	from_file_json = json_load_from_file(ETC "default_eps/set_credentials_ep.json");
 	set_credentials_ep = ep_local_new(from_file_json, &set_credentials_ep_handler);
 	set_credentials_ep->is_default = 1;
 	json_free(from_file_json);
@@ -12,13 +12,26 @@
 #include "hashmap.h"
 #include "state.h"
 #include "json_filter.h"
+#include "manifest.h"
 #include <utils.h>
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include <pthread.h>
 
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 0
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 pthread_mutex_t ipc_lock;
 
 extern STATE* app_state;
@@ -27,10 +40,25 @@ extern STATE* app_state;
 extern HashMap *endpoints;
 extern HashMap *locales;
 
+/*
+ * index of the local eps on the properties map queries compare for
+ * equality: value -> Array of the LOCAL_EPs that have it
+ */
+#define EP_INDEX_SIZE	4
+const char* ep_index_props[EP_INDEX_SIZE] = {"ep_name", "ep_type", "msg_hash", "resp_hash"};
+HashMap* ep_index[EP_INDEX_SIZE];
+pthread_mutex_t ep_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void ep_index_add(LOCAL_EP *lep);
+void ep_index_remove(LOCAL_EP *lep);
+
+/* from core_config, for eps that do not set their own */
+int ep_validation_default = EP_VALIDATE_ALWAYS;
+unsigned int ep_validation_sample_default = EP_VALIDATE_SAMPLE;
+
 /* default handlers for messages coming from other to the local ep */
 void ep_default_handler_send_to_app(MESSAGE* msg);
 void ep_default_handler_queuing(MESSAGE* msg);
-void ep_send_stream_fd();
 
 LOCAL_EP* ep_local_new(JSON *ep_json, void(* from_ext_handler)(MESSAGE*))
 {
@@ -45,6 +73,11 @@ LOCAL_EP* ep_local_new(JSON *ep_json, void(* from_ext_handler)(MESSAGE*))
 
 	LOCAL_EP *lep = (LOCAL_EP*)malloc(sizeof(LOCAL_EP));
 	lep->mappings_states = lep->messages = lep->responses = lep->filters = NULL;
+	lep->filters_compiled = NULL;
+	lep->mapping_filters = NULL;
+	lep->msg_validator = lep->resp_validator = NULL;
+	lep->msg_codec = lep->resp_codec = NULL;
+	lep->retired_codecs = NULL;
 
 	void(* ep_handler)(MESSAGE*);
 	lep->id = strdup_null(json_get_str(json_data, "ep_id"));
@@ -67,6 +100,18 @@ LOCAL_EP* ep_local_new(JSON *ep_json, void(* from_ext_handler)(MESSAGE*))
 
 	lep->msg_schema = json_get_json(json_data, "message");
 	lep->resp_schema = json_get_json(json_data, "response");
+	lep->msg_validator = json_schema_compile(lep->msg_schema);
+	lep->resp_validator = json_schema_compile(lep->resp_schema);
+	lep->msg_codec = json_codec_compile(lep->msg_schema);
+	lep->resp_codec = json_codec_compile(lep->resp_schema);
+
+	memset(&lep->stats, 0, sizeof(EP_STATS));
+	pthread_mutex_init(&lep->stats_lock, NULL);
+	char* validation = json_get_str(json_data, "validation");
+	int validation_sample = json_get_int(json_data, "validation_sample");
+	ep_set_validation(lep, ep_validation_policy(validation),
+			validation_sample > 0 ? validation_sample : 0);
+	free(validation);
 
 	char* msg_schema_str = json_to_str(lep->msg_schema);
 	char* resp_schema_str = json_to_str(lep->resp_schema);
@@ -110,6 +155,8 @@ LOCAL_EP* ep_local_new(JSON *ep_json, void(* from_ext_handler)(MESSAGE*))
 	lep->responses = array_new(ELEM_TYPE_PTR);
 
 	lep->filters = array_new(ELEM_TYPE_STR);
+	lep->filters_compiled = array_new(ELEM_TYPE_PTR);
+	lep->mapping_filters = filter_set_new();
 
 	lep->is_default = 0; /* is app endpoint */
 	lep->is_visible = 1; /* is visible */
@@ -117,6 +164,8 @@ LOCAL_EP* ep_local_new(JSON *ep_json, void(* from_ext_handler)(MESSAGE*))
 	/* add to maps of all eps */
 	map_insert(endpoints, lep->id, lep->ep);
 	map_insert(locales, lep->id, lep);
+	ep_index_add(lep);
+	manifest_invalidate();
 
 	return lep;
 }
@@ -130,6 +179,8 @@ int ep_local_remove(LOCAL_EP *lep)
 
 	map_remove(locales, lep->ep->id);
 	map_remove(endpoints, lep->ep->id);
+	ep_index_remove(lep);
+	manifest_invalidate();
 
 	ep_local_free(lep);
 	return 0;
@@ -146,9 +197,23 @@ void ep_local_free(LOCAL_EP *lep)
 	//array_free(lep->com_modules);
 
 	array_free(lep->filters);
+	json_filter_free_array(lep->filters_compiled);
+	filter_set_free(lep->mapping_filters);
 
 	json_free(lep->msg_schema);
 	json_free(lep->resp_schema);
+	json_schema_free(lep->msg_validator);
+	json_schema_free(lep->resp_validator);
+	json_codec_free(lep->msg_codec);
+	json_codec_free(lep->resp_codec);
+	if(lep->retired_codecs)
+	{
+		int i;
+		for(i = 0; i < array_size(lep->retired_codecs); i++)
+			json_codec_free((JSON_CODEC*)array_get(lep->retired_codecs, i));
+		array_free(lep->retired_codecs);
+	}
+	pthread_mutex_destroy(&lep->stats_lock);
 
 	array_free(lep->mappings_states);
 
@@ -160,38 +225,164 @@ void ep_local_free(LOCAL_EP *lep)
 
 
 
-void ep_default_handler_send_to_app(MESSAGE* msg)
+void ep_local_set_schema(LOCAL_EP *lep, JSON *schema, int resp)
 {
+	if(lep == NULL)
+		return;
 
-	pthread_mutex_lock(&ipc_lock);
+	JSON** schema_ptr = resp ? &lep->resp_schema : &lep->msg_schema;
+	JSON_SCHEMA** validator_ptr = resp ? &lep->resp_validator : &lep->msg_validator;
+	JSON_CODEC** codec_ptr = resp ? &lep->resp_codec : &lep->msg_codec;
+	char** hash_ptr = resp ? &lep->ep->resp : &lep->ep->msg;
+
+	char* schema_str = json_to_str(schema);
+
+	/* the hash is indexed */
+	ep_index_remove(lep);
+
+	json_free(*schema_ptr);
+	*schema_ptr = _json_dup(schema);
+	json_schema_free(*validator_ptr);
+	*validator_ptr = json_schema_compile(schema);
+	/* mappings may still encode with the old one */
+	if(*codec_ptr)
+	{
+		if(lep->retired_codecs == NULL)
+			lep->retired_codecs = array_new(ELEM_TYPE_PTR);
+		array_add(lep->retired_codecs, *codec_ptr);
+	}
+	*codec_ptr = json_codec_compile(schema);
+
+	free(*hash_ptr);
+	*hash_ptr = NULL;
+	if(schema_str)
+		*hash_ptr = hash(schema_str);
+	free(schema_str);
+
+	ep_index_add(lep);
+	manifest_invalidate();
+}
+
+int ep_validation_policy(const char *name)
+{
+	if(name == NULL)
+		return -1;
+	if(!strcmp(name, "always"))
+		return EP_VALIDATE_ALWAYS;
+	if(!strcmp(name, "sampled"))
+		return EP_VALIDATE_SAMPLED;
+	if(!strcmp(name, "trusted"))
+		return EP_VALIDATE_TRUSTED;
+	return -1;
+}
+
+void ep_set_validation_default(int policy, unsigned int sample)
+{
+	if(policy >= 0)
+		ep_validation_default = policy;
+	if(sample > 0)
+		ep_validation_sample_default = sample;
+}
+
+void ep_set_validation(LOCAL_EP *lep, int policy, unsigned int sample)
+{
+	if(lep == NULL)
+		return;
+
+	pthread_mutex_lock(&lep->stats_lock);
+	lep->validation = policy >= 0 ? policy : ep_validation_default;
+	lep->validation_sample = sample > 0 ? sample : ep_validation_sample_default;
+	pthread_mutex_unlock(&lep->stats_lock);
+}
+
+int ep_validate(LOCAL_EP *lep, JSON_SCHEMA *validator, JSON *msg)
+{
+	/* no schema: nothing to check, nothing counted */
+	if(validator == NULL || !ep_validate_due(lep))
+		return JSON_OK;
+
+	return ep_validate_now(lep, validator, msg);
+}
+
+int ep_validate_due(LOCAL_EP *lep)
+{
+	int check;
+
+	pthread_mutex_lock(&lep->stats_lock);
+	switch(lep->validation)
+	{
+	case EP_VALIDATE_TRUSTED:
+		check = 0;
+		break;
+	case EP_VALIDATE_SAMPLED:
+		/* the first message, then every validation_sample-th */
+		check = ((lep->stats.validated + lep->stats.validation_skipped)
+				% lep->validation_sample) == 0;
+		break;
+	default:
+		check = 1;
+	}
+	if(!check)
+		lep->stats.validation_skipped++;
+	pthread_mutex_unlock(&lep->stats_lock);
+
+	return check;
+}
+
+int ep_validate_now(LOCAL_EP *lep, JSON_SCHEMA *validator, JSON *msg)
+{
+	if(validator == NULL)
+		return JSON_OK;
 
-	const char delim1 = '{';
-	const char delim2 = '}';
-	const char* delim21 = "}{";
-	const char a = 'a', b = 'b';
+	int result = json_schema_validate(validator, msg);
 
-	COM_MODULE* sockpair_module = app_state->module;
-	(*(sockpair_module->fc_send))(app_state->conn, &delim1, 1);
+	pthread_mutex_lock(&lep->stats_lock);
+	lep->stats.validated++;
+	if(result != JSON_OK)
+		lep->stats.validation_failed++;
+	pthread_mutex_unlock(&lep->stats_lock);
 
-	(*(sockpair_module->fc_send))(app_state->conn, &a, 1);
-	(*(sockpair_module->fc_send))(app_state->conn, &delim1, 1);
-	(*(sockpair_module->fc_send))(app_state->conn, msg->ep->id, 10);
-	(*(sockpair_module->fc_send))(app_state->conn, delim21, 2);
+	if(result != JSON_OK)
+		slog(SLOG_WARN, "EP LOCAL: %s: message does not match the schema (%d)", lep->id, result);
 
+	return result;
+}
+
+JSON *ep_stats_to_json(LOCAL_EP *lep)
+{
+	if(lep == NULL)
+		return NULL;
+
+	JSON* stats_json = json_new(NULL);
+	pthread_mutex_lock(&lep->stats_lock);
+	json_set_int(stats_json, "validated", lep->stats.validated);
+	json_set_int(stats_json, "validation_failed", lep->stats.validation_failed);
+	json_set_int(stats_json, "validation_skipped", lep->stats.validation_skipped);
+	pthread_mutex_unlock(&lep->stats_lock);
+
+	return stats_json;
+}
+
+void ep_default_handler_send_to_app(MESSAGE* msg)
+{
+	/* {a{ep_id}{size}{msg}} in one write */
 	char* return_msg = message_to_str(msg);
-	char str[11];
-	sprintf(str, "%010lu", strlen(return_msg));
+	char head[32];
+	int head_len = sprintf(head, "{a{%.10s}{%010lu}{", msg->ep->id, strlen(return_msg));
 
-	//printf("sendig: %s %s\n", str, return_msg);
-	(*(sockpair_module->fc_send))(app_state->conn, str, 10);
-	(*(sockpair_module->fc_send))(app_state->conn, delim21, 2);
-	(*(sockpair_module->fc_send))(app_state->conn, return_msg, strlen(return_msg));
+	struct iovec iov[3];
+	iov[0].iov_base = head;
+	iov[0].iov_len = head_len;
+	iov[1].iov_base = return_msg;
+	iov[1].iov_len = strlen(return_msg);
+	iov[2].iov_base = "}}";
+	iov[2].iov_len = 2;
 
-	(*(sockpair_module->fc_send))(app_state->conn, &delim2, 1);
-	(*(sockpair_module->fc_send))(app_state->conn, &delim2, 1);
+	pthread_mutex_lock(&ipc_lock);
+	com_module_sendv(app_state->module, app_state->conn, iov, 3);
+	pthread_mutex_unlock(&ipc_lock);
 	free(return_msg);
 
-	pthread_mutex_unlock(&ipc_lock);
 	//printf("here\n");
 	//slog(SLOG_INFO, "EP LOCAL: default handler send_to_app: %d: %s", array_size(((LOCAL_EP*)(msg->ep->data))->filters), msg->msg_str);
 	//JSON* msg_json = msg->_msg_json;
@@ -207,26 +398,168 @@ void ep_default_handler_queuing(MESSAGE* msg)
 {
 	//slog(SLOG_INFO, "EP LOCAL: default handler queuing: %s", msg->msg_str);
 
-	JSON* msg_json = msg->_msg_json;
+	/* without filters it is queued, and later fetched, as received */
+	Array* filters = ((LOCAL_EP*)(msg->ep->data))->filters_compiled;
+	int match = (filters == NULL || json_filter_match_array(message_json(msg), filters));
+
+	/* the queue holds a ref, released by the fetch */
 	if( msg->status == MSG_REQ && (msg->ep->type == EP_RESP || msg->ep->type == EP_RESP_P))
-		if(json_filter_validate_array(msg_json, ((LOCAL_EP*)(msg->ep->data))->filters))
-			array_add(((LOCAL_EP*)msg->ep->data)->messages, msg);
+		if(match)
+			array_add(((LOCAL_EP*)msg->ep->data)->messages, message_ref(msg));
 
 	if( (msg->status == MSG_RESP_NEXT || msg->status == MSG_RESP_LAST) &&
 		(msg->ep->type == EP_REQ || msg->ep->type == EP_REQ_P))
-		if(json_filter_validate_array(msg_json, ((LOCAL_EP*)(msg->ep->data))->filters))
-			array_add(((LOCAL_EP*)msg->ep->data)->responses, msg);
+		if(match)
+			array_add(((LOCAL_EP*)msg->ep->data)->responses, message_ref(msg));
 
 	if(	msg->status == MSG_MSG &&
 		(msg->ep->type == EP_SNK || msg->ep->type == EP_SS))
-		if(json_filter_validate_array(msg_json, ((LOCAL_EP*)(msg->ep->data))->filters))
-			array_add(((LOCAL_EP*)msg->ep->data)->messages, msg);
+		if(match)
+			array_add(((LOCAL_EP*)msg->ep->data)->messages, message_ref(msg));
+
+}
+
+/*
+ * a socket pair per state on modules that pass fds: the sink gets
+ * one end with the start command and reads the stream from it. Ours
+ * is non-blocking, a sink that does not keep up gets messages instead.
+ */
+int ep_stream_open_fd(STATE* state, MESSAGE* fd_msg)
+{
+	int pair[2];
+
+	if(state->module->fc_send_fd == NULL)
+		return -1;
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+		return -1;
+	if(fcntl(pair[1], F_SETFL, fcntl(pair[1], F_GETFL, 0) | O_NONBLOCK) < 0
+			|| state_send_message_fd(state, fd_msg, pair[0]) <= 0)
+	{
+		close(pair[0]);
+		close(pair[1]);
+		return -1;
+	}
+	close(pair[0]);
 
+	pthread_mutex_lock(&state->stream_lock);
+	if(state->stream_pipe >= 0)
+		close(state->stream_pipe);
+	state->stream_pipe = pair[1];
+	pthread_mutex_unlock(&state->stream_lock);
+
+	return 0;
+}
+
+/* the sink sees the end of its stream */
+void ep_stream_close_fd(STATE* state)
+{
+	pthread_mutex_lock(&state->stream_lock);
+	if(state->stream_pipe >= 0)
+		close(state->stream_pipe);
+	state->stream_pipe = -1;
+	pthread_mutex_unlock(&state->stream_lock);
 }
 
-void ep_send_stream_fd()
+int ep_stream_command(LOCAL_EP *lep, int command)
 {
+	STATE* state;
+	int i;
+
+	JSON* msg_json = json_new(NULL);
+	json_set_int(msg_json, "command", command);
+	MESSAGE* msg = message_new_json(msg_json, MSG_STREAM_CMD);
+
+	JSON* fd_json = json_new(NULL);
+	json_set_int(fd_json, "command", command);
+	json_set_int(fd_json, "fd", 1);
+	MESSAGE* fd_msg = message_new_json(fd_json, MSG_STREAM_CMD);
 
+	for(i=0; i<array_size(lep->mappings_states); i++)
+	{
+		state = array_get(lep->mappings_states, i);
+		ep_stream_close_fd(state);
+
+		if(command == 1 && lep->ep->type == EP_STR_SRC
+				&& ep_stream_open_fd(state, fd_msg) == 0)
+			continue;
+
+		state_send_message(state, msg);
+	}
+
+	json_free(msg_json);
+	json_free(fd_json);
+	message_free(msg);
+	message_free(fd_msg);
+
+	return 0;
+}
+
+/* bytes written to the non-blocking @fd until it is full, -1 if closed */
+int ep_stream_write(int fd, const char* data, unsigned int size)
+{
+	unsigned int sent = 0;
+	ssize_t result;
+
+	while(sent < size)
+	{
+		result = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+		if(result < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		sent += result;
+	}
+
+	return sent;
+}
+
+int ep_stream_send(LOCAL_EP *lep, const char* data)
+{
+	STATE* state;
+	MESSAGE* msg;
+	JSON* msg_json;
+	unsigned int size = strlen(data);
+	int i, sent;
+
+	for(i=0; i<array_size(lep->mappings_states); i++)
+	{
+		state = array_get(lep->mappings_states, i);
+
+		sent = 0;
+		pthread_mutex_lock(&state->stream_lock);
+		if(state->stream_pipe >= 0)
+		{
+			sent = ep_stream_write(state->stream_pipe, data, size);
+			/*
+			 * closed or full: the rest of the stream goes as messages,
+			 * after what the socket holds
+			 */
+			if(sent < (int)size)
+			{
+				close(state->stream_pipe);
+				state->stream_pipe = -1;
+			}
+			if(sent < 0)
+				sent = 0;
+		}
+		pthread_mutex_unlock(&state->stream_lock);
+
+		if(sent == (int)size)
+			continue;
+
+		msg_json = json_new(NULL);
+		json_set_str(msg_json, "stream", data + sent);
+		msg = message_new_json(msg_json, MSG_STREAM);
+		state_send_message(state, msg);
+		json_free(msg_json);
+		message_free(msg);
+	}
+
+	return 0;
 }
 
 JSON *ep_to_json(ENDPOINT* endpoint)
@@ -305,7 +638,6 @@ int ep_match_desc(LOCAL_EP *lep, const char *rep_desc)
 	return 1;
 }
 
-#include "manifest.h"
 extern COMPONENT* cpt;
 JSON *ep_local_to_json(LOCAL_EP *lep)
 {
@@ -327,16 +659,20 @@ JSON *ep_local_to_json(LOCAL_EP *lep)
 	COM_MODULE* com_module;
 	Array* com_modules_json_array = array_new(ELEM_TYPE_PTR);
 	JSON* com_module_json;
-	lep->com_modules = map_get_values(com_modules);
-	for (i=0; i<array_size(lep->com_modules); i++)
+	/* local: manifest_build and endpoint queries run this concurrently */
+	Array* com_modules_array = map_get_values(com_modules);
+	for (i=0; i<array_size(com_modules_array); i++)
 	{
-		com_module = array_get(lep->com_modules, i);
+		com_module = array_get(com_modules_array, i);
 		com_module_json = json_new(NULL);
 		json_set_str(com_module_json, "name", com_module->name);
 		json_set_str(com_module_json, "address", com_module->address);
 		array_add(com_modules_json_array, com_module_json);
 	}
+	array_free(com_modules_array);
 	json_set_array(lep_json, "com_modules", com_modules_json_array);
+	/* host local modules are only good from the same host */
+	json_set_str(lep_json, "host_id", manifest_host_id());
 
 	json_merge(lep_json, cpt->metadata);
 
@@ -376,6 +712,7 @@ int ep_map(LOCAL_EP *ep_local, STATE* state)
 	 }
 
 	 array_add(ep_local->mappings_states, state);
+	 filter_set_add(ep_local->mapping_filters, state, state->filters);
 	 state->lep = ep_local;
 	return EP_OK;
 }
@@ -476,6 +813,7 @@ void ep_unmap_final(LOCAL_EP* lep, STATE* state_ptr)
 	}
 
 	/* remove from the array of mappings */
+	filter_set_remove(lep->mapping_filters, state_ptr);
 	if(array_remove(lep->mappings_states, state_ptr) < 0)
 	{
 		return;
@@ -504,8 +842,129 @@ void ep_unmap_all(LOCAL_EP *lep)
 
 	array_free(lep->mappings_states);
 	lep->mappings_states = array_new(ELEM_TYPE_PTR);
+	filter_set_clear(lep->mapping_filters);
+}
+
+
+/* the value of @lep for the indexed property @i; malloc'd, may be NULL */
+char* ep_index_value(LOCAL_EP *lep, int i)
+{
+	switch(i)
+	{
+	case 0: return strdup_null(lep->ep->name);
+	case 1: return get_ep_type_str(lep->ep->type);
+	case 2: return strdup_null(lep->ep->msg);
+	case 3: return strdup_null(lep->ep->resp);
+	}
+	return NULL;
+}
+
+void ep_index_add(LOCAL_EP *lep)
+{
+	int i;
+	char* value;
+	Array* leps;
+
+	pthread_mutex_lock(&ep_index_lock);
+	for(i=0; i<EP_INDEX_SIZE; i++)
+	{
+		value = ep_index_value(lep, i);
+		if(value == NULL)
+			continue;
+
+		leps = map_get(ep_index[i], value);
+		if(leps == NULL)
+		{
+			leps = array_new(ELEM_TYPE_PTR);
+			map_insert(ep_index[i], value, leps);
+		}
+		array_add(leps, lep);
+		free(value);
+	}
+	pthread_mutex_unlock(&ep_index_lock);
+}
+
+void ep_index_remove(LOCAL_EP *lep)
+{
+	int i, j;
+	char* value;
+	Array* leps;
+
+	pthread_mutex_lock(&ep_index_lock);
+	for(i=0; i<EP_INDEX_SIZE; i++)
+	{
+		value = ep_index_value(lep, i);
+		leps = value ? map_get(ep_index[i], value) : NULL;
+		if(leps == NULL)
+		{
+			free(value);
+			continue;
+		}
+
+		for(j=0; j<array_size(leps); j++)
+			if(array_get(leps, j) == lep)
+			{
+				array_remove_index(leps, j);
+				break;
+			}
+		if(array_size(leps) == 0)
+		{
+			map_remove(ep_index[i], value);
+			array_free(leps);
+		}
+		free(value);
+	}
+	pthread_mutex_unlock(&ep_index_lock);
 }
 
+/*
+ * the eps that can satisfy all the @paths: the fewest of those matching
+ * one indexed equality. NULL if no path is an indexed equality.
+ */
+Array* ep_index_candidates(Array *paths)
+{
+	int i, j;
+	char *prop, *value;
+	Array* leps;
+	Array* best = NULL;
+	int indexed = 0;
+
+	pthread_mutex_lock(&ep_index_lock);
+	for(i=0; paths != NULL && i<array_size(paths); i++)
+	{
+		if(!json_filter_equality(array_get(paths, i), &prop, &value))
+			continue;
+
+		for(j=0; j<EP_INDEX_SIZE; j++)
+		{
+			if(strcmp(prop, ep_index_props[j]) != 0)
+				continue;
+
+			leps = map_get(ep_index[j], value);
+			if(!indexed || leps == NULL
+					|| (best != NULL && array_size(leps) < array_size(best)))
+				best = leps;
+			indexed = 1;
+		}
+		free(prop);
+		free(value);
+
+		/* no ep has this value */
+		if(indexed && best == NULL)
+			break;
+	}
+
+	Array* candidates = NULL;
+	if(indexed)
+	{
+		candidates = array_new(ELEM_TYPE_PTR);
+		for(i=0; best != NULL && i<array_size(best); i++)
+			array_add(candidates, array_get(best, i));
+	}
+	pthread_mutex_unlock(&ep_index_lock);
+
+	return candidates;
+}
 
 LOCAL_EP* endpoint_query(JSON* query_json)
 {
@@ -514,15 +973,21 @@ LOCAL_EP* endpoint_query(JSON* query_json)
 	LOCAL_EP *lep_response = NULL;
 	JSON* lep_json;
 
+	/* equalities on indexed properties pick the candidates,
+	 * the whole query is checked on those only */
+	Array *paths = query_json ? json_get_array(query_json, NULL) : NULL;
+	Array *candidates = ep_index_candidates(paths);
+	if(candidates == NULL)
+		candidates = map_get_values(locales);
+	Array *filters = query_json ? json_filter_compile_array(paths) : NULL;
+
 	int i;
-	Array *_keys = map_get_keys(locales);
-	for(i=0;i<array_size(_keys); i++)
+	for(i=0;i<array_size(candidates); i++)
 	{
-		char* key = array_get(_keys, i);
-		lep = map_get(locales, key);
+		lep = array_get(candidates, i);
 		lep_json = ep_local_to_json(lep);
 
-		if( json_filter_validate(lep_json, query_json) )
+		if( json_filter_match_array(lep_json, filters) )
 		{
 			lep_response = lep;
 			json_free(lep_json);
@@ -531,52 +996,89 @@ LOCAL_EP* endpoint_query(JSON* query_json)
 		json_free(lep_json);
 	}
 
-	array_free(_keys);
+	array_free(candidates);
+	json_filter_free_array(filters);
+	if(paths != NULL)
+		array_free(paths);
 	return lep_response;
 }
 
 
+/*
+ * the mappings @json should go to: NULL for all of them, or those whose
+ * sink filters it satisfies. Only messages the sink filters are checked.
+ */
+Array* ep_send_matches(LOCAL_EP *lep, MESSAGE* msg)
+{
+	if(msg->status != MSG_MSG && msg->status != MSG_REQ &&
+			msg->status != MSG_RESP_NEXT && msg->status != MSG_RESP_LAST)
+		return NULL;
+	if(!filter_set_filtered(lep->mapping_filters))
+		return NULL;
+
+	/* the body is only parsed for filters */
+	return filter_set_match(lep->mapping_filters, message_json(msg));
+}
+
 int ep_send_json(LOCAL_EP *lep, JSON* json, const char* msg_id, int status)
+{
+	MESSAGE* msg = message_new_id_json(msg_id, json, status);
+	int result = ep_send_message(lep, msg);
+	message_free(msg);
+
+	return result;
+}
+
+int ep_send_message(LOCAL_EP *lep, MESSAGE* msg)
 {
 	//LOCAL_EP *lep = (LOCAL_EP*)(ep->data);
 	STATE* state;
+	STATE_WIRE wire;
 	int i;
-	for(i=0; i<array_size(lep->mappings_states); i++)
+	//slog(SLOG_DEBUG, "EP SEND MESSAGE: %s\n", message_to_str(msg));
+	Array* matches = ep_send_matches(lep, msg);
+	/* the matches are mappings themselves */
+	Array* states = matches ? matches : lep->mappings_states;
+	state_wire_init(&wire, msg);
+	for(i=0; i<array_size(states); i++)
 	{
-		state = array_get(lep->mappings_states, i);
-		state_send_json(state, msg_id, json, status);
+		state = array_get(states, i);
+		state_send_wire(state, &wire);
 	}
+	state_wire_free(&wire);
+	array_free(matches);
 
 	return 0;
 }
 
-int ep_send_message(LOCAL_EP *lep, MESSAGE* msg)
+int ep_send(LOCAL_EP *lep, const void* data, unsigned int size)
 {
 	//LOCAL_EP *lep = (LOCAL_EP*)(ep->data);
 	STATE* state;
 	int i;
-	slog(SLOG_DEBUG, "EP SEND MESSAGE: %s\n", message_to_str(msg));
 	for(i=0; i<array_size(lep->mappings_states); i++)
 	{
 		state = array_get(lep->mappings_states, i);
-		state_send_message(state, msg);
+		state_send(state, data, size, MSG_NONE);
 	}
 
 	return 0;
 }
 
-int ep_send(LOCAL_EP *lep, const void* data, unsigned int size)
+void ep_send_filters(LOCAL_EP *lep)
 {
-	//LOCAL_EP *lep = (LOCAL_EP*)(ep->data);
+	JSON* filters_json = json_build_map_filters(lep);
+	if(filters_json == NULL)
+		return;
+
 	STATE* state;
 	int i;
 	for(i=0; i<array_size(lep->mappings_states); i++)
 	{
 		state = array_get(lep->mappings_states, i);
-		(*(state->module->fc_send))(state->conn, data, size);
+		state_send_json(state, NULL, filters_json, MSG_MAP);
 	}
-
-	return 0;
+	json_free(filters_json);
 }
 
 int eps_init()
@@ -584,6 +1086,10 @@ int eps_init()
 	endpoints = map_new(KEY_TYPE_STR);
 	locales = map_new(KEY_TYPE_STR);
 
+	int i;
+	for(i=0; i<EP_INDEX_SIZE; i++)
+		ep_index[i] = map_new(KEY_TYPE_STR);
+
 	if(pthread_mutex_init(&ipc_lock, NULL) != 0) {
 		printf("IPC CORE -> APP COMMUNICATION MUTEX INIT FAILED!\n");
 		exit(1);
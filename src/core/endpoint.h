@@ -13,7 +13,11 @@
 #include "endpoint_base.h"
 #include "array.h"
 #include "json.h"
+#include "json_codec.h"
 #include "message.h"
+#include "filter_set.h"
+
+#include <pthread.h>
 
 #include "../module_wrappers/access_wrapper.h"
 //#include "state.h"
@@ -21,6 +25,19 @@
 
 struct _STATE;
 
+/* validation policy for what the app sends on an ep */
+#define EP_VALIDATE_ALWAYS	0 /* every message */
+#define EP_VALIDATE_SAMPLED	1 /* 1 in validation_sample messages */
+#define EP_VALIDATE_TRUSTED	2 /* none, the schema hash matched at map */
+
+#define EP_VALIDATE_SAMPLE	100 /* default N for sampled */
+
+typedef struct _EP_STATS{
+	unsigned long validated;
+	unsigned long validation_failed;
+	unsigned long validation_skipped;
+}EP_STATS;
+
 typedef struct _LOCAL_EP{
 	ENDPOINT *ep;
 	char *id;
@@ -34,6 +51,21 @@ typedef struct _LOCAL_EP{
 
 	JSON * msg_schema;
 	JSON * resp_schema;
+	/* the same schemas compiled; what messages are validated with */
+	JSON_SCHEMA * msg_validator;
+	JSON_SCHEMA * resp_validator;
+	/*
+	 * and as compact codecs, for mappings that agreed on the schemas.
+	 * states borrow them, so replaced ones are kept until the ep goes.
+	 */
+	JSON_CODEC * msg_codec;
+	JSON_CODEC * resp_codec;
+	Array * retired_codecs;
+
+	int validation;					/* EP_VALIDATE_* */
+	unsigned int validation_sample;
+	EP_STATS stats;
+	pthread_mutex_t stats_lock;
 
 	int flag;
 
@@ -50,6 +82,11 @@ typedef struct _LOCAL_EP{
 
 	/* an array of strings */
 	Array* filters;
+	/* the same filters compiled, JSON_FILTER*; what messages are checked with */
+	Array* filters_compiled;
+
+	/* the filters the mapped sinks pushed to us, over mappings_states */
+	FILTER_SET* mapping_filters;
 
 	/* handler called for messages from the app.
 	 * external msgs: ep->handler.
@@ -83,6 +120,39 @@ int ep_local_remove(LOCAL_EP *lep);
  */
 void ep_local_free(LOCAL_EP *lep);
 
+/*
+ * replaces the message (@resp == 0) or response schema of @lep:
+ * its validator, hash and place in the ep index
+ */
+void ep_local_set_schema(LOCAL_EP *lep, JSON *schema, int resp);
+
+/* EP_VALIDATE_* for "always", "sampled", "trusted"; -1 otherwise */
+int ep_validation_policy(const char *name);
+
+/* the policy of eps that do not set one in their json */
+void ep_set_validation_default(int policy, unsigned int sample);
+
+/* @sample: N for EP_VALIDATE_SAMPLED, 0 for the default */
+void ep_set_validation(LOCAL_EP *lep, int policy, unsigned int sample);
+
+/*
+ * validates @msg with @validator as the policy of @lep says, and counts it.
+ * JSON_OK if valid or skipped; a NULL @validator checks nothing and is
+ * not counted.
+ */
+int ep_validate(LOCAL_EP *lep, JSON_SCHEMA *validator, JSON *msg);
+
+/*
+ * the same in two steps, for senders that need no json tree when the
+ * message is skipped: whether the policy checks the next message (one
+ * skipped is counted here), then the check itself.
+ */
+int ep_validate_due(LOCAL_EP *lep);
+int ep_validate_now(LOCAL_EP *lep, JSON_SCHEMA *validator, JSON *msg);
+
+/* {"validated", "validation_failed", "validation_skipped"} */
+JSON *ep_stats_to_json(LOCAL_EP *lep);
+
 
 
 /*
@@ -162,6 +232,19 @@ int ep_send_message(LOCAL_EP *lep, MESSAGE* msg);
 
 int ep_send(LOCAL_EP *lep, const void* data, unsigned int size);
 
+/*
+ * stream endpoints: the start (1) or stop (0) command, and the data.
+ * A source passes the mapped sinks a socket where the module can pass
+ * fds; the others, and a sink that does not keep up, get MSG_STREAM
+ * messages.
+ */
+int ep_stream_command(LOCAL_EP *lep, int command);
+int ep_stream_send(LOCAL_EP *lep, const char* data);
+
+/* tells the mapped peers the filters of @lep changed */
+void ep_send_filters(LOCAL_EP *lep);
+
+
 /* send json message on a specific com modules */
 //int ep_module_send_json(ENDPOINT *ep, COM_MODULE* module, JSON* json);
 
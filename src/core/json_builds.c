@@ -8,29 +8,30 @@
 #include "json_builds.h"
 
 #include "json.h"
-#include "environment.h" /* for VERSION */
+#include "environment.h" /* for VERSION, ETC */
 
 #include <stdio.h>
 
-JSON* ep_def_schema;
-JSON* src_snk_def_schema;
-JSON* req_resp_def_schema;
+/* compiled once at load, validation only walks the message */
+JSON_SCHEMA* ep_def_schema;
+JSON_SCHEMA* src_snk_def_schema;
+JSON_SCHEMA* req_resp_def_schema;
 
-JSON* cmd_schema;
-JSON* hello_schema;
-JSON* hello_ack_schema;
-JSON* auth_schema;
-JSON* auth_ack_schema;
-JSON* map_schema;
-JSON* map_ack_schema;
-JSON* unmap_schema;
-JSON* unmap_ack_schema;
-JSON* ep_reg_schema;
-JSON* fc_call_schema;
-JSON* fc_return_schema;
+JSON_SCHEMA* cmd_schema;
+JSON_SCHEMA* hello_schema;
+JSON_SCHEMA* hello_ack_schema;
+JSON_SCHEMA* auth_schema;
+JSON_SCHEMA* auth_ack_schema;
+JSON_SCHEMA* map_schema;
+JSON_SCHEMA* map_ack_schema;
+JSON_SCHEMA* unmap_schema;
+JSON_SCHEMA* unmap_ack_schema;
+JSON_SCHEMA* ep_reg_schema;
+JSON_SCHEMA* fc_call_schema;
+JSON_SCHEMA* fc_return_schema;
 
-JSON* disconnect_schema;
-JSON* disconnect_ack_schema;
+JSON_SCHEMA* disconnect_schema;
+JSON_SCHEMA* disconnect_ack_schema;
 
 
 
@@ -38,22 +39,22 @@ int json_load_all_file_schemas()
 {
 	int ret = 0;
 
-	ep_def_schema 		= json_load_from_file("ep_def.schema.json");
-	src_snk_def_schema 	= json_load_from_file("src_snk_def.schema.json");
-	req_resp_def_schema = json_load_from_file("req_resp_def.schema.json");
-
-	cmd_schema 		= json_load_from_file("command.schema.json");
-	hello_schema 	= json_load_from_file("preloaded_schemata/hello.schema.json");
-	hello_ack_schema= json_load_from_file("preloaded_schemata/hello_ack.schema.json");
-	auth_schema 	= json_load_from_file("preloaded_schemata/auth.schema.json");
-	auth_ack_schema = json_load_from_file("preloaded_schemata/auth_ack.schema.json");
-	map_schema 		= json_load_from_file("preloaded_schemata/map.schema.json");
-	map_ack_schema 	= json_load_from_file("preloaded_schemata/map_ack.schema.json");
-	unmap_schema 	= json_load_from_file("unmap.schema.json");
-	unmap_ack_schema= json_load_from_file("unmap_ack.schema.json");
-	ep_reg_schema 	= json_load_from_file("general_endpoint.schema.json");
-	fc_call_schema 	= json_load_from_file("function_call.schema.json");
-	fc_return_schema= json_load_from_file("function_return.schema.json");
+	ep_def_schema 		= json_schema_load_from_file(ETC "ep_def.schema.json");
+	src_snk_def_schema 	= json_schema_load_from_file(ETC "src_snk_def.schema.json");
+	req_resp_def_schema = json_schema_load_from_file(ETC "req_resp_def.schema.json");
+
+	cmd_schema 		= json_schema_load_from_file(ETC "command.schema.json");
+	hello_schema 	= json_schema_load_from_file(ETC "preloaded_schemata/hello.schema.json");
+	hello_ack_schema= json_schema_load_from_file(ETC "preloaded_schemata/hello_ack.schema.json");
+	auth_schema 	= json_schema_load_from_file(ETC "preloaded_schemata/auth.schema.json");
+	auth_ack_schema = json_schema_load_from_file(ETC "preloaded_schemata/auth_ack.schema.json");
+	map_schema 		= json_schema_load_from_file(ETC "preloaded_schemata/map.schema.json");
+	map_ack_schema 	= json_schema_load_from_file(ETC "preloaded_schemata/map_ack.schema.json");
+	unmap_schema 	= json_schema_load_from_file(ETC "unmap.schema.json");
+	unmap_ack_schema= json_schema_load_from_file(ETC "unmap_ack.schema.json");
+	ep_reg_schema 	= json_schema_load_from_file(ETC "general_endpoint.schema.json");
+	fc_call_schema 	= json_schema_load_from_file(ETC "function_call.schema.json");
+	fc_return_schema= json_schema_load_from_file(ETC "function_return.schema.json");
 
 	return ret;
 	/*hello_schema == NULL || hello_ack_schema == NULL ||
@@ -107,6 +108,36 @@ JSON * json_build_auth_ack(int code, const char* key, JSON * other_data)
 }
 
 
+/* does @lep filter what it receives; only queuing eps do, see ep_default_handler_queuing */
+int json_ep_filters(LOCAL_EP *lep)
+{
+	if(lep == NULL || lep->queuing != 1)
+		return 0;
+
+	switch(lep->ep->type)
+	{
+	case EP_SNK:
+	case EP_SS:
+	case EP_REQ:
+	case EP_REQ_P:
+	case EP_RESP:
+	case EP_RESP_P:
+		return 1;
+	}
+	return 0;
+}
+
+JSON * json_build_map_filters(LOCAL_EP *lep)
+{
+	if(!json_ep_filters(lep))
+		return NULL;
+
+	JSON * filters_json = json_new(NULL);
+	json_set_array(filters_json, "filters", lep->filters);
+
+	return filters_json;
+}
+
 JSON * json_build_map(LOCAL_EP *lep, JSON * ep_query, JSON * cpt_query)
 {
 	JSON * map_json = json_new(NULL);
@@ -120,7 +151,7 @@ JSON * json_build_map(LOCAL_EP *lep, JSON * ep_query, JSON * cpt_query)
 		char ep_type_query[50], msg_hash_query[50], resp_hash_query[50];
 		sprintf(ep_type_query, "ep_type = \'%s\'", get_ep_type_matching_str(lep->ep->type));
 		array_add(ep_query_array, ep_type_query);
-		if(lep->ep->resp)
+		if(lep->ep->msg)
 		{
 			sprintf(msg_hash_query, "msg_hash = \'%s\'", lep->ep->msg);
 			array_add(ep_query_array, msg_hash_query);
@@ -137,6 +168,10 @@ JSON * json_build_map(LOCAL_EP *lep, JSON * ep_query, JSON * cpt_query)
 		JSON* ep_metadata = ep_to_json(lep->ep);
 		json_set_json(map_json, "ep_metadata", ep_metadata);
 		json_free(ep_metadata);
+
+		/* so the peer drops what we would filter out before sending it */
+		if(json_ep_filters(lep) && array_size(lep->filters) > 0)
+			json_set_array(map_json, "filters", lep->filters);
 	}
 
 	return map_json;
@@ -153,6 +188,9 @@ JSON * json_build_map_ack(LOCAL_EP *lep, int code, JSON * other_data)
 		JSON* ep_metadata = ep_to_json(lep->ep);
 		json_set_json(map_ack_json, "ep_metadata", ep_metadata);
 		json_free(ep_metadata);
+
+		if(json_ep_filters(lep) && array_size(lep->filters) > 0)
+			json_set_array(map_ack_json, "filters", lep->filters);
 	}
 
 	return map_ack_json;
@@ -202,7 +240,7 @@ JSON * json_build_disconnect_ack(int code, JSON * other_data)
 
 int json_validate_ep_def(JSON * msg)
 {
-	if (json_validate(ep_def_schema, msg))
+	if (json_schema_validate(ep_def_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating ep_schema schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -211,7 +249,7 @@ int json_validate_ep_def(JSON * msg)
 }
 int json_validate_ep_remote_def(JSON * msg)
 {
-	if (json_validate(ep_def_schema, msg))
+	if (json_schema_validate(ep_def_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating ep_remote schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -220,7 +258,7 @@ int json_validate_ep_remote_def(JSON * msg)
 }
 int json_validate_req_resp(JSON * msg)
 {
-	if (json_validate(req_resp_def_schema, msg))
+	if (json_schema_validate(req_resp_def_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating ep_req_resp_def schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -229,7 +267,7 @@ int json_validate_req_resp(JSON * msg)
 }
 int json_validate_src_snk(JSON * msg)
 {
-	if (json_validate(src_snk_def_schema, msg))
+	if (json_schema_validate(src_snk_def_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating ep_src_snk_def schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -241,7 +279,7 @@ int json_validate_src_snk(JSON * msg)
 
 int json_validate_hello(JSON * msg)
 {
-	if (json_validate(hello_schema, msg))
+	if (json_schema_validate(hello_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating hello message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -261,7 +299,7 @@ int json_validate_hello(JSON * msg)
 
 int json_validate_hello_ack(JSON * msg)
 {
-	if (json_validate(hello_ack_schema, msg))
+	if (json_schema_validate(hello_ack_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating hello ack message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -278,7 +316,7 @@ int json_validate_hello_ack(JSON * msg)
 int json_validate_auth(JSON * msg)
 {
 	return JSON_OK;
-	if (json_validate(auth_schema, msg))
+	if (json_schema_validate(auth_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating access message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -290,7 +328,7 @@ int json_validate_auth(JSON * msg)
 /* 0 if ok, code!=0 invalid */
 int json_validate_auth_ack(JSON * msg)
 {
-	if (json_validate(auth_ack_schema, msg))
+	if (json_schema_validate(auth_ack_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating access ack message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -303,7 +341,7 @@ int json_validate_auth_ack(JSON * msg)
 
 int json_validate_map(JSON * msg)
 {
-	if (json_validate(map_schema, msg))
+	if (json_schema_validate(map_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating map message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -314,7 +352,7 @@ int json_validate_map(JSON * msg)
 
 int json_validate_map_ack(JSON * msg)
 {
-	if (json_validate(map_ack_schema, msg))
+	if (json_schema_validate(map_ack_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating map ack message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -326,7 +364,7 @@ int json_validate_map_ack(JSON * msg)
 
 int json_validate_unmap(JSON * msg)
 {
-	if (json_validate(unmap_schema, msg))
+	if (json_schema_validate(unmap_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating unmap message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -337,7 +375,7 @@ int json_validate_unmap(JSON * msg)
 
 int json_validate_unmap_ack(JSON * msg)
 {
-	if (json_validate(unmap_ack_schema, msg))
+	if (json_schema_validate(unmap_ack_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating unmap ack message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -349,7 +387,7 @@ int json_validate_unmap_ack(JSON * msg)
 
 int json_validate_disconnect(JSON * msg)
 {
-	if ( json_validate(disconnect_schema, msg))
+	if ( json_schema_validate(disconnect_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating disconnect message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -360,7 +398,7 @@ int json_validate_disconnect(JSON * msg)
 
 int json_validate_disconnect_ack(JSON * msg)
 {
-	if (json_validate(disconnect_ack_schema, msg))
+	if (json_schema_validate(disconnect_ack_schema, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating disconnect ack message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
@@ -373,7 +411,7 @@ int json_validate_disconnect_ack(JSON * msg)
 
 int json_validate_message(LOCAL_EP *lep, JSON * msg)
 {
-	if (json_validate( lep->msg_schema, msg))
+	if (ep_validate(lep, lep->msg_validator, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating\n"
 		//		"\tmessage: %s\n"
@@ -385,7 +423,7 @@ int json_validate_message(LOCAL_EP *lep, JSON * msg)
 }
 int json_validate_response(LOCAL_EP *lep, JSON * msg)
 {
-	if ( json_validate(lep->resp_schema, msg))
+	if ( ep_validate(lep, lep->resp_validator, msg))
 	{
 		//slog(SLOG_ERROR, "PROTO JSON: error validating disconnect message schema: %s", json_to_str(msg));
 		return JSON_NOT_VALID;
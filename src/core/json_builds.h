@@ -29,6 +29,8 @@ JSON * json_build_auth_ack(int code, const char* key, JSON * other_data);
 
 JSON * json_build_map(LOCAL_EP *lep, JSON * ep_query, JSON * cpt_query);
 JSON * json_build_map_ack(LOCAL_EP *lep, int code, JSON * other_data);
+/* the current filters of @lep, sent as map on a mapped state; NULL if it does not filter */
+JSON * json_build_map_filters(LOCAL_EP *lep);
 
 JSON * json_build_unmap(JSON * other_data);
 JSON * json_build_unmap_ack(int code, JSON * other_data);
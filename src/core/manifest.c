@@ -12,7 +12,10 @@
 #include "array.h"
 #include "endpoint.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
 /* in core.c */
 extern HashMap *locales;
@@ -25,6 +28,54 @@ Array* metadata_endpoints_array();
 
 COMPONENT* cpt = NULL;
 
+/* built manifests by level, until something they contain changes */
+JSON* manifest_cache[MANIFEST_FULL+1] = {NULL};
+pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void manifest_invalidate()
+{
+	int lvl;
+	pthread_mutex_lock(&manifest_lock);
+	for(lvl=0; lvl<=MANIFEST_FULL; lvl++)
+	{
+		json_free(manifest_cache[lvl]);
+		manifest_cache[lvl] = NULL;
+	}
+	pthread_mutex_unlock(&manifest_lock);
+}
+
+char manifest_host[256] = "";
+pthread_once_t manifest_host_once = PTHREAD_ONCE_INIT;
+
+void manifest_host_init()
+{
+	FILE* file = fopen("/etc/machine-id", "r");
+	if(file != NULL)
+	{
+		if(fgets(manifest_host, sizeof(manifest_host), file) == NULL)
+			manifest_host[0] = '\0';
+		manifest_host[strcspn(manifest_host, "\r\n")] = '\0';
+		fclose(file);
+	}
+	if(manifest_host[0] == '\0' && gethostname(manifest_host, sizeof(manifest_host)-1) != 0)
+		manifest_host[0] = '\0';
+}
+
+const char* manifest_host_id()
+{
+	pthread_once(&manifest_host_once, manifest_host_init);
+	return manifest_host;
+}
+
+int manifest_same_host(JSON* json)
+{
+	const char* host = manifest_host_id();
+	char* peer_host = json_get_str(json, "host_id");
+	int same = host[0] != '\0' && peer_host != NULL && strcmp(host, peer_host) == 0;
+	free(peer_host);
+	return same;
+}
+
 int manifest_update(JSON *json)
 {
 	if(cpt == NULL)
@@ -36,14 +87,17 @@ int manifest_update(JSON *json)
 	if(json != NULL)
 		json_merge(cpt->metadata, json);
 
+	manifest_invalidate();
 	return 0;
 }
 
 
 JSON* manigest_get_short()
 {
-	JSON *manifest = json_new(json_to_str(cpt->metadata));
-	if (cpt != NULL)
+	if (cpt == NULL)
+		return json_new(NULL);
+
+	JSON *manifest = _json_dup(cpt->metadata);
 	{
 		json_set_json(manifest, "component", cpt->metadata);
 		json_set_array(manifest, "com_modules", metadata_com_modules_array());
@@ -124,7 +178,7 @@ Array* metadata_endpoints_array()
 	return ep_md_array;
 }
 
-JSON* manifest_get(int lvl)
+JSON* manifest_build(int lvl)
 {
 	JSON *manifest= json_new(NULL);
 
@@ -136,6 +190,7 @@ JSON* manifest_get(int lvl)
 	if(lvl >= MANIFEST_SIMPLE)
 	{
 		json_set_json(manifest, "component", cpt->metadata);
+		json_set_str(manifest, "host_id", manifest_host_id());
 	}
 	if(lvl >= MANIFEST_SHORT)
 	{
@@ -152,3 +207,19 @@ JSON* manifest_get(int lvl)
 		return manifest;
 	}
 }
+
+JSON* manifest_get(int lvl)
+{
+	if(lvl < 0)
+		lvl = 0;
+	if(lvl > MANIFEST_FULL)
+		lvl = MANIFEST_FULL;
+
+	pthread_mutex_lock(&manifest_lock);
+	if(manifest_cache[lvl] == NULL)
+		manifest_cache[lvl] = manifest_build(lvl);
+	JSON* manifest = _json_dup(manifest_cache[lvl]);
+	pthread_mutex_unlock(&manifest_lock);
+
+	return manifest;
+}
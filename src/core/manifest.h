@@ -31,9 +31,26 @@ int manifest_update(JSON* json);
 
 /*
  * returns the JSON md.
+ * built once per level and copied; the caller frees the copy.
  */
 JSON* manifest_get(int lvl);
 
+/*
+ * drops the built manifests; call when endpoints, modules or
+ * the component metadata change.
+ */
+void manifest_invalidate();
+
+/*
+ * identifies this host: /etc/machine-id, else the host name.
+ * In the manifest and in each endpoint as "host_id", so a peer knows
+ * whether host local modules (unix, shm) can reach us.
+ */
+const char* manifest_host_id();
+
+/* 1 if json carries the host_id of this host */
+int manifest_same_host(JSON* json);
+
 /*
  * short manifest
  */
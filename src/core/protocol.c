@@ -26,11 +26,281 @@
 #include "../common/sync.h"
 #include "../module_wrappers/access_wrapper.h"
 #include "manifest.h"
+#include "session.h"
 
-//TODO: remove, replace with sync
+/* send auth and map in hello when mapping a new connection; core_config "optimistic_handshake" */
+int core_proto_optimistic_enabled = 1;
 
-extern int map_sync_pipe[2];
+/* binary envelope over binary framing; core_config "envelope": "json" turns it off */
+int core_proto_envelope_enabled = 1;
 
+/* the map core_map does on the connection it opens; on_connect runs in its thread */
+__thread LOCAL_EP* pending_lep = NULL;
+__thread JSON* pending_ep_query = NULL;
+__thread JSON* pending_cpt_query = NULL;
+/* the session tokens core_map holds for the address it connects to */
+__thread const char* pending_session = NULL;
+__thread const char* pending_session_pair = NULL;
+
+
+/* add this side's optional capabilities to hello/hello_ack; older peers ignore them */
+void core_proto_advertise(STATE *state_ptr, JSON *hello_json)
+{
+	COM_MODULE* module = state_ptr->module;
+	if(module->fc_is_binary_safe && (*module->fc_is_binary_safe)())
+	{
+		json_set_str(hello_json, "framing", "binary");
+		json_set_int(hello_json, "multiplex", 1);
+		if(core_proto_envelope_enabled)
+			json_set_str(hello_json, "envelope", "msgpack");
+	}
+	if(core_proto_optimistic_enabled)
+		json_set_str(hello_json, "handshake", "optimistic");
+}
+
+void core_proto_set_pending_map(LOCAL_EP* lep, JSON* ep_query, JSON* cpt_query)
+{
+	pending_lep = lep;
+	pending_ep_query = ep_query;
+	pending_cpt_query = cpt_query;
+}
+
+void core_proto_set_pending_session(const char* token, const char* pair)
+{
+	pending_session = token;
+	pending_session_pair = pair;
+}
+
+int core_proto_offer_session(STATE *state_ptr, JSON *hello_json)
+{
+	if(pending_session == NULL || pending_session_pair == NULL)
+		return 0;
+
+	json_set_str(hello_json, "session", pending_session);
+	state_ptr->session_key = strdup(pending_session);
+	state_ptr->session_issued = strdup(pending_session_pair);
+	core_proto_set_pending_session(NULL, NULL);
+
+	return 1;
+}
+
+/*
+ * initiator side: a peer that resumed the session answers with the token
+ * we issued to it, not the one we sent; an echo proves nothing.
+ */
+void core_proto_session_resumed(STATE *state_ptr, JSON *hello_ack_json)
+{
+	if(state_ptr->session_key == NULL || state_ptr->session_issued == NULL)
+		return;
+
+	char* token = json_get_str(hello_ack_json, "session");
+	if(token != NULL && strcmp(token, state_ptr->session_issued) == 0)
+	{
+		state_ptr->resumed = 1;
+		state_ptr->is_auth = 1;
+		state_ptr->am_auth = 1;
+	}
+	else
+	{
+		/* expired or unknown there: new ones come with auth_ack */
+		free(state_ptr->session_key);
+		state_ptr->session_key = NULL;
+		free(state_ptr->session_issued);
+		state_ptr->session_issued = NULL;
+	}
+	free(token);
+}
+
+/* keep the token the peer issued in auth_ack */
+void core_proto_session_key(STATE *state_ptr, JSON *auth_ack_json)
+{
+	char* key = json_get_str(auth_ack_json, "key");
+	if(key == NULL || key[0] == '\0')
+	{
+		free(key);
+		return;
+	}
+	free(state_ptr->session_key);
+	state_ptr->session_key = key;
+	session_pair(state_ptr);
+}
+
+/* own credentials from all the access modules */
+Array* core_proto_credentials()
+{
+	Array* auth_creds_aray = array_new(ELEM_TYPE_PTR);
+	Array* access_modules_keys = map_get_keys(access_modules);
+
+	int i;
+	char* acc_key;
+	ACCESS_MODULE* access_module;
+	JSON* credential_json;
+
+	for(i=0; i<array_size(access_modules_keys); i++)
+	{
+		acc_key = array_get(access_modules_keys, i);
+		access_module = map_get(access_modules, acc_key);
+
+		credential_json = json_new(NULL);
+		json_set_str(credential_json, "name", acc_key);
+		json_set_str(credential_json, "credential", (*(access_module->fc_get_credential))());
+		array_add(auth_creds_aray, credential_json);
+	}
+
+	return auth_creds_aray;
+}
+
+int core_proto_optimistic(STATE *state_ptr, JSON *hello_json)
+{
+	if(!core_proto_optimistic_enabled || pending_lep == NULL)
+		return 0;
+
+	Array* auth_creds_array = core_proto_credentials();
+	JSON* auth_json = json_build_auth(auth_creds_array, NULL);
+	JSON* map_json = json_build_map(pending_lep, pending_ep_query, pending_cpt_query);
+	core_proto_offer_payload(map_json);
+	json_set_json(hello_json, "auth", auth_json);
+	json_set_json(hello_json, "map", map_json);
+	json_free(auth_json);
+	json_free(map_json);
+	array_free(auth_creds_array);
+
+	state_ptr->lep = pending_lep;
+	state_ptr->optimistic = 1;
+	/* only the first connection of this map */
+	core_proto_set_pending_map(NULL, NULL, NULL);
+
+	return 1;
+}
+
+/*
+ * responder side: the hello also carried the initiator's credentials and
+ * map query. Check both now and answer everything in one hello_ack that
+ * also carries our credentials; the initiator checks those itself.
+ */
+void core_proto_hello_optimistic(STATE *state_ptr, JSON *auth_json, JSON *map_json, const char* session_pair)
+{
+	JSON* manifest = manifest_get(MANIFEST_SIMPLE);
+	JSON* hello_ack_json = json_build_hello_ack(0, manifest);
+	core_proto_advertise(state_ptr, hello_ack_json);
+
+	/* a resumed session needs no credentials either way */
+	int auth_validate = 0;
+	char* key = NULL;
+	JSON* own_auth_json = NULL;
+	Array* auth_creds_array = NULL;
+	if(session_pair != NULL)
+		json_set_str(hello_ack_json, "session", session_pair);
+	else
+	{
+		auth_validate = core_proto_auth_verify(state_ptr, auth_json);
+		if(auth_validate == 0)
+			key = session_issue(state_ptr);
+		auth_creds_array = core_proto_credentials();
+		own_auth_json = json_build_auth(auth_creds_array, NULL);
+	}
+	JSON* auth_ack_json = json_build_auth_ack(auth_validate, key ? key : "", NULL);
+	free(key);
+
+	JSON* map_ack_json;
+	if(auth_validate == 0)
+	{
+		/* the initiator closes the connection if ours are refused */
+		state_ptr->am_auth = 1;
+		state_ptr->state = STATE_MAP;
+		map_ack_json = core_proto_map_json(state_ptr, map_json);
+	}
+	else
+	{
+		state_ptr->state = STATE_BAD;
+		map_ack_json = json_build_map_ack(NULL, auth_validate, NULL);
+	}
+
+	json_set_json(hello_ack_json, "auth_ack", auth_ack_json);
+	json_set_json(hello_ack_json, "auth", own_auth_json);
+	json_set_json(hello_ack_json, "map_ack", map_ack_json);
+	state_send_json(state_ptr, NULL, hello_ack_json, MSG_HELLO_ACK);
+
+	json_free(hello_ack_json);
+	json_free(auth_ack_json);
+	json_free(own_auth_json);
+	json_free(map_ack_json);
+	if(auth_creds_array != NULL)
+		array_free(auth_creds_array);
+	json_free(manifest);
+}
+
+/*
+ * initiator side: the combined ack of an optimistic hello.
+ * hello, auth and map steps are all done, or the connection is closed.
+ */
+void core_proto_hello_ack_optimistic(STATE *state_ptr, JSON *hello_ack_json, JSON *map_ack_json)
+{
+	JSON* auth_ack_json = json_get_json(hello_ack_json, "auth_ack");
+	JSON* auth_json = json_get_json(hello_ack_json, "auth");
+
+	if(auth_ack_json != NULL && json_validate_auth_ack(auth_ack_json) == 0)
+	{
+		state_ptr->am_auth = 1;
+		core_proto_session_key(state_ptr, auth_ack_json);
+	}
+	if(auth_json != NULL && !state_ptr->resumed
+			&& core_proto_auth_verify(state_ptr, auth_json) == 0)
+	{
+		/* our token for the peer, which sent its own in auth_ack */
+		char* key = session_issue(state_ptr);
+		if(key != NULL)
+		{
+			JSON* own_auth_ack_json = json_build_auth_ack(0, key, NULL);
+			state_send_json(state_ptr, NULL, own_auth_ack_json, MSG_AUTH_ACK);
+			json_free(own_auth_ack_json);
+			free(key);
+		}
+	}
+	json_free(auth_ack_json);
+	json_free(auth_json);
+
+	if(!state_ptr->am_auth || !state_ptr->is_auth)
+	{
+		json_free(map_ack_json);
+		(*(state_ptr->module->fc_connection_close))(state_ptr->conn);
+		return;
+	}
+
+	/* hello and access */
+	state_ptr->state = STATE_MAP_ACK;
+	state_sync_trigger(state_ptr);
+	state_sync_trigger(state_ptr);
+
+	core_proto_map_ack_json(state_ptr, map_ack_json);
+	json_free(map_ack_json);
+}
+
+/*
+ * switch to binary framing if the peer advertised it in hello/hello_ack;
+ * channels need binary framing on both sides
+ */
+void core_proto_set_framing(STATE *state_ptr, JSON *hello_json)
+{
+	COM_MODULE* module = state_ptr->module;
+	if(module->fc_is_binary_safe == NULL || !(*module->fc_is_binary_safe)())
+		return;
+
+	char* framing = json_get_str(hello_json, "framing");
+	if(framing != NULL && strcmp(framing, "binary") == 0)
+		state_ptr->framing = STATE_FRAMING_BINARY;
+	free(framing);
+
+	if(state_ptr->framing == STATE_FRAMING_BINARY
+			&& json_get_int(hello_json, "multiplex") == 1)
+		state_ptr->multiplex = 1;
+
+	char* envelope = json_get_str(hello_json, "envelope");
+	if(state_ptr->framing == STATE_FRAMING_BINARY && core_proto_envelope_enabled
+			&& envelope != NULL && strcmp(envelope, "msgpack") == 0)
+		state_ptr->envelope = 1;
+	free(envelope);
+}
 
 /* recv hello msg, send hello ack
  * only in STATE_HELLO_S  and STATE_HELLO_2 */
@@ -43,30 +313,85 @@ void core_proto_hello(STATE *state_ptr, MESSAGE *hello_msg)
 	 * if(hello_msg->status != MSG_HELLO)
 	 */
 
-	JSON *hello_json = hello_msg->_msg_json;
+	JSON *hello_json = message_json(hello_msg);
 	/* validate */
 	int hello_validation =  json_validate_hello(hello_json);
 	if(hello_validation != 0)
 		goto final;
 
+	core_proto_set_framing(state_ptr, hello_json);
+
 	/* save the address */
 	state_ptr->cpt_manifest = json_get_json(hello_json, "manifest");
 	if (state_ptr->cpt_manifest != NULL)
     	state_ptr->addr = strdup_null(json_get_str(state_ptr->cpt_manifest, "address"));
 
+	char* handshake = json_get_str(hello_json, "handshake");
+	int peer_optimistic = handshake != NULL && strcmp(handshake, "optimistic") == 0;
+	free(handshake);
+
+	/* the peer resumes a session we issued: no auth step.
+	 * session is then the peer's token, which we show back in hello_ack */
+	char* session = json_get_str(hello_json, "session");
+	char* session_pair = NULL;
+	if(session != NULL)
+		session_resume(state_ptr, session, &session_pair);
+	free(session);
+	session = session_pair;
+
+	if(state_ptr->optimistic)
+	{
+		/* the peer answers our hello with the combined ack instead */
+		if(peer_optimistic)
+			return;
+		state_ptr->optimistic = 0;
+	}
+	else if(core_proto_optimistic_enabled)
+	{
+		JSON* auth_json = json_get_json(hello_json, "auth");
+		JSON* map_json = json_get_json(hello_json, "map");
+		if(auth_json != NULL && map_json != NULL)
+			core_proto_hello_optimistic(state_ptr, auth_json, map_json, session);
+		json_free(auth_json);
+		json_free(map_json);
+		if(state_ptr->state != STATE_HELLO_S && state_ptr->state != STATE_HELLO_2)
+		{
+			free(session);
+			return;
+		}
+	}
+
+	if(session != NULL)
+	{
+		/* straight to map; the peer's hello_ack to our hello is ignored */
+		state_ptr->state = STATE_MAP;
+
+		JSON* manifest = manifest_get(MANIFEST_SIMPLE);
+		JSON* hello_ack_json = json_build_hello_ack(0, manifest);
+		core_proto_advertise(state_ptr, hello_ack_json);
+		json_set_str(hello_ack_json, "session", session);
+		state_send_json(state_ptr, NULL, hello_ack_json, MSG_HELLO_ACK);
+
+		json_free(hello_ack_json);
+		json_free(manifest);
+		free(session);
+		return;
+	}
+
 	/* set new state */
 	if(state_ptr->state == STATE_HELLO_S)
 		state_ptr->state = STATE_HELLO_ACK_S;
 	else if(state_ptr->state == STATE_HELLO_2)
 	{
 		state_ptr->state = STATE_AUTH;
-		sync_trigger(map_sync_pipe[0], "hello:0\n");
+		state_sync_trigger(state_ptr);
 	}
 
 	final:/* send acknowledge, free stuff */
 	{
 		JSON* manifest = manifest_get(MANIFEST_SIMPLE);
 		JSON* hello_ack_json = json_build_hello_ack(hello_validation, manifest);
+		core_proto_advertise(state_ptr, hello_ack_json);
 		state_send_json(state_ptr, NULL, hello_ack_json, MSG_HELLO_ACK);
 
 		//json_free(hello_json);
@@ -86,20 +411,44 @@ void core_proto_hello_ack(STATE *state_ptr, MESSAGE *hello_ack_msg)
 	 * if(hello_ack_msg->status != MSG_HELLO_ACK)
 	 */
 
-	JSON *hello_ack_json = hello_ack_msg->_msg_json;
+	JSON *hello_ack_json = message_json(hello_ack_msg);
 
 	/* validate */
 	int hello_ack_validation = json_validate_hello_ack(hello_ack_json);
 	if(hello_ack_validation != 0)
 		goto final;
 
+	core_proto_set_framing(state_ptr, hello_ack_json);
+	core_proto_session_resumed(state_ptr, hello_ack_json);
+
+	if(state_ptr->optimistic)
+	{
+		JSON* map_ack_json = json_get_json(hello_ack_json, "map_ack");
+		if(map_ack_json != NULL)
+		{
+			core_proto_hello_ack_optimistic(state_ptr, hello_ack_json, map_ack_json);
+			return;
+		}
+		/* older peer: go through auth and map */
+		state_ptr->optimistic = 0;
+	}
+
+	if(state_ptr->resumed)
+	{
+		/* hello and access */
+		state_ptr->state = STATE_MAP;
+		state_sync_trigger(state_ptr);
+		state_sync_trigger(state_ptr);
+		return;
+	}
+
 	/* sync and trigger auth step */
 	if(state_ptr->state == STATE_HELLO_S)
 		state_ptr->state = STATE_HELLO_2;
 	else if(state_ptr->state == STATE_HELLO_ACK_S)
 	{
 		state_ptr->state = STATE_AUTH;
-		sync_trigger(map_sync_pipe[0], "hello:0\n");
+		state_sync_trigger(state_ptr);
 	}
 	//char ret_pipe[] = "hello:0";
 	//send(map_sync_pipe[0], ret_pipe, strlen(ret_pipe), 0);
@@ -123,26 +472,7 @@ void core_proto_send_auth(STATE *state_ptr)
 
 	/* the structures containing all credentials */
 	JSON* auth_creds_json = json_new(NULL);
-	Array* auth_creds_aray = array_new(ELEM_TYPE_PTR);
-
-	/* build the structures iterating over all auth modules */
-	Array* access_modules_keys = map_get_keys(access_modules);
-
-	int i;
-	char* acc_key;
-	ACCESS_MODULE* access_module;
-	JSON* credential_json;
-
-	for(i=0; i<array_size(access_modules_keys); i++)
-	{
-		acc_key = array_get(access_modules_keys, i);
-		access_module = map_get(access_modules, acc_key);
-
-		credential_json = json_new(NULL);
-		json_set_str(credential_json, "name", acc_key);
-		json_set_str(credential_json, "credential", (*(access_module->fc_get_credential))());
-		array_add(auth_creds_aray, credential_json);
-	}
+	Array* auth_creds_aray = core_proto_credentials();
 
 	/* send credentials */
 	JSON* auth_json = json_build_auth(auth_creds_aray, NULL);
@@ -156,16 +486,9 @@ void core_proto_send_auth(STATE *state_ptr)
 	}
 }
 
-/* receive and check credentials for component and sends ACK */
-void core_proto_check_auth(STATE *state_ptr, MESSAGE *auth_msg)
+/* check the peer's credentials; 0 and is_auth set if accepted */
+int core_proto_auth_verify(STATE *state_ptr, JSON *auth_json)
 {
-	/*
-	 * because this function is called from the core only, these should never happen:
-	 * if(state_ptr == NULL)
-	 * if(auth_msg == NULL)
-	 * if(auth_msg->status != MSG_AUTH)
-	 */
-
 	if(access_no_auth())
 	{
 		/* no auth module loaded,
@@ -173,44 +496,19 @@ void core_proto_check_auth(STATE *state_ptr, MESSAGE *auth_msg)
 		 */
 		state_ptr->access_module = NULL;
 		state_ptr->is_auth = 1;
-		//conn_send_sockpair(map_sync_pipe[0], "access ok");
-		//char ret_pipe[] = "access ok";
-		//send(map_sync_pipe[0], ret_pipe, strlen(ret_pipe), 0);
-
-		JSON* access_ack_json = json_build_auth_ack(0, "", NULL);
-		state_send_json(state_ptr, NULL, access_ack_json, MSG_AUTH_ACK);
-		json_free(access_ack_json);
-
-		if(state_ptr->state == STATE_AUTH)
-			state_ptr->state = STATE_AUTH_ACK;
-		else if(state_ptr->state == STATE_AUTH_2)
-		{
-			state_ptr->state = STATE_MAP;
-			sync_trigger(map_sync_pipe[0], "access:0");
-		}
-
-		/*if(state_ptr->is_auth && state_ptr->am_auth)
-			state_ptr->state = STATE_MAP;
-		else
-			state_ptr->state = STATE_AUTH;*/
-
-		return;
+		return 0;
 	}
 
 	/* validate */
-	JSON* auth_ack_json = NULL;
-	Array* auth_creds_array = NULL;
-
-	JSON *auth_json = auth_msg->_msg_json;
 	int auth_validate = json_validate_auth(auth_json);
 	if(auth_validate != 0)
 	{
 		//(*(state_ptr->module->fc_connection_close))(state_ptr->conn);
-		goto final;
+		return auth_validate;
 	}
 
 	/* get all credentials */
-	auth_creds_array = json_get_jsonarray(auth_json, "credentials");
+	Array* auth_creds_array = json_get_jsonarray(auth_json, "credentials");
 	int i;
 	JSON* auth_cred_json;
 	char* name = NULL;
@@ -238,34 +536,48 @@ void core_proto_check_auth(STATE *state_ptr, MESSAGE *auth_msg)
 	}
 	free(name);
 	free(cred);
+	array_free(auth_creds_array);
 
+	if(!state_ptr->is_auth)
+	{
+		//slog(SLOG_WARN, "Proto: auth failed\n");
+		return -3;
+	}
+
+	return 0;
+}
+
+/* receive and check credentials for component and sends ACK */
+void core_proto_check_auth(STATE *state_ptr, MESSAGE *auth_msg)
+{
+	/*
+	 * because this function is called from the core only, these should never happen:
+	 * if(state_ptr == NULL)
+	 * if(auth_msg == NULL)
+	 * if(auth_msg->status != MSG_AUTH)
+	 */
+
+	int auth_validate = core_proto_auth_verify(state_ptr, message_json(auth_msg));
 
 	/* if auth succeeded */
-	if(state_ptr->is_auth)
+	if(auth_validate == 0)
 	{
 		if(state_ptr->state == STATE_AUTH)
 			state_ptr->state = STATE_AUTH_ACK;
 		else if(state_ptr->state == STATE_AUTH_2)
 		{
 			state_ptr->state = STATE_MAP;
-			sync_trigger(map_sync_pipe[0], "access:0");
+			state_sync_trigger(state_ptr);
 		}
 	}
-	else
-	{
-		//slog(SLOG_WARN, "Proto: auth failed\n");
-		auth_validate = -3;
-	}
 
+	/* lets the peer resume without credentials next time */
+	char* key = auth_validate == 0 ? session_issue(state_ptr) : NULL;
 
-	final:
-	{
-		auth_ack_json = json_build_auth_ack(auth_validate, "", NULL);
-		state_send_json(state_ptr, NULL, auth_ack_json, MSG_AUTH_ACK);
-		json_free(auth_ack_json);
-		array_free(auth_creds_array);
-		//json_free(auth_json);
-	}
+	JSON* auth_ack_json = json_build_auth_ack(auth_validate, key ? key : "", NULL);
+	state_send_json(state_ptr, NULL, auth_ack_json, MSG_AUTH_ACK);
+	json_free(auth_ack_json);
+	free(key);
 }
 
 /* receive credentials ACK for component */
@@ -278,7 +590,7 @@ void core_proto_check_auth_ack(STATE *state_ptr, MESSAGE *auth_ack_msg)
 	 * if(auth_ack_msg->status != MSG_AUTH_ACK)
 	 */
 
-	JSON *auth_ack_json = auth_ack_msg->_msg_json;
+	JSON *auth_ack_json = message_json(auth_ack_msg);
 	int auth_ack_validate = json_validate_auth_ack(auth_ack_json);
 
 	if(auth_ack_validate != 0)
@@ -287,14 +599,17 @@ void core_proto_check_auth_ack(STATE *state_ptr, MESSAGE *auth_ack_msg)
 		goto final;
 	}
 	else
+	{
 		state_ptr->am_auth = 1;
+		core_proto_session_key(state_ptr, auth_ack_json);
+	}
 
 	if(state_ptr->state == STATE_AUTH)
 		state_ptr->state = STATE_AUTH_2;
 	else if(state_ptr->state == STATE_AUTH_ACK)
 	{
 		state_ptr->state = STATE_MAP;
-		sync_trigger(map_sync_pipe[0], "access:0");
+		state_sync_trigger(state_ptr);
 	}
 
 	if(state_ptr->state == STATE_MAP ||
@@ -320,6 +635,7 @@ int core_proto_map_to(STATE *state_ptr, LOCAL_EP *lep, JSON* ep_query, JSON* cpt
 	state_ptr->state = STATE_MAP_ACK;
 
 	JSON *map_json = json_build_map(lep, ep_query, cpt_query);
+	core_proto_offer_payload(map_json);
 	state_send_json(state_ptr, NULL, map_json, MSG_MAP);
 	json_free(map_json);
 
@@ -337,7 +653,11 @@ void core_proto_map_ack(STATE *state_ptr, MESSAGE *map_ack_msg)
 	 * if(map_ack_msg->status != MSG_MAP_ACK)
 	 */
 
-	JSON *map_ack_json = map_ack_msg->_msg_json;
+	core_proto_map_ack_json(state_ptr, message_json(map_ack_msg));
+}
+
+void core_proto_map_ack_json(STATE *state_ptr, JSON *map_ack_json)
+{
 	int map_ack_validate = json_validate_map_ack(map_ack_json);
 
 	if(map_ack_validate == 0)
@@ -348,9 +668,18 @@ void core_proto_map_ack(STATE *state_ptr, MESSAGE *map_ack_msg)
 			//slog(SLOG_ERROR, "PROTO: received map ack for no ep %s");
 			goto final;
 		}
+		if(!core_proto_trusts(lep, map_ack_json))
+			map_ack_validate = EP_DOESNT_MATCH_HASH;
+	}
+
+	if(map_ack_validate == 0)
+	{
+		LOCAL_EP  *lep = state_ptr->lep;
+		core_proto_map_filters(state_ptr, map_ack_json);
 		ep_map(lep, state_ptr);
 		state_ptr->state = STATE_EXT_MSG;
 		state_ptr->ep_metadata = json_get_json(map_ack_json, "ep_metadata");
+		core_proto_set_payload(state_ptr, map_ack_json);
 	}
 	else
 	{
@@ -363,13 +692,13 @@ void core_proto_map_ack(STATE *state_ptr, MESSAGE *map_ack_msg)
 	//TODO
 	if(state_ptr->state == STATE_EXT_MSG)
 	{
-		sync_trigger(map_sync_pipe[0], "state_ext _msg");
+		state_sync_trigger(state_ptr);
 		//char ret_pipe[] = "state_ext _msg";
 		//send(map_sync_pipe[0], ret_pipe, strlen(ret_pipe), 0);
 	}
 	else
 	{
-		sync_trigger(map_sync_pipe[0], "state_bad");
+		state_sync_trigger(state_ptr);
 		//char ret_pipe[] = "state_bad";
 		//send(map_sync_pipe[0], ret_pipe, strlen(ret_pipe), 0);
 	}
@@ -390,7 +719,15 @@ void core_proto_map(STATE *state_ptr, MESSAGE *map_msg)
 	 * if(map_ack_msg->status != MSG_MAP)
 	 */
 
-	JSON *map_json = map_msg->_msg_json;
+	JSON *map_ack_json = core_proto_map_json(state_ptr, message_json(map_msg));
+	state_send_json(state_ptr, NULL, map_ack_json, MSG_MAP_ACK);
+
+	json_free(map_ack_json);
+	//json_free(map_json);
+}
+
+JSON* core_proto_map_json(STATE *state_ptr, JSON *map_json)
+{
 	int map_validate = json_validate_map(map_json);
 	LOCAL_EP *lep = NULL;
 
@@ -404,11 +741,19 @@ void core_proto_map(STATE *state_ptr, MESSAGE *map_msg)
 
 		lep = endpoint_query(ep_query_json);
 		json_free(ep_query_json);
-		if(lep != NULL)
+		if(lep != NULL && !core_proto_trusts(lep, map_json))
+		{
+			lep = NULL;
+			map_validate = EP_DOESNT_MATCH_HASH;
+			state_ptr->state = STATE_BAD;
+		}
+		else if(lep != NULL)
 		{
+			core_proto_map_filters(state_ptr, map_json);
 			ep_map(lep, state_ptr);
 			state_ptr->state = STATE_EXT_MSG;
 			state_ptr->ep_metadata = json_get_json(map_json, "ep_metadata");
+			core_proto_set_payload(state_ptr, map_json);
 		}
 		else
 		{
@@ -420,11 +765,95 @@ void core_proto_map(STATE *state_ptr, MESSAGE *map_msg)
 
 	state_ptr->flag = map_validate;
 
-	JSON *map_ack_json = json_build_map_ack(lep, map_validate, NULL);
-	state_send_json(state_ptr, NULL, map_ack_json, MSG_MAP_ACK);
+	JSON* map_ack_json = json_build_map_ack(lep, map_validate, NULL);
+	if(state_ptr->msg_codec || state_ptr->resp_codec)
+		json_set_str(map_ack_json, "payload", "schema");
+	return map_ack_json;
+}
 
-	json_free(map_ack_json);
-	//json_free(map_json);
+void core_proto_offer_payload(JSON *map_json)
+{
+	if(core_proto_envelope_enabled)
+		json_set_str(map_json, "payload", "schema");
+}
+
+/* both unset or the same hash */
+int core_proto_same_hash(const char* hash, const char* other)
+{
+	if(hash == NULL || other == NULL)
+		return hash == other;
+	return strcmp(hash, other) == 0;
+}
+
+/* the peer's ep_metadata has the same schema hashes as @lep */
+int core_proto_same_schema(LOCAL_EP *lep, JSON *ep_metadata)
+{
+	char* msg_hash = json_get_str(ep_metadata, "message");
+	char* resp_hash = json_get_str(ep_metadata, "response");
+	int same = core_proto_same_hash(msg_hash, lep->ep->msg)
+			&& core_proto_same_hash(resp_hash, lep->ep->resp);
+	free(msg_hash);
+	free(resp_hash);
+	return same;
+}
+
+/*
+ * a trusted endpoint skips validation, so it maps only peers with its
+ * schemas, whatever the query checked
+ */
+int core_proto_trusts(LOCAL_EP *lep, JSON *map_json)
+{
+	if(lep->validation != EP_VALIDATE_TRUSTED)
+		return 1;
+
+	JSON* ep_metadata = json_get_json(map_json, "ep_metadata");
+	int same = ep_metadata != NULL && core_proto_same_schema(lep, ep_metadata);
+	json_free(ep_metadata);
+	return same;
 }
 
+void core_proto_set_payload(STATE *state_ptr, JSON *map_json)
+{
+	state_ptr->msg_codec = state_ptr->resp_codec = NULL;
 
+	LOCAL_EP* lep = state_ptr->lep;
+	if(!state_ptr->envelope || lep == NULL || state_ptr->ep_metadata == NULL)
+		return;
+
+	char* payload = json_get_str(map_json, "payload");
+	int offered = (payload != NULL && strcmp(payload, "schema") == 0);
+	free(payload);
+	if(!offered)
+		return;
+
+	/* the query does not always check the hashes, so check them here */
+	if(core_proto_same_schema(lep, state_ptr->ep_metadata))
+	{
+		state_ptr->msg_codec = lep->msg_codec;
+		state_ptr->resp_codec = lep->resp_codec;
+	}
+}
+
+void core_proto_map_filters(STATE *state_ptr, JSON *map_json)
+{
+	Array* filters = NULL;
+	JSON* filters_json = json_get_json(map_json, "filters");
+	if(filters_json != NULL)
+	{
+		Array* paths = json_get_array(filters_json, NULL);
+		if(array_size(paths) > 0)
+			filters = json_filter_compile_array(paths);
+		array_free(paths);
+		json_free(filters_json);
+	}
+
+	/* a mapped state is re-indexed with the new filters */
+	LOCAL_EP* lep = state_ptr->lep;
+	int mapped = (lep != NULL && filter_set_remove(lep->mapping_filters, state_ptr) == 0);
+
+	json_filter_free_array(state_ptr->filters);
+	state_ptr->filters = filters;
+
+	if(mapped)
+		filter_set_add(lep->mapping_filters, state_ptr, filters);
+}
@@ -23,6 +23,42 @@
 //int proto_init_state_functions();
 
 
+/* add optional capabilities (e.g. framing) to hello and hello_ack */
+void core_proto_advertise(STATE *state_ptr, JSON *hello_json);
+
+/* switch to binary framing if the peer advertised it */
+void core_proto_set_framing(STATE *state_ptr, JSON *hello_json);
+
+/*
+ * optimistic handshake: the hello of the side that maps also carries its
+ * credentials and map query and the peer answers all in one hello_ack.
+ * Peers that do not advertise "handshake": "optimistic" get the usual steps.
+ */
+extern int core_proto_optimistic_enabled;
+extern int core_proto_envelope_enabled;
+
+/* the map the calling thread is about to do over a new connection */
+void core_proto_set_pending_map(LOCAL_EP* lep, JSON* ep_query, JSON* cpt_query);
+
+/* adds auth and map of the pending map to hello; 1 if it did */
+int core_proto_optimistic(STATE *state_ptr, JSON *hello_json);
+
+/*
+ * session resumption, see session.h: the token the calling thread holds
+ * for the address it connects to goes into hello as "session", and the
+ * peer must answer with pair
+ */
+void core_proto_set_pending_session(const char* token, const char* pair);
+int core_proto_offer_session(STATE *state_ptr, JSON *hello_json);
+/* keeps the token the peer issued in auth_ack, paired with ours */
+void core_proto_session_key(STATE *state_ptr, JSON *auth_ack_json);
+
+/* own credentials from all access modules */
+Array* core_proto_credentials();
+
+/* check the peer's credentials; 0 if accepted */
+int core_proto_auth_verify(STATE *state_ptr, JSON *auth_json);
+
 /* recv hello msg, send hello ack */
 void core_proto_hello(STATE *state_ptr, MESSAGE *hello_msg);
 
@@ -48,8 +84,30 @@ int core_proto_map_to(STATE *state_ptr, LOCAL_EP *lep, JSON* ep_query, JSON* cpt
 
 /* awaits for map msg */
 void core_proto_map(STATE *state_ptr, MESSAGE *data);
+/* maps the query in map_json, returns the map ack to send */
+JSON* core_proto_map_json(STATE *state_ptr, JSON *map_json);
 /* awaits for map_ack */
 void core_proto_map_ack(STATE *state_ptr, MESSAGE *map_ack_msg);
+void core_proto_map_ack_json(STATE *state_ptr, JSON *map_ack_json);
+
+/*
+ * the filters of the peer's sink, sent in map, map ack, or in a map on
+ * a mapped state when they change. What they reject is not sent.
+ */
+void core_proto_map_filters(STATE *state_ptr, JSON *map_json);
+
+/*
+ * compact payloads: map offers "payload": "schema" where the envelope may
+ * be used; a mapping whose ends have the same schema hashes then encodes
+ * the payloads with the ep's codecs, see json_codec.h. The map ack answers
+ * the same if the responder took it.
+ */
+void core_proto_offer_payload(JSON *map_json);
+void core_proto_set_payload(STATE *state_ptr, JSON *map_json);
+int core_proto_same_schema(LOCAL_EP *lep, JSON *ep_metadata);
+
+/* a trusted ep maps only peers whose ep_metadata has its schema hashes */
+int core_proto_trusts(LOCAL_EP *lep, JSON *map_json);
 
 
 
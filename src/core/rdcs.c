@@ -187,7 +187,7 @@ void rdc_register(RDC* r, MESSAGE* register_msg, int flag)
     if (!ep_can_send(ep_reg_rdc->ep))
 			return;
 
-    if (json_validate_message(ep_reg_rdc, register_msg->_msg_json))
+    if (json_validate_message(ep_reg_rdc, message_json(register_msg)))
 			return EP_NO_VALID;
 
     char* msg_to_send = message_to_str(register_msg);
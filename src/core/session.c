@@ -0,0 +1,217 @@
+/*
+ * session.c
+ */
+
+#include "session.h"
+
+#include <hashmap.h>
+#include <utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* token -> SESSION, the tokens given to peers */
+HashMap* sessions_issued = NULL;
+/* module:addr -> SESSION, the tokens peers gave us */
+HashMap* sessions_held = NULL;
+
+pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+SESSION* session_new(const char* token, JSON* cpt_manifest)
+{
+	SESSION* session = (SESSION*)malloc(sizeof(SESSION));
+	session->token = strdup(token);
+	session->pair = NULL;
+	session->access_module = NULL;
+	session->cpt_manifest = NULL;
+	if(cpt_manifest != NULL)
+		session->cpt_manifest = _json_dup(cpt_manifest);
+	session->expires = time(NULL) + SESSION_TTL;
+
+	return session;
+}
+
+void session_free(SESSION* session)
+{
+	if(session == NULL)
+		return;
+	free(session->token);
+	free(session->pair);
+	json_free(session->cpt_manifest);
+	free(session);
+}
+
+int sessions_init()
+{
+	sessions_issued = map_new(KEY_TYPE_STR);
+	sessions_held = map_new(KEY_TYPE_STR);
+	return (sessions_issued == NULL || sessions_held == NULL);
+}
+
+/* drop the expired sessions of one map; with sessions_lock held */
+void sessions_expire(HashMap* sessions)
+{
+	Array* keys = map_get_keys(sessions);
+	time_t now = time(NULL);
+	int i;
+	char* key;
+	SESSION* session;
+
+	for(i=0; i<array_size(keys); i++)
+	{
+		key = array_get(keys, i);
+		session = map_get(sessions, key);
+		if(session != NULL && session->expires <= now)
+		{
+			map_remove(sessions, key);
+			session_free(session);
+		}
+	}
+	array_free(keys);
+}
+
+/* random token, from /dev/urandom when there is one */
+char* session_token()
+{
+	static const char charset[] =
+			"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	unsigned char bytes[SESSION_TOKEN_SIZE];
+
+	int fd = open("/dev/urandom", O_RDONLY);
+	if(fd < 0)
+		return randstring(SESSION_TOKEN_SIZE);
+	int size = read(fd, bytes, SESSION_TOKEN_SIZE);
+	close(fd);
+	if(size != SESSION_TOKEN_SIZE)
+		return randstring(SESSION_TOKEN_SIZE);
+
+	char* token = (char*)malloc(SESSION_TOKEN_SIZE+1);
+	int i;
+	for(i=0; i<SESSION_TOKEN_SIZE; i++)
+		token[i] = charset[bytes[i] % (sizeof(charset)-1)];
+	token[SESSION_TOKEN_SIZE] = '\0';
+
+	return token;
+}
+
+char* session_issue(STATE* state_ptr)
+{
+	if(sessions_issued == NULL || !state_ptr->is_auth)
+		return NULL;
+
+	char* token = session_token();
+	SESSION* session = session_new(token, state_ptr->cpt_manifest);
+	session->access_module = state_ptr->access_module;
+
+	pthread_mutex_lock(&sessions_lock);
+	sessions_expire(sessions_issued);
+	map_insert(sessions_issued, token, session);
+	pthread_mutex_unlock(&sessions_lock);
+
+	free(state_ptr->session_issued);
+	state_ptr->session_issued = strdup(token);
+	session_pair(state_ptr);
+
+	return token;
+}
+
+void session_pair(STATE* state_ptr)
+{
+	if(sessions_issued == NULL || state_ptr->session_issued == NULL
+			|| state_ptr->session_key == NULL)
+		return;
+
+	pthread_mutex_lock(&sessions_lock);
+	SESSION* session = map_get(sessions_issued, state_ptr->session_issued);
+	if(session != NULL)
+	{
+		free(session->pair);
+		session->pair = strdup(state_ptr->session_key);
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+int session_resume(STATE* state_ptr, const char* token, char** pair)
+{
+	*pair = NULL;
+	if(sessions_issued == NULL || token == NULL)
+		return -1;
+
+	pthread_mutex_lock(&sessions_lock);
+	SESSION* session = map_get(sessions_issued, (void*)token);
+	/* without a token of the peer's we could not prove ourselves */
+	if(session == NULL || session->expires <= time(NULL) || session->pair == NULL)
+	{
+		pthread_mutex_unlock(&sessions_lock);
+		return -1;
+	}
+	*pair = strdup(session->pair);
+
+	state_ptr->access_module = session->access_module;
+	state_ptr->is_auth = 1;
+	/* the pair was issued by the peer once it accepted us */
+	state_ptr->am_auth = 1;
+	if(state_ptr->cpt_manifest == NULL && session->cpt_manifest != NULL)
+		state_ptr->cpt_manifest = _json_dup(session->cpt_manifest);
+	pthread_mutex_unlock(&sessions_lock);
+
+	return 0;
+}
+
+void session_remember(COM_MODULE* module, const char* addr, const char* token,
+		const char* pair, JSON* cpt_manifest)
+{
+	if(sessions_held == NULL || addr == NULL || token == NULL || pair == NULL)
+		return;
+
+	char key[105];
+	snprintf(key, sizeof(key), "%s:%s", module->name, addr);
+	SESSION* session = session_new(token, cpt_manifest);
+	session->pair = strdup(pair);
+
+	pthread_mutex_lock(&sessions_lock);
+	sessions_expire(sessions_held);
+	session_free(map_get(sessions_held, key));
+	map_insert(sessions_held, key, session);
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+char* session_find(COM_MODULE* module, const char* addr, char** pair)
+{
+	*pair = NULL;
+	if(sessions_held == NULL || addr == NULL)
+		return NULL;
+
+	char key[105];
+	snprintf(key, sizeof(key), "%s:%s", module->name, addr);
+	char* token = NULL;
+
+	pthread_mutex_lock(&sessions_lock);
+	SESSION* session = map_get(sessions_held, key);
+	if(session != NULL && session->expires > time(NULL))
+	{
+		token = strdup(session->token);
+		*pair = strdup(session->pair);
+	}
+	pthread_mutex_unlock(&sessions_lock);
+
+	return token;
+}
+
+void session_forget(COM_MODULE* module, const char* addr)
+{
+	if(sessions_held == NULL || addr == NULL)
+		return;
+
+	char key[105];
+	snprintf(key, sizeof(key), "%s:%s", module->name, addr);
+
+	pthread_mutex_lock(&sessions_lock);
+	SESSION* session = map_get(sessions_held, key);
+	map_remove(sessions_held, key);
+	session_free(session);
+	pthread_mutex_unlock(&sessions_lock);
+}
@@ -0,0 +1,68 @@
+/*
+ * session.h
+ */
+
+#ifndef CORE_SESSION_H_
+#define CORE_SESSION_H_
+
+#include <time.h>
+#include "json.h"
+#include "state.h"
+
+/*
+ * Resumable sessions.
+ * A side that accepted the peer's credentials issues a token in auth_ack,
+ * so after a full handshake each side holds a token the other issued.
+ * The initiator keeps both for the address it mapped to and sends the one
+ * it was given in the hello of its next connection there; the responder
+ * answers with the one it was given in hello_ack. Each side has then shown
+ * a token the other issued, and while they are valid both skip the
+ * credentials and take the access module and manifest from the cache.
+ */
+
+/* seconds a token stays valid from the moment it was issued */
+#define SESSION_TTL			300
+#define SESSION_TOKEN_SIZE	32
+
+typedef struct _SESSION{
+	char* token;
+	/*
+	 * the token of the other direction, NULL until known: for an issued
+	 * session the one the peer gave us, shown back on resume; for a held
+	 * one the one we gave the peer, expected back
+	 */
+	char* pair;
+	/* issued: the access module that accepted the peer */
+	ACCESS_MODULE* access_module;
+	/* the peer's manifest */
+	JSON* cpt_manifest;
+	time_t expires;
+}SESSION;
+
+int sessions_init();
+
+/* a new token for the authenticated peer on this state, kept in session_issued */
+char* session_issue(STATE* state_ptr);
+
+/* the peer's token on this state (session_key) pairs with the one we issued */
+void session_pair(STATE* state_ptr);
+
+/*
+ * resumes the session of token on state_ptr: sets the access module,
+ * is_auth/am_auth and the manifest if the peer did not send one.
+ * 0 if the token is valid and paired; *pair is then the token the peer
+ * gave us, to show back.
+ */
+int session_resume(STATE* state_ptr, const char* token, char** pair);
+
+/* keep the token the peer behind module+addr gave us and the one we gave it */
+void session_remember(COM_MODULE* module, const char* addr, const char* token,
+		const char* pair, JSON* cpt_manifest);
+
+/* the token to resume a connection to module+addr and its pair, NULL if none */
+char* session_find(COM_MODULE* module, const char* addr, char** pair);
+
+/* the token was refused by the peer */
+void session_forget(COM_MODULE* module, const char* addr);
+
+#endif /* CORE_SESSION_H_ */
@@ -8,28 +8,40 @@
 #include "state.h"
 
 #include "message.h"
+#include "frame_scan.h"
+#include "utils.h"
 #include <hashmap.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h> /* close */
 
 extern STATE* app_state;
 
-#define BUFFER_FINAL 	0
-#define BUFFER_JSON  	1
-#define BUFFER_STR_2 	2
-#define BUFFER_ESC_2 	3
-#define BUFFER_STR_1 	4
-#define BUFFER_ESC_1 	5
+/* guards the channels maps, filled from receive threads and core_map */
+pthread_mutex_t channels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* signals new entries in conn_state to states_wait */
+pthread_mutex_t states_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t states_cond = PTHREAD_COND_INITIALIZER;
+
+/* BUFFER_FINAL .. BUFFER_ESC_1 are in frame_scan.h */
+#define BUFFER_BIN_HEAD	6
+#define BUFFER_BIN_BODY	7
 
 BUFFER* buffer_new(STATE* state)
 {
 	BUFFER* buffer = (BUFFER*) malloc(sizeof(BUFFER));
 
-	buffer->data = NULL;
-	buffer->size = 0;
+	frame_buffer_init(&buffer->frame);
 
 	buffer->buffer_state = 0;
 	buffer->brackets = 0;
 
+	buffer->frame_len = 0;
+	buffer->frame_status = 0;
+	buffer->frame_flags = 0;
+
 	buffer->state = state;
 
 	return buffer;
@@ -37,42 +49,12 @@ BUFFER* buffer_new(STATE* state)
 
 void buffer_free(BUFFER* buffer)
 {
-	if(buffer->data)
-		free(buffer->data);
-	buffer->data = NULL;
-	buffer->size = 0;
+	frame_buffer_free(&buffer->frame);
 
 	buffer->buffer_state = 0;
 	buffer->brackets = 0;
 }
 
-void buffer_reset(BUFFER* buffer)
-{
-	if(buffer->data)
-		free(buffer->data);
-
-	buffer->data = (char*)(malloc(1));
-	buffer->data[0]='\0';
-}
-
-void buffer_set(BUFFER* buffer, const void* new_buf, unsigned int new_start, unsigned int new_end)
-{
-	/*printf("----old %d *%*s* \n"
-			"----new %d *%*s*\n\n",
-			buffer->size, buffer->size, buffer->data,
-			new_end-new_start, new_end-new_start, new_buf+new_start);
-	*/
-	char* old_buf = buffer->data;
-	int new_size = new_end-new_start;
-	buffer->data = (char*) malloc(buffer->size + new_size + 1);
-	memcpy(buffer->data,             old_buf,           buffer->size);
-	memcpy(buffer->data+buffer->size, new_buf+new_start, new_size   );
-	buffer->size = buffer->size + new_size;
-	buffer->data[buffer->size] = '\0';
-
-	free(old_buf);
-}
-
 void buffer_app_set(BUFFER *buffer)
 {
 	static int first = 1;
@@ -85,13 +67,13 @@ void buffer_app_set(BUFFER *buffer)
 	char module_id[5], function_id[18], return_type[4], msg_id[11];
 	void* arg = NULL;
 	int cmd=0;
-	//printf("RECEIVED: %s\n", buffer->data);
-	sscanf(buffer->data, "{{%d}{%4s}{%17s}{%3s}{%10s}",
+	//printf("RECEIVED: %s\n", buffer->frame.data);
+	sscanf(buffer->frame.data, "{{%d}{%4s}{%17s}{%3s}{%10s}",
 			&cmd, module_id, function_id, return_type, msg_id);
 
-	char arg_void[buffer->size-46];
-	memcpy(arg_void, buffer->data+48, buffer->size-48);
-	arg_void[buffer->size-48]='\0';
+	char arg_void[buffer->frame.size-46];
+	memcpy(arg_void, buffer->frame.data+48, buffer->frame.size-48);
+	arg_void[buffer->frame.size-48]='\0';
 
 	//printf (">>>> %d--%s--%s--%s--%s\n",
 	//		cmd,module_id, function_id, return_type, msg_id);
@@ -127,118 +109,178 @@ void buffer_app_set(BUFFER *buffer)
 
 }
 
-void buffer_update(BUFFER* buffer, const void* new_data, unsigned int new_size) //size should be fixed?
+/* a full message is in the buffer: apply the callback for this connection */
+void buffer_dispatch(BUFFER* buffer)
 {
-	unsigned int i=0;
-	unsigned int word_start = i;
-	unsigned int word_end = i;
+	STATE* state_ptr = buffer->state;
+	const char* data = buffer->frame.data;
 
-	for(i=0; i<new_size; i++)
+	if(state_ptr == app_state)
 	{
-		switch(buffer->buffer_state){
-			case BUFFER_FINAL:
-				switch (((char*)new_data)[i])
-				{
-					case '{':
-						buffer->brackets += 1;
-						word_start = i;
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					/* ignore spaces and new lines */
-					case ' ': case '\n': case '\r':
-						break;
-					default:
-						//slog(SLOG_ERROR, "%c", new_data[i]);
-						continue;
-
-				}
-				break;
+		buffer_app_set(buffer);
+		return;
+	}
 
-			case BUFFER_JSON:
-				switch (((char*)new_data)[i])
-				{
-					case '{':
-						buffer->brackets += 1;
-						//data->buffer_state = 1;
-						break;
-					case '}':
-						buffer->brackets -= 1;
-
-						if(buffer->brackets == 0) // finished 1 word
-						{
-							buffer->buffer_state = BUFFER_FINAL;
-							word_end = i+1;
-							buffer_set(buffer, new_data, word_start, word_end);
-							/* apply the callback for this connection */
-							if(buffer->state == app_state)
-							{
-								buffer_app_set(buffer);
-							}
-							else
-							{
-								MESSAGE* msg = message_parse(buffer->data);
-								JSON* js=msg->_msg_json;
-								(*buffer->state->on_message)(buffer->state, msg);
-								json_free(js);
-								message_free(msg);
-							}
-
-							buffer_reset(buffer);
-							buffer->size = 0;
-							word_start = i+1;
-						}
-
-						break;
-					case '\"':
-						buffer->buffer_state = BUFFER_STR_2;
-						break;
-					case '\'':
-						buffer->buffer_state = BUFFER_STR_1;
-						break;
-
-					default:
-						continue;
-				}
-				break;
-			case BUFFER_STR_1:
-				switch (((char*)new_data)[i])
-				{
-					case '\\':
-						buffer->buffer_state = BUFFER_ESC_1;
-						break;
-					case '\'':
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					default:
-						continue;
-				}
-				break;
-			case BUFFER_ESC_1:
-				buffer->buffer_state = BUFFER_STR_1;
+	/* multiplexed frame: hand it to the channel's state */
+	if(buffer->frame_flags & FRAME_FLAG_CHANNEL)
+	{
+		if(!state_ptr->multiplex || buffer->frame.size < FRAME_CHANNEL_SIZE)
+			return;
+
+		const unsigned char* head = (const unsigned char*)data;
+		unsigned int channel = ((unsigned int)head[0] << 24) | ((unsigned int)head[1] << 16)
+				| ((unsigned int)head[2] << 8) | (unsigned int)head[3];
+		data += FRAME_CHANNEL_SIZE;
+
+		if(channel != 0)
+		{
+			STATE* child = state_get_channel(state_ptr, channel);
+			/* the peer opens a channel with a map on it, on an id of its
+			 * parity; ours that are not there any more were closed */
+			if(child == NULL)
+			{
+				if(buffer->frame_status != MSG_MAP
+						|| (channel & 1) == (state_ptr->next_channel & 1))
+					return;
+				if(state_new_channel(state_ptr, channel) == NULL)
+					return;
+				/* with our ref, unless it was closed meanwhile */
+				child = state_get_channel(state_ptr, channel);
+				if(child == NULL)
+					return;
+			}
+			state_ptr = child;
+		}
+	}
+
+	MESSAGE* msg;
+	if(buffer->frame_flags & FRAME_FLAG_ENVELOPE)
+		msg = message_parse_bin(data, buffer->frame.data + buffer->frame.size - data,
+				state_ptr->msg_codec, state_ptr->resp_codec);
+	else
+		msg = message_parse_lazy(data, buffer->frame.data + buffer->frame.size - data);
+	if(msg != NULL)
+	{
+		/* handlers that keep it take a ref */
+		(*state_ptr->on_message)(state_ptr, msg);
+		message_free(msg);
+	}
+
+	/* the ref state_get_channel took */
+	if(state_ptr != buffer->state)
+		state_put(state_ptr);
+}
+
+void frame_header_write(unsigned char* header,
+		unsigned int len, unsigned char status, unsigned char flags)
+{
+	header[0] = FRAME_MAGIC_0;
+	header[1] = FRAME_MAGIC_1;
+	header[2] = (len >> 24) & 0xFF;
+	header[3] = (len >> 16) & 0xFF;
+	header[4] = (len >> 8) & 0xFF;
+	header[5] = len & 0xFF;
+	header[6] = status;
+	header[7] = flags;
+}
+
+/*
+ * consumes binary frame bytes from new_data[start..end)
+ * returns the position of the first byte not consumed
+ */
+unsigned int buffer_bin_update(BUFFER* buffer, const void* new_data,
+		unsigned int start, unsigned int end)
+{
+	const unsigned char* data = (const unsigned char*)new_data;
+	unsigned int needed, take;
+
+	while(start < end && buffer->buffer_state != BUFFER_FINAL)
+	{
+		if(buffer->buffer_state == BUFFER_BIN_HEAD)
+		{
+			needed = FRAME_HEADER_SIZE - buffer->frame.size;
+			take = (end-start < needed) ? end-start : needed;
+			frame_buffer_append(&buffer->frame, new_data, start, start+take);
+			start += take;
+			if(buffer->frame.size < FRAME_HEADER_SIZE)
 				break;
-			case BUFFER_STR_2:
-				switch (((char*)new_data)[i])
-				{
-					case '\\':
-						buffer->buffer_state = BUFFER_ESC_2;
-						break;
-					case '\"':
-						buffer->buffer_state = BUFFER_JSON;
-						break;
-					default:
-						continue;
-				}
+
+			const unsigned char* head = (const unsigned char*)buffer->frame.data;
+			buffer->frame_len = ((unsigned int)head[2] << 24) | ((unsigned int)head[3] << 16)
+					| ((unsigned int)head[4] << 8) | (unsigned int)head[5];
+			buffer->frame_status = head[6];
+			buffer->frame_flags = head[7];
+			int is_frame = (head[1] == FRAME_MAGIC_1 && buffer->frame_len <= FRAME_MAX_SIZE);
+
+			frame_buffer_reset(&buffer->frame);
+
+			/* not a frame after all: drop it and resync on the next '{' or magic */
+			if(!is_frame)
+			{
+				buffer->buffer_state = BUFFER_FINAL;
 				break;
-			case BUFFER_ESC_2:
-				buffer->buffer_state = BUFFER_STR_2;
+			}
+			buffer->buffer_state = BUFFER_BIN_BODY;
+		}
+
+		if(buffer->buffer_state == BUFFER_BIN_BODY)
+		{
+			needed = buffer->frame_len - buffer->frame.size;
+			take = (end-start < needed) ? end-start : needed;
+			if(take > 0)
+				frame_buffer_append(&buffer->frame, data, start, start+take);
+			start += take;
+			if(buffer->frame.size < buffer->frame_len)
 				break;
-			default: //impossible
-				return;
+
+			buffer->buffer_state = BUFFER_FINAL;
+			if(buffer->frame_len > 0)
+				buffer_dispatch(buffer);
+			frame_buffer_reset(&buffer->frame);
+			buffer->frame_flags = 0;
+		}
+	}
+
+	return start;
+}
+
+void buffer_update(BUFFER* buffer, const void* new_data, unsigned int new_size) //size should be fixed?
+{
+	unsigned int i = 0;
+	unsigned int word_start = 0;
+	int scan;
+
+	while(i < new_size)
+	{
+		if(buffer->buffer_state == BUFFER_BIN_HEAD || buffer->buffer_state == BUFFER_BIN_BODY)
+		{
+			i = buffer_bin_update(buffer, new_data, i, new_size);
+			word_start = i;
+			continue;
+		}
+
+		scan = frame_scan(&buffer->buffer_state, &buffer->brackets, new_data,
+				&i, new_size, &word_start, FRAME_MAGIC_0);
+
+		if(scan == FRAME_SCAN_FRAME) /* finished 1 word */
+		{
+			frame_buffer_append(&buffer->frame, new_data, word_start, i);
+			buffer_dispatch(buffer);
+			frame_buffer_reset(&buffer->frame);
+			word_start = i;
+		}
+		else if(scan == FRAME_SCAN_STOP) /* binary frame magic */
+		{
+			buffer->buffer_state = BUFFER_BIN_HEAD;
+			word_start = i;
 		}
 	}
 
-	if(word_start<new_size && buffer->buffer_state != BUFFER_FINAL)
-		buffer_set(buffer, new_data, word_start, new_size);
+	/* keep the incomplete json word */
+	if(word_start<new_size && buffer->buffer_state != BUFFER_FINAL
+			&& buffer->buffer_state != BUFFER_BIN_HEAD
+			&& buffer->buffer_state != BUFFER_BIN_BODY)
+		frame_buffer_append(&buffer->frame, new_data, word_start, new_size);
 }
 
 
@@ -263,9 +305,34 @@ STATE* state_new(COM_MODULE* module, int conn, int state)
 	state_ptr->ep_metadata = NULL;
 
 	state_ptr->flag = 0; /* the good flag */
+	state_ptr->stream_pipe = -1;
+	pthread_mutex_init(&state_ptr->stream_lock, NULL);
+	state_ptr->framing = STATE_FRAMING_BRACES;
+	state_ptr->envelope = 0;
+	state_ptr->msg_codec = state_ptr->resp_codec = NULL;
+	state_ptr->optimistic = 0;
+	state_ptr->session_key = NULL;
+	state_ptr->session_issued = NULL;
+	state_ptr->resumed = 0;
+	state_ptr->filters = NULL;
+
+	state_ptr->multiplex = 0;
+	state_ptr->parent = NULL;
+	state_ptr->channel = 0;
+	state_ptr->channels = NULL;
+	state_ptr->next_channel = 2;
+	state_ptr->closing = 0;
+	pthread_mutex_init(&state_ptr->send_lock, NULL);
+	state_ptr->refs = 1;
 	state_ptr->is_auth = 0;
 	state_ptr->am_auth = 0;
 
+	pthread_mutex_init(&state_ptr->sync_lock, NULL);
+	pthread_cond_init(&state_ptr->sync_cond, NULL);
+	state_ptr->sync_events = 0;
+	state_ptr->sync_waiters = 0;
+	state_ptr->sync_closed = 0;
+
 	state_ptr->buffer = buffer_new(state_ptr);
 	state_ptr->on_message = NULL;
 	return state_ptr;
@@ -276,28 +343,200 @@ void state_free(STATE* state)
 {
 	if(state == NULL)
 		return;
+
+	/* wake a mapping still waiting on this state and let it leave */
+	pthread_mutex_lock(&state->sync_lock);
+	state->sync_closed = 1;
+	pthread_cond_broadcast(&state->sync_cond);
+	while(state->sync_waiters > 0)
+		pthread_cond_wait(&state->sync_cond, &state->sync_lock);
+	pthread_mutex_unlock(&state->sync_lock);
+	pthread_cond_destroy(&state->sync_cond);
+	pthread_mutex_destroy(&state->sync_lock);
+	pthread_mutex_destroy(&state->send_lock);
+
 	json_free(state->cpt_manifest);
 	json_free(state->ep_metadata);
 	array_free(state->tokens);
 	free(state->addr);
+	free(state->session_key);
+	free(state->session_issued);
+	json_filter_free_array(state->filters);
+	map_free(state->channels);
+	if(state->stream_pipe >= 0)
+		close(state->stream_pipe);
+	pthread_mutex_destroy(&state->stream_lock);
 	//data_free(state->data);
 
 	buffer_free(state->buffer);
 	free(state);
 }
 
+void state_get(STATE* state)
+{
+	pthread_mutex_lock(&states_lock);
+	state->refs++;
+	pthread_mutex_unlock(&states_lock);
+}
+
+void state_put(STATE* state)
+{
+	if(state == NULL)
+		return;
+
+	pthread_mutex_lock(&states_lock);
+	unsigned int refs = --state->refs;
+	pthread_mutex_unlock(&states_lock);
+
+	if(refs == 0)
+		state_free(state);
+}
+
+
+/* fd, if not -1, is passed along with the frame */
+int state_send_frame_fd(STATE* state, const void* data, unsigned int size,
+		int status, unsigned char flags, int fd)
+{
+	unsigned char header[FRAME_HEADER_SIZE + FRAME_CHANNEL_SIZE];
+	struct iovec iov[2];
+	/* channels share the owner's connection */
+	STATE* owner = state->parent ? state->parent : state;
+	int result;
+
+	if(state->framing != STATE_FRAMING_BINARY)
+	{
+		pthread_mutex_lock(&owner->send_lock);
+		if(fd < 0)
+			result = (*(state->module->fc_send))(state->conn, data, size);
+		else
+		{
+			iov[0].iov_base = (void*)data;
+			iov[0].iov_len = size;
+			result = com_module_sendv_fd(state->module, state->conn, fd, iov, 1);
+		}
+		pthread_mutex_unlock(&owner->send_lock);
+		return result;
+	}
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = FRAME_HEADER_SIZE;
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = size;
+
+	if(state->parent == NULL)
+		frame_header_write(header, size, status, flags);
+	else
+	{
+		/* the channel id goes first in the payload */
+		frame_header_write(header, size + FRAME_CHANNEL_SIZE, status, flags | FRAME_FLAG_CHANNEL);
+		header[FRAME_HEADER_SIZE] = (state->channel >> 24) & 0xFF;
+		header[FRAME_HEADER_SIZE+1] = (state->channel >> 16) & 0xFF;
+		header[FRAME_HEADER_SIZE+2] = (state->channel >> 8) & 0xFF;
+		header[FRAME_HEADER_SIZE+3] = state->channel & 0xFF;
+		iov[0].iov_len += FRAME_CHANNEL_SIZE;
+	}
+
+	pthread_mutex_lock(&owner->send_lock);
+	result = com_module_sendv_fd(state->module, state->conn, fd, iov, 2);
+	pthread_mutex_unlock(&owner->send_lock);
+	return result;
+}
+
+int state_send_frame(STATE* state, const void* data, unsigned int size,
+		int status, unsigned char flags)
+{
+	return state_send_frame_fd(state, data, size, status, flags, -1);
+}
+
+int state_send(STATE* state, const void* data, unsigned int size, int status)
+{
+	return state_send_frame(state, data, size, status, 0);
+}
+
+void state_wire_init(STATE_WIRE* wire, MESSAGE* msg)
+{
+	wire->msg = msg;
+	wire->text = NULL;
+	wire->bin = NULL;
+	wire->bin_size = 0;
+	wire->codec = NULL;
+	wire->compact = NULL;
+	wire->compact_size = 0;
+}
+
+void state_wire_free(STATE_WIRE* wire)
+{
+	free(wire->text);
+	free(wire->bin);
+	free(wire->compact);
+	state_wire_init(wire, NULL);
+}
+
+int state_send_wire_fd(STATE* state, STATE_WIRE* wire, int fd)
+{
+	JSON_CODEC* codec = state->envelope ?
+			message_codec(wire->msg->status, state->msg_codec, state->resp_codec) : NULL;
+	if(codec != NULL)
+	{
+		/* states of one ep share its codec; one mapping behind a schema update may not */
+		if(codec != wire->codec)
+		{
+			free(wire->compact);
+			wire->codec = codec;
+			wire->compact = message_to_bin_codec(wire->msg, codec, &wire->compact_size);
+		}
+		if(wire->compact != NULL)
+			return state_send_frame_fd(state, wire->compact, wire->compact_size,
+					wire->msg->status, FRAME_FLAG_ENVELOPE, fd);
+		/* not in the schema's shape, the generic envelope carries it */
+	}
+
+	if(state->envelope)
+	{
+		if(wire->bin == NULL)
+			wire->bin = message_to_bin(wire->msg, &wire->bin_size);
+		return state_send_frame_fd(state, wire->bin, wire->bin_size,
+				wire->msg->status, FRAME_FLAG_ENVELOPE, fd);
+	}
+
+	if(wire->text == NULL)
+		wire->text = message_to_str(wire->msg);
+
+	//slog(SLOG_DEBUG, "STATE SEND MESSAGE: %s\n", wire->text);
+	if(state->framing == STATE_FRAMING_BINARY || fd >= 0)
+		return state_send_frame_fd(state, wire->text, strlen(wire->text),
+				wire->msg->status, 0, fd);
+
+	pthread_mutex_lock(&state->send_lock);
+	int result = (*(state->module->fc_send_data))(state->conn, wire->text);
+	pthread_mutex_unlock(&state->send_lock);
+	return result;
+}
+
+int state_send_wire(STATE* state, STATE_WIRE* wire)
+{
+	return state_send_wire_fd(state, wire, -1);
+}
 
 int state_send_message(STATE* state, MESSAGE* msg)
 {
 //	if(state == NULL)
 //		return STATE_BAD;
 
-	char* msg_str = message_to_str(msg);
+	STATE_WIRE wire;
+	state_wire_init(&wire, msg);
+	int result = state_send_wire(state, &wire);
+	state_wire_free(&wire);
 
-	//slog(SLOG_DEBUG, "STATE SEND MESSAGE: %s\n", msg_str);
-	int result = (*(state->module->fc_send_data))(state->conn, msg_str);
+	return result;
+}
 
-	free(msg_str);
+int state_send_message_fd(STATE* state, MESSAGE* msg, int fd)
+{
+	STATE_WIRE wire;
+	state_wire_init(&wire, msg);
+	int result = state_send_wire_fd(state, &wire, fd);
+	state_wire_free(&wire);
 
 	return result;
 }
@@ -314,6 +553,63 @@ int state_send_json(STATE* state, const char* id, JSON* json, int status)
 
 	return result;
 }
+/* completion */
+
+void state_sync_trigger(STATE* state)
+{
+	pthread_mutex_lock(&state->sync_lock);
+	state->sync_events++;
+	pthread_cond_broadcast(&state->sync_cond);
+	pthread_mutex_unlock(&state->sync_lock);
+}
+
+unsigned int state_sync_events(STATE* state)
+{
+	pthread_mutex_lock(&state->sync_lock);
+	unsigned int events = state->sync_events;
+	pthread_mutex_unlock(&state->sync_lock);
+
+	return events;
+}
+
+/* absolute deadline timeout seconds from now */
+static void sync_deadline(struct timespec* deadline, int timeout)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += timeout;
+}
+
+int state_sync_wait(STATE* state, unsigned int events, int timeout)
+{
+	struct timespec deadline;
+	sync_deadline(&deadline, timeout);
+	int result = STATE_SYNC_OK;
+
+	pthread_mutex_lock(&state->sync_lock);
+	state->sync_waiters++;
+	while(state->sync_events < events)
+	{
+		if(state->sync_closed)
+		{
+			result = STATE_SYNC_CLOSED;
+			break;
+		}
+		if(pthread_cond_timedwait(&state->sync_cond, &state->sync_lock, &deadline) != 0
+				&& state->sync_events < events)
+		{
+			result = state->sync_closed ? STATE_SYNC_CLOSED : STATE_SYNC_TIMEOUT;
+			break;
+		}
+	}
+	state->sync_waiters--;
+	/* state_free may be waiting for the last waiter */
+	if(state->sync_closed)
+		pthread_cond_broadcast(&state->sync_cond);
+	pthread_mutex_unlock(&state->sync_lock);
+
+	return result;
+}
+
 const char* state_get_str(int state)
 {
 	switch (state) {
@@ -367,6 +663,93 @@ STATE* states_get(COM_MODULE* module, int conn)
 	return state_ptr;
 }
 
+/* channels */
+
+STATE* state_new_channel(STATE* parent, unsigned int channel)
+{
+	STATE* child = state_new(parent->module, parent->conn, STATE_MAP);
+	if(child == NULL)
+		return NULL;
+
+	/* the connection is already through hello and auth */
+	child->parent = parent;
+	child->channel = channel;
+	child->framing = parent->framing;
+	child->envelope = parent->envelope;
+	child->multiplex = 1;
+	child->access_module = parent->access_module;
+	child->is_auth = parent->is_auth;
+	child->am_auth = parent->am_auth;
+	child->addr = strdup_null(parent->addr);
+	child->on_message = parent->on_message;
+
+	pthread_mutex_lock(&channels_lock);
+	if(parent->closing || (parent->channels != NULL
+			&& map_size(parent->channels) >= STATE_MAX_CHANNELS))
+	{
+		pthread_mutex_unlock(&channels_lock);
+		state_free(child);
+		return NULL;
+	}
+	if(parent->channels == NULL)
+		parent->channels = map_new(KEY_TYPE_INT);
+	map_insert(parent->channels, &child->channel, child);
+	pthread_mutex_unlock(&channels_lock);
+
+	return child;
+}
+
+STATE* state_get_channel(STATE* parent, unsigned int channel)
+{
+	pthread_mutex_lock(&channels_lock);
+	STATE* child = map_get(parent->channels, &channel);
+	if(child != NULL)
+		state_get(child);
+	pthread_mutex_unlock(&channels_lock);
+
+	return child;
+}
+
+STATE* state_open_channel(STATE* parent)
+{
+	pthread_mutex_lock(&channels_lock);
+	unsigned int channel = parent->next_channel;
+	parent->next_channel += 2;
+	pthread_mutex_unlock(&channels_lock);
+
+	return state_new_channel(parent, channel);
+}
+
+void state_close_channel(STATE* child)
+{
+	pthread_mutex_lock(&channels_lock);
+	map_remove(child->parent->channels, &child->channel);
+	pthread_mutex_unlock(&channels_lock);
+
+	/* freed once a dispatch on it is over */
+	state_put(child);
+}
+
+void state_free_channels(STATE* parent)
+{
+	pthread_mutex_lock(&channels_lock);
+	parent->closing = 1;
+	Array* children = map_get_values(parent->channels);
+	map_free(parent->channels);
+	parent->channels = NULL;
+	pthread_mutex_unlock(&channels_lock);
+
+	int i;
+	STATE* child;
+	for(i=0; i<array_size(children); i++)
+	{
+		child = array_get(children, i);
+		ep_unmap_final(child->lep, child);
+		state_put(child);
+	}
+	array_free(children);
+}
+
 int states_set(COM_MODULE* module, int conn, STATE* state)
 {
 	if(state == NULL)
@@ -377,5 +760,72 @@ int states_set(COM_MODULE* module, int conn, STATE* state)
 	char* conn_str=(char*) malloc(105*sizeof(char));
 	sprintf(conn_str, "%s:%d", module->name, conn);
 
-	return map_insert(conn_state, conn_str, state);
+	pthread_mutex_lock(&states_lock);
+	int result = map_insert(conn_state, conn_str, state);
+	pthread_cond_broadcast(&states_cond);
+	pthread_mutex_unlock(&states_lock);
+
+	return result;
+}
+
+STATE* states_wait(COM_MODULE* module, int conn, int timeout)
+{
+	struct timespec deadline;
+	sync_deadline(&deadline, timeout);
+
+	pthread_mutex_lock(&states_lock);
+	STATE* state_ptr = states_get(module, conn);
+	while(state_ptr == NULL)
+	{
+		int err = pthread_cond_timedwait(&states_cond, &states_lock, &deadline);
+		state_ptr = states_get(module, conn);
+		if(err != 0)
+			break;
+	}
+	pthread_mutex_unlock(&states_lock);
+
+	return state_ptr;
+}
+
+int states_remove(COM_MODULE* module, int conn)
+{
+	char conn_str[105];
+	sprintf(conn_str, "%s:%d", module->name, conn);
+
+	pthread_mutex_lock(&states_lock);
+	int result = map_remove(conn_state, conn_str);
+	pthread_mutex_unlock(&states_lock);
+
+	return result;
+}
+
+STATE* states_get_peer(COM_MODULE* module, const char* addr)
+{
+	if(addr == NULL)
+		return NULL;
+
+	int i;
+	STATE* state_ptr;
+	STATE* peer = NULL;
+
+	pthread_mutex_lock(&states_lock);
+	Array* states = map_get_values(conn_state);
+
+	for(i=0; i<array_size(states); i++)
+	{
+		state_ptr = array_get(states, i);
+		if(state_ptr->module == module && state_ptr->multiplex
+				&& state_ptr->parent == NULL
+				&& state_ptr->state == STATE_EXT_MSG
+				&& state_ptr->addr != NULL && strcmp(state_ptr->addr, addr) == 0)
+		{
+			peer = state_ptr;
+			peer->refs++;
+			break;
+		}
+	}
+	array_free(states);
+	pthread_mutex_unlock(&states_lock);
+
+	return peer;
 }
@@ -9,9 +9,11 @@
 #define CORE_STATE_H_
 
 
+#include <pthread.h>
 #include <hashmap.h>
 #include <endpoint.h>
 #include <com_wrapper.h>
+#include <frame_scan.h>
 #include "../module_wrappers/access_wrapper.h"
 
 /* state error codes */
@@ -32,15 +34,48 @@
 
 #define STATE_BAD			0
 
+/* state_sync_wait results */
+#define STATE_SYNC_OK		 0
+#define STATE_SYNC_TIMEOUT	-1
+#define STATE_SYNC_CLOSED	-2
+
+/* seconds a mapping waits for each protocol step */
+#define STATE_SYNC_DEADLINE	5
+
+/* framing of the messages on a connection */
+#define STATE_FRAMING_BRACES	0
+#define STATE_FRAMING_BINARY	1
+
+/*
+ * binary frame header, all fields in network order:
+ * magic (2) | payload length (4) | status (1) | flags (1)
+ * negotiated in hello; brace delimited json stays the default.
+ */
+#define FRAME_MAGIC_0		0xCF
+#define FRAME_MAGIC_1		0x1A
+#define FRAME_HEADER_SIZE	8
+#define FRAME_MAX_SIZE		(64*1024*1024)
+
+/* frame flags */
+#define FRAME_FLAG_CHANNEL	0x01 /* payload starts with a 4 byte channel id */
+#define FRAME_FLAG_ENVELOPE	0x02 /* message in the binary envelope, message_to_bin */
+#define FRAME_CHANNEL_SIZE	4
+/* channels the peer may have open on one connection */
+#define STATE_MAX_CHANNELS	256
+
 struct _STATE;
 
 typedef struct _BUFFER{
-	char* data;
-	int size;
+	FRAME_BUFFER frame;
 
 	int buffer_state;
 	int brackets;
 
+	/* binary frames */
+	unsigned int frame_len;
+	unsigned char frame_status;
+	unsigned char frame_flags;
+
 	struct _STATE* state;
 }BUFFER;
 
@@ -48,12 +83,12 @@ BUFFER* buffer_new(struct _STATE* state);
 
 void buffer_free(BUFFER* buffer);
 
-void buffer_set(BUFFER* buffer, const void* new_data,
-		unsigned int new_start, unsigned int new_end);
-
 void buffer_update(BUFFER* buffer, const void* new_data, unsigned int new_end);
 //size should be fixed?
 
+void frame_header_write(unsigned char* header,
+		unsigned int len, unsigned char status, unsigned char flags);
+
 
 typedef struct _STATE{
 	/* the access module that provided auth for this connection */
@@ -77,6 +112,68 @@ typedef struct _STATE{
 	unsigned int state		:5;
 	int flag;
 
+	/*
+	 * stream source over a module that passes fds: the write end of
+	 * the socket pair whose other end the sink reads; -1 otherwise
+	 */
+	int stream_pipe;
+	pthread_mutex_t stream_lock;	/* stream_pipe; never held across a block */
+
+	/* STATE_FRAMING_*; binary once the peer advertised it in hello */
+	unsigned int framing	:1;
+	/* binary framing and the peer reads the binary envelope */
+	unsigned int envelope	:1;
+	/*
+	 * envelope and both ends agreed on the ep schemas in map: payloads
+	 * go in their compact encoding. Borrowed from lep, NULL otherwise.
+	 */
+	JSON_CODEC* msg_codec;
+	JSON_CODEC* resp_codec;
+
+	/* our hello carried auth and map, waiting for the combined ack */
+	unsigned int optimistic	:1;
+
+	/* session token the peer gave us; resumed: hello skipped auth with it */
+	char* session_key;
+	/* session token we gave the peer, which it shows back to resume */
+	char* session_issued;
+	unsigned int resumed	:1;
+
+	/* the remote sink's filters, JSON_FILTER*; NULL if it takes everything */
+	Array* filters;
+
+	/*
+	 * multiplexing, binary framing only: several mappings share one
+	 * connection, each on its own channel. Channel 0 is the state that
+	 * owns the connection; the others are child states of it.
+	 */
+	unsigned int multiplex	:1;
+	struct _STATE* parent;		/* owner of the connection, NULL for the owner */
+	unsigned int channel;
+	HashMap* channels;			/* on the owner: channel id -> child state */
+	unsigned int next_channel;	/* odd on the side that dialed, even on the other */
+	unsigned int closing	:1;	/* on the owner: no new channels, it is going */
+	/* on the owner: the frames of all channels go out one at a time */
+	pthread_mutex_t send_lock;
+
+	/*
+	 * holders: conn_state (the owner's channels map for a child), core_map
+	 * while it opens a channel on the owner found by states_get_peer, and
+	 * buffer_dispatch while it hands a frame to a child. The last
+	 * state_put frees it.
+	 */
+	unsigned int refs;
+
+	/*
+	 * completion of the protocol steps (hello, auth, map ack) on this
+	 * state, so each core_map waits for its own connection only
+	 */
+	pthread_mutex_t sync_lock;
+	pthread_cond_t sync_cond;
+	unsigned int sync_events;	/* steps completed so far */
+	unsigned int sync_waiters;
+	unsigned int sync_closed	:1;
+
 	BUFFER* buffer;
 	/* on_message handler for each connection */
 	void (*on_message)(struct _STATE*, MESSAGE*);
@@ -91,10 +188,55 @@ typedef struct _STATE{
 STATE* state_new(COM_MODULE* module, int conn, int state);
 
 void state_free(STATE* state);
+/* takes a reference / drops one; the last state_put frees the state */
+void state_get(STATE* state);
+void state_put(STATE* state);
 
 int state_send_message(STATE* state, MESSAGE* msg);
+/* the same with fd passed along, on modules that can (fc_send_fd) */
+int state_send_message_fd(STATE* state, MESSAGE* msg, int fd);
 int state_send_json(STATE* state, const char* id, JSON* json, int status);
 
+/* sends an already serialised message, framed for the state's channel */
+int state_send(STATE* state, const void* data, unsigned int size, int status);
+
+/*
+ * a message going to several states, serialised at most once
+ * in each encoding they use
+ */
+typedef struct _STATE_WIRE{
+	MESSAGE* msg;
+	char* text;
+	void* bin;
+	unsigned int bin_size;
+	/* compact envelope, for the codec it was made with; NULL if it did not fit */
+	JSON_CODEC* codec;
+	void* compact;
+	unsigned int compact_size;
+}STATE_WIRE;
+
+void state_wire_init(STATE_WIRE* wire, MESSAGE* msg);
+void state_wire_free(STATE_WIRE* wire);
+int state_send_wire(STATE* state, STATE_WIRE* wire);
+
+/* channels */
+STATE* state_new_channel(STATE* parent, unsigned int channel);
+/* with a reference taken, state_put when done; NULL if not open */
+STATE* state_get_channel(STATE* parent, unsigned int channel);
+/* a new channel from this side, NULL if the connection is closing */
+STATE* state_open_channel(STATE* parent);
+/* removes a child state from its connection and drops its ref */
+void state_close_channel(STATE* child);
+/* unmaps all the child states and drops their refs, when the connection is gone */
+void state_free_channels(STATE* parent);
+
+/* completion */
+/* one more protocol step done; wakes the mapping waiting on it */
+void state_sync_trigger(STATE* state);
+unsigned int state_sync_events(STATE* state);
+/* waits until events steps are done, at most timeout seconds */
+int state_sync_wait(STATE* state, unsigned int events, int timeout);
+
 const char* state_get_str(int state);
 
 
@@ -110,5 +252,16 @@ STATE* states_get(COM_MODULE* module, int conn);
 
 int states_set(COM_MODULE* module, int conn, STATE* state);
 
+/* states_get, waiting at most timeout seconds for on_connect to add it */
+STATE* states_wait(COM_MODULE* module, int conn, int timeout);
+
+int states_remove(COM_MODULE* module, int conn);
+
+/*
+ * an established, multiplexing connection to addr over module, or NULL.
+ * The caller holds a reference to it: state_put when done.
+ */
+STATE* states_get_peer(COM_MODULE* module, const char* addr);
+
 
 #endif /* CORE_STATE_H_ */
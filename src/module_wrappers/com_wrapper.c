@@ -13,13 +13,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <dlfcn.h>
 #include <unistd.h> /* for sleep */
+#include <pthread.h>
 
 /* error string modified if errors appear in this module
  * e.g. if functions are not found */
 char* error;
 
+/* map_cost is updated by concurrent core_maps and read while ranking */
+pthread_mutex_t com_cost_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* helper function for instantiating and loading a module */
 int load_all_com_functions(COM_MODULE *module)
 {
@@ -73,6 +78,13 @@ int load_all_com_functions(COM_MODULE *module)
 //	{
 //		return -1;
 //	}
+	/* optional functions */
+	module->fc_sendv = dlsym(module->handle, "com_sendv");
+	module->fc_is_binary_safe = dlsym(module->handle, "com_is_binary_safe");
+	module->fc_send_fd = dlsym(module->handle, "com_send_fd");
+	module->fc_recv_fd = dlsym(module->handle, "com_recv_fd");
+	module->fc_get_locality = dlsym(module->handle, "com_get_locality");
+	module->fc_before_exec = dlsym(module->handle, "com_before_exec");
 
 
 	return 0;
@@ -128,6 +140,11 @@ COM_MODULE* com_module_new(const char* filename, const char* config_json)
 		return NULL;
 	}
 
+	module->locality = COM_LOCALITY_NET;
+	if (module->fc_get_locality != NULL)
+		module->locality = (*(module->fc_get_locality))();
+	module->map_cost = 0;
+
 	module->address = (*(module->fc_init))(module, config_json);
 
 	if(module->address == NULL)
@@ -156,6 +173,84 @@ void com_module_free(COM_MODULE* module)
 	free(module);
 }
 
+int com_module_sendv(COM_MODULE* module, int conn, const struct iovec* iov, int iovcnt)
+{
+	if (module->fc_sendv != NULL)
+		return (*(module->fc_sendv))(conn, iov, iovcnt);
+
+	unsigned int size = 0, pos = 0;
+	int i;
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	char* data = (char*) malloc(size);
+	if (data == NULL)
+		return COM_ERROR;
+	for (i = 0; i < iovcnt; i++)
+	{
+		memcpy(data + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	int result = (*(module->fc_send))(conn, data, size);
+	free(data);
+
+	return result;
+}
+
+int com_module_sendv_fd(COM_MODULE* module, int conn, int fd, const struct iovec* iov, int iovcnt)
+{
+	if (fd < 0)
+		return com_module_sendv(module, conn, iov, iovcnt);
+	if (module->fc_send_fd == NULL)
+		return COM_ERROR;
+
+	unsigned int size = 0, pos = 0;
+	int i;
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].iov_len;
+
+	char* data = (char*) malloc(size);
+	if (data == NULL)
+		return COM_ERROR;
+	for (i = 0; i < iovcnt; i++)
+	{
+		memcpy(data + pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	}
+
+	int result = (*(module->fc_send_fd))(conn, fd, data, size);
+	free(data);
+
+	return result;
+}
+
+void com_module_add_cost(COM_MODULE* module, double cost_ms)
+{
+	pthread_mutex_lock(&com_cost_lock);
+	if (module->map_cost == 0)
+		module->map_cost = cost_ms;
+	else
+		module->map_cost += COM_COST_ALPHA * (cost_ms - module->map_cost);
+	pthread_mutex_unlock(&com_cost_lock);
+}
+
+int com_module_compare(const COM_MODULE* a, const COM_MODULE* b)
+{
+	if (a->locality != b->locality)
+		return a->locality - b->locality;
+
+	pthread_mutex_lock(&com_cost_lock);
+	double a_cost = a->map_cost, b_cost = b->map_cost;
+	pthread_mutex_unlock(&com_cost_lock);
+
+	/* try the unmeasured ones to get a cost */
+	if (a_cost == 0 || b_cost == 0)
+		return (a_cost != 0) - (b_cost != 0);
+
+	return (a_cost > b_cost) - (a_cost < b_cost);
+}
+
 /* container functionality*/
 
 int init_com_wrapper()
@@ -244,6 +339,33 @@ COM_MODULE* com_get_module(const char* modulename)
 	return map_get(com_modules, (void*)modulename);
 }
 
+Array* com_get_ranked_modules()
+{
+	Array* values = map_get_values(com_modules);
+	if (values == NULL)
+		return NULL;
+
+	int i, j, size = array_size(values);
+	COM_MODULE* sorted[size > 0 ? size : 1];
+	COM_MODULE* module;
+
+	/* insertion sort, there are only a few modules */
+	for (i = 0; i < size; i++)
+	{
+		module = array_get(values, i);
+		for (j = i; j > 0 && com_module_compare(sorted[j-1], module) > 0; j--)
+			sorted[j] = sorted[j-1];
+		sorted[j] = module;
+	}
+	array_free(values);
+
+	Array* ranked = array_new(ELEM_TYPE_PTR);
+	for (i = 0; i < size; i++)
+		array_add(ranked, sorted[i]);
+
+	return ranked;
+}
+
 
 /* all functionality applied to module called by name */
 
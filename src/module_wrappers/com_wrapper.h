@@ -11,6 +11,8 @@
 #include <hashmap.h>
 #include <json.h>
 
+#include <sys/uio.h> /* struct iovec */
+
 /*
  * Com errors
  */
@@ -21,6 +23,18 @@
 
 #define COM_ERROR	-1
 
+/*
+ * Module locality, lower is preferred when mapping
+ */
+#ifndef COM_LOCALITY_HOST
+#define COM_LOCALITY_HOST	0
+#define COM_LOCALITY_NET	1
+#define COM_LOCALITY_BROKER	2
+#endif
+
+/* weight of the latest sample in the map cost average */
+#define COM_COST_ALPHA		0.25
+
 typedef struct _COM_MODULE{
 	char* name;
 	JSON* metadata;
@@ -37,6 +51,7 @@ typedef struct _COM_MODULE{
 	int   (*fc_connection_close)(int conn);
 	int   (*fc_send_data)(int conn, const char *msg);
 	int   (*fc_send)(int conn, const void *ptr, unsigned int size);
+	int   (*fc_sendv)(int conn, const struct iovec *iov, int iovcnt); /* optional */
 
 	int   (*fc_set_on_data)(void (*handler)(void*, int, const void*, unsigned int));
 	int   (*fc_set_on_connect)(void (*handler)(void*, int));
@@ -45,6 +60,17 @@ typedef struct _COM_MODULE{
 
 	int   (*fc_is_valid_address)(const char* full_address);
 	int   (*fc_is_bridge)(void);
+	int   (*fc_is_binary_safe)(void); /* optional, may be NULL */
+
+	/* optional fd passing, local transports only */
+	int   (*fc_send_fd)(int conn, int fd, const void *ptr, unsigned int size);
+	int   (*fc_recv_fd)(int conn);
+	int   (*fc_get_locality)(void); /* optional */
+	int   (*fc_before_exec)(void); /* optional, in the child that execs the peer */
+
+	/* ranking: locality, then the average time (ms) a core_map took; 0 is unmeasured */
+	int    locality;
+	double map_cost;
 
 } COM_MODULE;
 
@@ -62,6 +88,30 @@ COM_MODULE* com_module_new(const char* lib_filename, const char* config_json);
  */
 void com_module_free(COM_MODULE* module);
 
+/*
+ * gather send through fc_sendv;
+ * for modules without it, the buffers are joined and sent with one fc_send
+ */
+int com_module_sendv(COM_MODULE* module, int conn, const struct iovec* iov, int iovcnt);
+
+/*
+ * the same with fd passed along (fc_send_fd); fd < 0 is a plain sendv.
+ * COM_ERROR if the module cannot pass fds.
+ */
+int com_module_sendv_fd(COM_MODULE* module, int conn, int fd, const struct iovec* iov, int iovcnt);
+
+/*
+ * adds a map duration (ms) to the module's running average
+ */
+void com_module_add_cost(COM_MODULE* module, double cost_ms);
+
+/*
+ * compares two modules by locality then by map cost;
+ * unmeasured modules go before measured ones of the same locality.
+ * host modules only reach a peer on this host: the caller checks that.
+ */
+int com_module_compare(const COM_MODULE* a, const COM_MODULE* b);
+
 
 
 /* com modules' container functionality */
@@ -85,6 +135,12 @@ int com_unload_module(const char* filename);
 
 COM_MODULE* com_get_module(const char* filename);
 
+/*
+ * the loaded modules, best first (see com_module_compare)
+ * array of COM_MODULE*, to be freed with array_free
+ */
+Array* com_get_ranked_modules();
+
 
 /**
  * com modules'common functionality: handlers that will be called for each module
@@ -198,6 +198,8 @@ void rdc_lookup_handler(MESSAGE *msg)
   printf("%s\n\n", json_to_str_pretty(lookup_json));
 
   Array* lookup_array = json_get_array(lookup_json, "ep_query");
+  /* parsed once for all the endpoints */
+  Array* lookup_filters = json_filter_compile_array(lookup_array);
 
   int i, j;
   Array* keys = map_get_keys(cpts);
@@ -220,7 +222,7 @@ void rdc_lookup_handler(MESSAGE *msg)
       ep_com_modules_array = json_get_jsonarray(cpt_ep_md, "com_modules");
       ep_com_modules_json = json_new(NULL);
       json_set_array(ep_com_modules_json, "", ep_com_modules_array);
-      if(json_filter_validate_array(cpt_ep_md, lookup_array))
+      if(json_filter_match_array(cpt_ep_md, lookup_filters))
       {
         printf("--- found %s \n", json_to_str_pretty(cpt_ep_md));
         printf(">>>>>> %s\n", json_to_str_pretty(ep_com_modules_json));
@@ -249,6 +251,8 @@ void rdc_lookup_handler(MESSAGE *msg)
   json_free(result);
   array_free(keys);
   array_free(results);
+  json_filter_free_array(lookup_filters);
+  array_free(lookup_array);
 }
 
 
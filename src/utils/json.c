@@ -65,6 +65,19 @@ JSON* json_new(const char* msg)
 	return json;
 }
 
+JSON* json_new_len(const char* msg, unsigned int len)
+{
+	JSON *json = (JSON*)malloc(sizeof(JSON));
+	struct json_tokener* jtok = json_tokener_new();
+	json->elem_json = json_tokener_parse_ex(jtok, msg, len);
+	/* a number at the end waits for more digits; the nul ends it */
+	if(json->elem_json == NULL && json_tokener_get_error(jtok) == json_tokener_continue)
+		json->elem_json = json_tokener_parse_ex(jtok, "", 1);
+	json_tokener_free(jtok);
+
+	return json;
+}
+
 void json_free(JSON* json)
 {
 	if(json == NULL)
@@ -200,6 +213,34 @@ char* json_get_str(JSON* json, const char* prop)
 	return strdup_null(json_object_get_string(son_elem));
 }
 
+const char* json_peek_str(JSON* json, const char* prop)
+{
+	if(json == NULL || json->elem_json == NULL)
+		return NULL;
+
+	struct json_object *son_elem = NULL;
+	json_object_object_get_ex(json->elem_json, prop, &son_elem);
+	if(! json_object_is_type(son_elem, json_type_string))
+		return NULL;
+
+	return json_object_get_string(son_elem);
+}
+
+int json_peek_number(JSON* json, const char* prop, double* value)
+{
+	if(json == NULL || json->elem_json == NULL)
+		return 0;
+
+	struct json_object *son_elem = NULL;
+	json_object_object_get_ex(json->elem_json, prop, &son_elem);
+	if(! json_object_is_type(son_elem, json_type_int) &&
+	   ! json_object_is_type(son_elem, json_type_double))
+		return 0;
+
+	*value = json_object_get_double(son_elem);
+	return 1;
+}
+
 JSON* json_get_json(JSON* json, const char* prop)
 {
 	if(json == NULL)
@@ -430,6 +471,57 @@ int json_validate(JSON* schema, JSON* instance)
 	return JSON_OK;
 }
 
+JSON_SCHEMA* json_schema_compile(JSON* schema)
+{
+	if (!schema)
+		return NULL;
+
+	JSON_SCHEMA* compiled = (JSON_SCHEMA*)malloc(sizeof(JSON_SCHEMA));
+	compiled->schema = _json_dup(schema);
+	compiled->code = JSON_OK;
+
+	if (!compiled->schema || !compiled->schema->elem_json ||
+			!json_validate_schema(compiled->schema->elem_json))
+		compiled->code = JSON_INVALID_SCHEMA;
+
+	return compiled;
+}
+
+JSON_SCHEMA* json_schema_load_from_file(const char *filename)
+{
+	JSON* schema = json_load_from_file(filename);
+	JSON_SCHEMA* compiled = json_schema_compile(schema);
+	json_free(schema);
+
+	return compiled;
+}
+
+void json_schema_free(JSON_SCHEMA* schema)
+{
+	if (!schema)
+		return;
+
+	json_free(schema->schema);
+	free(schema);
+}
+
+int json_schema_validate(JSON_SCHEMA* schema, JSON* instance)
+{
+	if (!schema)
+		return JSON_INVALID_SCHEMA;
+	if (schema->code != JSON_OK)
+		return schema->code;
+
+	if (!instance || !instance->elem_json)
+		return JSON_INVALID_JSON;
+
+	/* the number of errors */
+	if (json_validate_instance(instance->elem_json, schema->schema->elem_json))
+		return JSON_NOT_VALID;
+
+	return JSON_OK;
+}
+
 int json_schema_validate_str(const char *schema, const char * instance)
 {
 	int return_value = JSON_OK;
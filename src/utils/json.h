@@ -32,6 +32,8 @@ typedef struct _JSON{
 
 
 JSON * json_new(const char* msg);
+/* parses msg[0..len), msg need not end there */
+JSON * json_new_len(const char* msg, unsigned int len);
 void json_free(JSON * json);
 JSON* _json_dup(JSON* json);
 
@@ -50,6 +52,11 @@ float	json_get_float (JSON* json, const char* prop);
 char* 	json_get_str   (JSON* json, const char* prop);
 JSON*	json_get_json  (JSON* json, const char* prop);
 
+/* getters without allocation; the string is owned by @json */
+const char*	json_peek_str    (JSON* json, const char* prop);
+/* 1 and @value set if @prop is a number */
+int		json_peek_number (JSON* json, const char* prop, double* value);
+
 /* returns an array with strings;
  * if no result is found, the array must be empty
  */
@@ -61,6 +68,24 @@ void json_merge(JSON* parent, JSON* val);
 /* validation */
 int json_validate(JSON* schema, JSON* json);
 
+/*
+ * A schema checked once against the meta schema, so that validating an
+ * instance only walks the instance. Keeps its own copy of the schema.
+ */
+typedef struct _JSON_SCHEMA{
+	JSON* schema;
+	int code; /* JSON_OK or why the schema cannot be used */
+} JSON_SCHEMA;
+
+/* NULL if @schema is NULL */
+JSON_SCHEMA* json_schema_compile(JSON* schema);
+/* loads and compiles a schema file; NULL if it cannot be read */
+JSON_SCHEMA* json_schema_load_from_file(const char *filename);
+void json_schema_free(JSON_SCHEMA* schema);
+
+/* json_validate on a compiled schema */
+int json_schema_validate(JSON_SCHEMA* schema, JSON* json);
+
 
 /*
  * Validates a string json message against a string schema.
@@ -0,0 +1,452 @@
+/*
+ * json_codec.c
+ */
+
+#include "json_codec.h"
+
+#include <json-c/json.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define JSON_CODEC_ANY		0 /* MessagePack */
+#define JSON_CODEC_NULL		1
+#define JSON_CODEC_BOOLEAN	2
+#define JSON_CODEC_INTEGER	3
+#define JSON_CODEC_NUMBER	4
+#define JSON_CODEC_STRING	5
+#define JSON_CODEC_ARRAY	6
+#define JSON_CODEC_OBJECT	7
+
+#define JSON_CODEC_MAX_DEPTH	64
+/* array items a peer may send; NULL items take no bytes at all */
+#define JSON_CODEC_MAX_ITEMS	(1024*1024)
+
+struct _JSON_CODEC{
+	int type;
+	/* object: properties sorted by name; array: one child, the items */
+	unsigned int count;
+	char** names;
+	struct _JSON_CODEC** children;
+};
+
+int json_codec_type(struct json_object* schema)
+{
+	struct json_object* type = NULL;
+	struct json_object* ref = NULL;
+
+	if(schema == NULL || !json_object_is_type(schema, json_type_object))
+		return JSON_CODEC_ANY;
+	if(json_object_object_get_ex(schema, "$ref", &ref))
+		return JSON_CODEC_ANY;
+	if(!json_object_object_get_ex(schema, "type", &type)
+			|| !json_object_is_type(type, json_type_string))
+		return JSON_CODEC_ANY;
+
+	const char* name = json_object_get_string(type);
+	if(!strcmp(name, "null"))		return JSON_CODEC_NULL;
+	if(!strcmp(name, "boolean"))	return JSON_CODEC_BOOLEAN;
+	if(!strcmp(name, "integer"))	return JSON_CODEC_INTEGER;
+	if(!strcmp(name, "number"))		return JSON_CODEC_NUMBER;
+	if(!strcmp(name, "string"))		return JSON_CODEC_STRING;
+	if(!strcmp(name, "array"))		return JSON_CODEC_ARRAY;
+	if(!strcmp(name, "object"))		return JSON_CODEC_OBJECT;
+
+	return JSON_CODEC_ANY;
+}
+
+int json_codec_name_cmp(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+JSON_CODEC* json_codec_node(struct json_object* schema, int depth)
+{
+	JSON_CODEC* codec = (JSON_CODEC*)malloc(sizeof(JSON_CODEC));
+	codec->type = depth < JSON_CODEC_MAX_DEPTH ? json_codec_type(schema) : JSON_CODEC_ANY;
+	codec->count = 0;
+	codec->names = NULL;
+	codec->children = NULL;
+
+	if(codec->type == JSON_CODEC_ARRAY)
+	{
+		struct json_object* items = NULL;
+		json_object_object_get_ex(schema, "items", &items);
+		codec->count = 1;
+		codec->children = (JSON_CODEC**)malloc(sizeof(JSON_CODEC*));
+		/* tuple items are not modelled */
+		codec->children[0] = json_codec_node(
+				json_object_is_type(items, json_type_object) ? items : NULL, depth+1);
+	}
+
+	if(codec->type == JSON_CODEC_OBJECT)
+	{
+		struct json_object* properties = NULL;
+		json_object_object_get_ex(schema, "properties", &properties);
+		if(properties == NULL || !json_object_is_type(properties, json_type_object))
+		{
+			/* nothing to be positional about */
+			codec->type = JSON_CODEC_ANY;
+			return codec;
+		}
+
+		unsigned int i = 0;
+		codec->count = json_object_object_length(properties);
+		codec->names = (char**)malloc(codec->count * sizeof(char*));
+		codec->children = (JSON_CODEC**)malloc(codec->count * sizeof(JSON_CODEC*));
+		json_object_object_foreach(properties, key, val)
+		{
+			(void)val;
+			codec->names[i++] = strdup(key);
+		}
+		/* the order both sides agree on */
+		qsort(codec->names, codec->count, sizeof(char*), json_codec_name_cmp);
+
+		struct json_object* prop;
+		for(i = 0; i < codec->count; i++)
+		{
+			json_object_object_get_ex(properties, codec->names[i], &prop);
+			codec->children[i] = json_codec_node(prop, depth+1);
+		}
+	}
+
+	return codec;
+}
+
+JSON_CODEC* json_codec_compile(JSON* schema)
+{
+	if(schema == NULL || schema->elem_json == NULL)
+		return NULL;
+
+	return json_codec_node(schema->elem_json, 0);
+}
+
+void json_codec_free(JSON_CODEC* codec)
+{
+	if(codec == NULL)
+		return;
+
+	unsigned int i;
+	for(i = 0; i < codec->count; i++)
+	{
+		if(codec->names)
+			free(codec->names[i]);
+		json_codec_free(codec->children[i]);
+	}
+	free(codec->names);
+	free(codec->children);
+	free(codec);
+}
+
+/* encoding */
+
+void json_codec_put(JSON_PACK* pack, const void* data, unsigned int len)
+{
+	if(pack->size + len > pack->capacity)
+	{
+		unsigned int capacity = pack->capacity ? pack->capacity : 256;
+		while(capacity < pack->size + len)
+			capacity *= 2;
+		pack->data = realloc(pack->data, capacity);
+		pack->capacity = capacity;
+	}
+	memcpy(pack->data + pack->size, data, len);
+	pack->size += len;
+}
+
+void json_codec_put_varint(JSON_PACK* pack, uint64_t value)
+{
+	unsigned char bytes[10];
+	unsigned int len = 0;
+	do
+	{
+		bytes[len] = value & 0x7F;
+		value >>= 7;
+		if(value)
+			bytes[len] |= 0x80;
+		len++;
+	} while(value);
+	json_codec_put(pack, bytes, len);
+}
+
+void json_codec_put_u64(JSON_PACK* pack, uint64_t value)
+{
+	unsigned char bytes[8];
+	int i;
+	for(i = 0; i < 8; i++)
+		bytes[i] = (value >> (8*(7-i))) & 0xFF;
+	json_codec_put(pack, bytes, 8);
+}
+
+int json_codec_encode_elem(JSON_CODEC* codec, struct json_object* elem, JSON_PACK* pack)
+{
+	unsigned int i;
+
+	switch(codec->type)
+	{
+	case JSON_CODEC_ANY:
+	{
+		JSON json = {elem};
+		json_pack(pack, &json);
+		return 0;
+	}
+	case JSON_CODEC_NULL:
+		return elem == NULL || json_object_is_type(elem, json_type_null) ? 0 : -1;
+	case JSON_CODEC_BOOLEAN:
+	{
+		if(!json_object_is_type(elem, json_type_boolean))
+			return -1;
+		unsigned char b = json_object_get_boolean(elem) ? 1 : 0;
+		json_codec_put(pack, &b, 1);
+		return 0;
+	}
+	case JSON_CODEC_INTEGER:
+		if(!json_object_is_type(elem, json_type_int))
+			return -1;
+		json_codec_put_u64(pack, (uint64_t)json_object_get_int64(elem));
+		return 0;
+	case JSON_CODEC_NUMBER:
+	{
+		/* an int keeps its text form only as MessagePack */
+		if(!json_object_is_type(elem, json_type_double))
+			return -1;
+		double d = json_object_get_double(elem);
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		json_codec_put_u64(pack, bits);
+		return 0;
+	}
+	case JSON_CODEC_STRING:
+	{
+		if(!json_object_is_type(elem, json_type_string))
+			return -1;
+		unsigned int len = json_object_get_string_len(elem);
+		json_codec_put_varint(pack, len);
+		json_codec_put(pack, json_object_get_string(elem), len);
+		return 0;
+	}
+	case JSON_CODEC_ARRAY:
+	{
+		if(!json_object_is_type(elem, json_type_array))
+			return -1;
+		unsigned int count = json_object_array_length(elem);
+		json_codec_put_varint(pack, count);
+		for(i = 0; i < count; i++)
+			if(json_codec_encode_elem(codec->children[0], json_object_array_get_idx(elem, i), pack))
+				return -1;
+		return 0;
+	}
+	case JSON_CODEC_OBJECT:
+	{
+		if(!json_object_is_type(elem, json_type_object))
+			return -1;
+
+		/* presence bitmap, then the values present */
+		unsigned int bitmap_len = (codec->count + 7) / 8;
+		unsigned int bitmap_pos = pack->size;
+		unsigned int present = 0;
+		unsigned char zero = 0;
+		for(i = 0; i < bitmap_len; i++)
+			json_codec_put(pack, &zero, 1);
+
+		struct json_object* prop;
+		for(i = 0; i < codec->count; i++)
+		{
+			if(!json_object_object_get_ex(elem, codec->names[i], &prop))
+				continue;
+			pack->data[bitmap_pos + i/8] |= 1 << (i%8);
+			present++;
+			if(json_codec_encode_elem(codec->children[i], prop, pack))
+				return -1;
+		}
+
+		/* properties the schema does not name */
+		if(present != (unsigned int)json_object_object_length(elem))
+			return -1;
+		return 0;
+	}
+	}
+
+	return -1;
+}
+
+int json_codec_encode(JSON_CODEC* codec, JSON* json, JSON_PACK* pack)
+{
+	unsigned int size = pack->size;
+	if(codec == NULL || json == NULL
+			|| json_codec_encode_elem(codec, json->elem_json, pack) != 0)
+	{
+		pack->size = size;
+		return -1;
+	}
+	return 0;
+}
+
+/* decoding */
+
+unsigned int json_codec_get_varint(const unsigned char* data, unsigned int size, uint64_t* value)
+{
+	unsigned int i;
+	*value = 0;
+	for(i = 0; i < size && i < 10; i++)
+	{
+		*value |= (uint64_t)(data[i] & 0x7F) << (7*i);
+		if(!(data[i] & 0x80))
+			return i+1;
+	}
+	return 0;
+}
+
+uint64_t json_codec_get_u64(const unsigned char* data)
+{
+	uint64_t value = 0;
+	int i;
+	for(i = 0; i < 8; i++)
+		value = (value << 8) | data[i];
+	return value;
+}
+
+/* the fewest bytes a value takes, 0 for NULL and empty objects */
+static unsigned int json_codec_min_size(JSON_CODEC* codec)
+{
+	switch(codec->type)
+	{
+	case JSON_CODEC_NULL:
+		return 0;
+	case JSON_CODEC_INTEGER:
+	case JSON_CODEC_NUMBER:
+		return 8;
+	case JSON_CODEC_OBJECT:
+		return (codec->count + 7) / 8;
+	default:
+		return 1;
+	}
+}
+
+/* bytes read, -1 on error */
+int json_codec_decode_elem(JSON_CODEC* codec,
+		const unsigned char* data, unsigned int size, struct json_object** elem)
+{
+	unsigned int used = 0, i;
+	int n;
+	uint64_t len;
+	*elem = NULL;
+
+	switch(codec->type)
+	{
+	case JSON_CODEC_ANY:
+	{
+		JSON* json = NULL;
+		used = json_unpack(data, size, &json);
+		if(used == 0)
+			return -1;
+		/* nil: no json */
+		if(json != NULL)
+		{
+			*elem = json->elem_json;
+			free(json);
+		}
+		return used;
+	}
+	case JSON_CODEC_NULL:
+		/* nothing on the wire */
+		return 0;
+	case JSON_CODEC_BOOLEAN:
+		if(size < 1)
+			return -1;
+		*elem = json_object_new_boolean(data[0] != 0);
+		return 1;
+	case JSON_CODEC_INTEGER:
+		if(size < 8)
+			return -1;
+		*elem = json_object_new_int64((int64_t)json_codec_get_u64(data));
+		return 8;
+	case JSON_CODEC_NUMBER:
+	{
+		if(size < 8)
+			return -1;
+		uint64_t bits = json_codec_get_u64(data);
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		*elem = json_object_new_double(d);
+		return 8;
+	}
+	case JSON_CODEC_STRING:
+		if(!(used = json_codec_get_varint(data, size, &len)) || len > size - used)
+			return -1;
+		*elem = json_object_new_string_len((const char*)data + used, len);
+		return used + len;
+	case JSON_CODEC_ARRAY:
+	{
+		if(!(used = json_codec_get_varint(data, size, &len)))
+			return -1;
+		/* no more items than the bytes left can hold */
+		unsigned int min = json_codec_min_size(codec->children[0]);
+		if(len > JSON_CODEC_MAX_ITEMS || (min && len > (size - used) / min))
+			return -1;
+		struct json_object* item;
+		*elem = json_object_new_array();
+		for(i = 0; i < len; i++)
+		{
+			n = json_codec_decode_elem(codec->children[0], data + used, size - used, &item);
+			if(n < 0)
+				goto error;
+			json_object_array_add(*elem, item);
+			used += n;
+		}
+		return used;
+	}
+	case JSON_CODEC_OBJECT:
+	{
+		unsigned int bitmap_len = (codec->count + 7) / 8;
+		if(size < bitmap_len)
+			return -1;
+		const unsigned char* bitmap = data;
+		used = bitmap_len;
+
+		struct json_object* prop;
+		*elem = json_object_new_object();
+		for(i = 0; i < codec->count; i++)
+		{
+			if(!(bitmap[i/8] & (1 << (i%8))))
+				continue;
+			n = json_codec_decode_elem(codec->children[i], data + used, size - used, &prop);
+			if(n < 0)
+				goto error;
+			json_object_object_add(*elem, codec->names[i], prop);
+			used += n;
+		}
+		return used;
+	}
+	}
+
+	return -1;
+
+	error:
+	{
+		json_object_put(*elem);
+		*elem = NULL;
+		return -1;
+	}
+}
+
+int json_codec_decode(JSON_CODEC* codec, const void* data, unsigned int size, JSON** json)
+{
+	*json = NULL;
+	if(codec == NULL || (data == NULL && size))
+		return -1;
+
+	struct json_object* elem = NULL;
+	int used = json_codec_decode_elem(codec, (const unsigned char*)data, size, &elem);
+	if(used < 0)
+		return -1;
+	/* null: no json, as json_unpack */
+	if(elem == NULL)
+		return used;
+
+	*json = (JSON*)malloc(sizeof(JSON));
+	(*json)->elem_json = elem;
+
+	return used;
+}
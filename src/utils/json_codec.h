@@ -0,0 +1,36 @@
+/*
+ * json_codec.h
+ */
+
+#ifndef JSON_CODEC_H_
+#define JSON_CODEC_H_
+/*
+ * Positional binary encoding derived from a json schema.
+ * Both sides compile the same schema (same hash), so property names are
+ * implied by their place: an object is a bitmap of the properties present
+ * followed by their values, in name order; integers and numbers are 8 bytes,
+ * big endian; strings and arrays are prefixed by a varint length.
+ * Parts of the schema it does not model (no or several types, $ref,
+ * tuple items...) fall back to MessagePack, see json_pack.h.
+ */
+
+#include "json.h"
+#include "json_pack.h"
+
+typedef struct _JSON_CODEC JSON_CODEC;
+
+/* NULL if @schema is NULL */
+JSON_CODEC* json_codec_compile(JSON* schema);
+void json_codec_free(JSON_CODEC* codec);
+
+/*
+ * appends the encoding of @json to @pack.
+ * -1 if @json does not follow the schema closely enough (extra
+ * properties, other types); pack->size is then left as it was.
+ */
+int json_codec_encode(JSON_CODEC* codec, JSON* json, JSON_PACK* pack);
+
+/* bytes read from data[0..size), -1 on error; *json is NULL for null */
+int json_codec_decode(JSON_CODEC* codec, const void* data, unsigned int size, JSON** json);
+
+#endif /* JSON_CODEC_H_ */
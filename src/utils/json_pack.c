@@ -0,0 +1,464 @@
+/*
+ * json_pack.c
+ */
+
+#include "json_pack.h"
+
+#include <json-c/json.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* nesting allowed when unpacking */
+#define JSON_PACK_MAX_DEPTH	64
+
+void json_pack_init(JSON_PACK* pack)
+{
+	pack->data = NULL;
+	pack->size = 0;
+	pack->capacity = 0;
+}
+
+void json_pack_free(JSON_PACK* pack)
+{
+	free(pack->data);
+	json_pack_init(pack);
+}
+
+void json_pack_reserve(JSON_PACK* pack, unsigned int size)
+{
+	if(pack->size + size <= pack->capacity)
+		return;
+
+	unsigned int capacity = pack->capacity ? pack->capacity : 256;
+	while(capacity < pack->size + size)
+		capacity *= 2;
+
+	pack->data = realloc(pack->data, capacity);
+	pack->capacity = capacity;
+}
+
+void json_pack_byte(JSON_PACK* pack, unsigned char byte)
+{
+	json_pack_reserve(pack, 1);
+	pack->data[pack->size++] = byte;
+}
+
+/* @tag then @value on @len bytes, big endian */
+void json_pack_be(JSON_PACK* pack, unsigned char tag, uint64_t value, int len)
+{
+	json_pack_reserve(pack, len + 1);
+	pack->data[pack->size++] = tag;
+	int i;
+	for(i = len-1; i >= 0; i--)
+		pack->data[pack->size++] = (value >> (8*i)) & 0xFF;
+}
+
+void json_pack_nil(JSON_PACK* pack)
+{
+	json_pack_byte(pack, 0xc0);
+}
+
+void json_pack_int(JSON_PACK* pack, long long value)
+{
+	if(value >= 0)
+	{
+		if(value < 128)
+			json_pack_byte(pack, (unsigned char)value);
+		else if(value <= 0xFF)
+			json_pack_be(pack, 0xcc, value, 1);
+		else if(value <= 0xFFFF)
+			json_pack_be(pack, 0xcd, value, 2);
+		else if(value <= 0xFFFFFFFFLL)
+			json_pack_be(pack, 0xce, value, 4);
+		else
+			json_pack_be(pack, 0xcf, value, 8);
+	}
+	else
+	{
+		if(value >= -32)
+			json_pack_byte(pack, (unsigned char)(value & 0xFF));
+		else if(value >= INT8_MIN)
+			json_pack_be(pack, 0xd0, (uint64_t)value, 1);
+		else if(value >= INT16_MIN)
+			json_pack_be(pack, 0xd1, (uint64_t)value, 2);
+		else if(value >= INT32_MIN)
+			json_pack_be(pack, 0xd2, (uint64_t)value, 4);
+		else
+			json_pack_be(pack, 0xd3, (uint64_t)value, 8);
+	}
+}
+
+void json_pack_double(JSON_PACK* pack, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	json_pack_be(pack, 0xcb, bits, 8);
+}
+
+void json_pack_str_len(JSON_PACK* pack, const char* str, unsigned int len)
+{
+	if(len < 32)
+		json_pack_byte(pack, 0xa0 | len);
+	else if(len <= 0xFF)
+		json_pack_be(pack, 0xd9, len, 1);
+	else if(len <= 0xFFFF)
+		json_pack_be(pack, 0xda, len, 2);
+	else
+		json_pack_be(pack, 0xdb, len, 4);
+
+	json_pack_reserve(pack, len);
+	memcpy(pack->data + pack->size, str, len);
+	pack->size += len;
+}
+
+void json_pack_str(JSON_PACK* pack, const char* str)
+{
+	if(str == NULL)
+		json_pack_nil(pack);
+	else
+		json_pack_str_len(pack, str, strlen(str));
+}
+
+void json_pack_array_head(JSON_PACK* pack, unsigned int count)
+{
+	if(count < 16)
+		json_pack_byte(pack, 0x90 | count);
+	else if(count <= 0xFFFF)
+		json_pack_be(pack, 0xdc, count, 2);
+	else
+		json_pack_be(pack, 0xdd, count, 4);
+}
+
+void json_pack_bin(JSON_PACK* pack, const void* data, unsigned int len)
+{
+	if(len <= 0xFF)
+		json_pack_be(pack, 0xc4, len, 1);
+	else if(len <= 0xFFFF)
+		json_pack_be(pack, 0xc5, len, 2);
+	else
+		json_pack_be(pack, 0xc6, len, 4);
+
+	json_pack_reserve(pack, len);
+	memcpy(pack->data + pack->size, data, len);
+	pack->size += len;
+}
+
+void json_pack_map_head(JSON_PACK* pack, unsigned int count)
+{
+	if(count < 16)
+		json_pack_byte(pack, 0x80 | count);
+	else if(count <= 0xFFFF)
+		json_pack_be(pack, 0xde, count, 2);
+	else
+		json_pack_be(pack, 0xdf, count, 4);
+}
+
+void json_pack_elem(JSON_PACK* pack, struct json_object* elem)
+{
+	if(elem == NULL)
+	{
+		json_pack_nil(pack);
+		return;
+	}
+
+	switch(json_object_get_type(elem))
+	{
+	case json_type_boolean:
+		json_pack_byte(pack, json_object_get_boolean(elem) ? 0xc3 : 0xc2);
+		break;
+	case json_type_int:
+		json_pack_int(pack, json_object_get_int64(elem));
+		break;
+	case json_type_double:
+		json_pack_double(pack, json_object_get_double(elem));
+		break;
+	case json_type_string:
+		json_pack_str_len(pack, json_object_get_string(elem), json_object_get_string_len(elem));
+		break;
+	case json_type_array:
+	{
+		unsigned int i, count = json_object_array_length(elem);
+		json_pack_array_head(pack, count);
+		for(i = 0; i < count; i++)
+			json_pack_elem(pack, json_object_array_get_idx(elem, i));
+		break;
+	}
+	case json_type_object:
+	{
+		json_pack_map_head(pack, json_object_object_length(elem));
+		json_object_object_foreach(elem, key, val)
+		{
+			json_pack_str(pack, key);
+			json_pack_elem(pack, val);
+		}
+		break;
+	}
+	default:
+		json_pack_nil(pack);
+	}
+}
+
+void json_pack(JSON_PACK* pack, JSON* json)
+{
+	json_pack_elem(pack, json ? json->elem_json : NULL);
+}
+
+/* reading */
+
+uint64_t json_unpack_be(const unsigned char* data, int len)
+{
+	uint64_t value = 0;
+	int i;
+	for(i = 0; i < len; i++)
+		value = (value << 8) | data[i];
+	return value;
+}
+
+/* length prefix of a str/array/map: header bytes used, 0 if @tag is not one */
+unsigned int json_unpack_len(const unsigned char* data, unsigned int size,
+		unsigned char fix, unsigned char fix_mask, unsigned char tag8,
+		unsigned char tag16, unsigned char tag32, unsigned int* len)
+{
+	if(size < 1)
+		return 0;
+
+	unsigned char tag = data[0];
+	if((tag & ~fix_mask) == fix)
+	{
+		*len = tag & fix_mask;
+		return 1;
+	}
+	if(tag8 && tag == tag8 && size >= 2)
+	{
+		*len = data[1];
+		return 2;
+	}
+	if(tag == tag16 && size >= 3)
+	{
+		*len = json_unpack_be(data+1, 2);
+		return 3;
+	}
+	if(tag == tag32 && size >= 5)
+	{
+		*len = json_unpack_be(data+1, 4);
+		return 5;
+	}
+	return 0;
+}
+
+unsigned int json_unpack_int(const void* data_, unsigned int size, long long* value)
+{
+	const unsigned char* data = (const unsigned char*)data_;
+	if(size < 1)
+		return 0;
+
+	unsigned char tag = data[0];
+	if(tag < 0x80)
+	{
+		*value = tag;
+		return 1;
+	}
+	if(tag >= 0xe0)
+	{
+		*value = (signed char)tag;
+		return 1;
+	}
+
+	int len;
+	int is_signed = 0;
+	switch(tag)
+	{
+	case 0xcc: len = 1; break;
+	case 0xcd: len = 2; break;
+	case 0xce: len = 4; break;
+	case 0xcf: len = 8; break;
+	case 0xd0: len = 1; is_signed = 1; break;
+	case 0xd1: len = 2; is_signed = 1; break;
+	case 0xd2: len = 4; is_signed = 1; break;
+	case 0xd3: len = 8; is_signed = 1; break;
+	default: return 0;
+	}
+	if(size < (unsigned int)len + 1)
+		return 0;
+
+	uint64_t raw = json_unpack_be(data+1, len);
+	if(is_signed && len < 8 && (raw >> (8*len-1)))
+		raw |= ~(uint64_t)0 << (8*len); /* sign extend */
+	*value = (long long)raw;
+
+	return len + 1;
+}
+
+unsigned int json_unpack_str(const void* data_, unsigned int size, char** str)
+{
+	const unsigned char* data = (const unsigned char*)data_;
+	if(size >= 1 && data[0] == 0xc0)
+	{
+		*str = NULL;
+		return 1;
+	}
+
+	unsigned int len;
+	unsigned int head = json_unpack_len(data, size, 0xa0, 0x1f, 0xd9, 0xda, 0xdb, &len);
+	if(head == 0 || len > size - head)
+		return 0;
+
+	*str = (char*)malloc(len + 1);
+	memcpy(*str, data + head, len);
+	(*str)[len] = '\0';
+
+	return head + len;
+}
+
+unsigned int json_unpack_array_head(const void* data, unsigned int size, unsigned int* count)
+{
+	return json_unpack_len((const unsigned char*)data, size, 0x90, 0x0f, 0, 0xdc, 0xdd, count);
+}
+
+unsigned int json_unpack_bin(const void* data_, unsigned int size, const void** bin, unsigned int* len)
+{
+	const unsigned char* data = (const unsigned char*)data_;
+	unsigned int head;
+	if(size < 1)
+		return 0;
+
+	switch(data[0])
+	{
+	case 0xc4: head = 2; break;
+	case 0xc5: head = 3; break;
+	case 0xc6: head = 5; break;
+	default: return 0;
+	}
+	if(size < head)
+		return 0;
+
+	*len = json_unpack_be(data+1, head-1);
+	if(*len > size - head)
+		return 0;
+	*bin = data + head;
+
+	return head + *len;
+}
+
+unsigned int json_unpack_elem(const unsigned char* data, unsigned int size,
+		struct json_object** elem, int depth)
+{
+	*elem = NULL;
+	if(size < 1 || depth > JSON_PACK_MAX_DEPTH)
+		return 0;
+
+	unsigned char tag = data[0];
+	unsigned int used, len, i, n;
+	long long value;
+
+	switch(tag)
+	{
+	case 0xc0:
+		return 1;
+	case 0xc2:
+	case 0xc3:
+		*elem = json_object_new_boolean(tag == 0xc3);
+		return 1;
+	case 0xca:
+	{
+		if(size < 5)
+			return 0;
+		uint32_t bits = json_unpack_be(data+1, 4);
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		*elem = json_object_new_double(f);
+		return 5;
+	}
+	case 0xcb:
+	{
+		if(size < 9)
+			return 0;
+		uint64_t bits = json_unpack_be(data+1, 8);
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		*elem = json_object_new_double(d);
+		return 9;
+	}
+	}
+
+	if((used = json_unpack_int(data, size, &value)) > 0)
+	{
+		*elem = json_object_new_int64(value);
+		return used;
+	}
+
+	if((used = json_unpack_len(data, size, 0xa0, 0x1f, 0xd9, 0xda, 0xdb, &len)) > 0)
+	{
+		if(len > size - used)
+			return 0;
+		*elem = json_object_new_string_len((const char*)data + used, len);
+		return used + len;
+	}
+
+	if((used = json_unpack_len(data, size, 0x90, 0x0f, 0, 0xdc, 0xdd, &len)) > 0)
+	{
+		struct json_object* item;
+		*elem = json_object_new_array();
+		for(i = 0; i < len; i++)
+		{
+			n = json_unpack_elem(data + used, size - used, &item, depth+1);
+			if(n == 0)
+				goto error;
+			json_object_array_add(*elem, item);
+			used += n;
+		}
+		return used;
+	}
+
+	if((used = json_unpack_len(data, size, 0x80, 0x0f, 0, 0xde, 0xdf, &len)) > 0)
+	{
+		struct json_object* item;
+		char* key;
+		*elem = json_object_new_object();
+		for(i = 0; i < len; i++)
+		{
+			n = json_unpack_str(data + used, size - used, &key);
+			if(n == 0 || key == NULL)
+				goto error;
+			used += n;
+
+			n = json_unpack_elem(data + used, size - used, &item, depth+1);
+			if(n == 0)
+			{
+				free(key);
+				goto error;
+			}
+			json_object_object_add(*elem, key, item);
+			free(key);
+			used += n;
+		}
+		return used;
+	}
+
+	/* bin, ext: not json */
+	return 0;
+
+	error:
+	{
+		json_object_put(*elem);
+		*elem = NULL;
+		return 0;
+	}
+}
+
+unsigned int json_unpack(const void* data, unsigned int size, JSON** json)
+{
+	struct json_object* elem = NULL;
+	unsigned int used = json_unpack_elem((const unsigned char*)data, size, &elem, 0);
+
+	*json = NULL;
+	if(used == 0 || elem == NULL)
+		return used;
+
+	*json = (JSON*)malloc(sizeof(JSON));
+	(*json)->elem_json = elem;
+
+	return used;
+}
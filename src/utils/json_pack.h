@@ -0,0 +1,45 @@
+/*
+ * json_pack.h
+ */
+
+#ifndef JSON_PACK_H_
+#define JSON_PACK_H_
+/*
+ * MessagePack encoding of json values, for the binary message envelope.
+ * Covers what json holds: nil, bool, int, float 64, str, array, map with
+ * str keys. Readers return the number of bytes consumed, 0 on error.
+ */
+
+#include "json.h"
+
+typedef struct _JSON_PACK{
+	unsigned char* data;
+	unsigned int size;
+	unsigned int capacity;
+} JSON_PACK;
+
+void json_pack_init(JSON_PACK* pack);
+void json_pack_free(JSON_PACK* pack);
+
+/* writers, appending to pack */
+void json_pack_nil(JSON_PACK* pack);
+void json_pack_int(JSON_PACK* pack, long long value);
+/* NULL is packed as nil */
+void json_pack_str(JSON_PACK* pack, const char* str);
+void json_pack_str_len(JSON_PACK* pack, const char* str, unsigned int len);
+void json_pack_array_head(JSON_PACK* pack, unsigned int count);
+void json_pack_bin(JSON_PACK* pack, const void* data, unsigned int len);
+/* NULL json or json without a value is packed as nil */
+void json_pack(JSON_PACK* pack, JSON* json);
+
+/* readers, from data[0..size) */
+unsigned int json_unpack_int(const void* data, unsigned int size, long long* value);
+/* *str is malloc'd, NULL for nil */
+unsigned int json_unpack_str(const void* data, unsigned int size, char** str);
+unsigned int json_unpack_array_head(const void* data, unsigned int size, unsigned int* count);
+/* *bin points into data, not copied */
+unsigned int json_unpack_bin(const void* data, unsigned int size, const void** bin, unsigned int* len);
+/* *json is NULL for nil */
+unsigned int json_unpack(const void* data, unsigned int size, JSON** json);
+
+#endif /* JSON_PACK_H_ */
@@ -0,0 +1,19 @@
+/*
+ * test.h
+ *
+ * The check macro of the unit tests: a failed condition is printed and
+ * counted, and main returns failures != 0 for ctest.
+ */
+
+#ifndef TESTS_TEST_H_
+#define TESTS_TEST_H_
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { \
+		printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; } } while(0)
+
+#endif /* TESTS_TEST_H_ */
@@ -0,0 +1,154 @@
+/*
+ * test_filter_set.c
+ *
+ * filter_set.c: one pass over a message yields the same members as
+ * matching each member's filters on its own; members added and removed.
+ */
+
+#include <filter_set.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#define MEMBERS 6
+
+/* the filters of each member, NULL for none */
+const char* member_filters[MEMBERS][3] = {
+		{NULL},
+		{"kind = 'a'", NULL},
+		{"kind = 'a'", "value > 3", NULL},
+		{"kind = 'b'", NULL},
+		{"kind != 'a'", "value < 10", NULL},
+		{"value = 5", "value != 6", NULL},
+};
+
+const char* messages[] = {
+		"{\"kind\": \"a\", \"value\": 5}",
+		"{\"kind\": \"a\", \"value\": 1}",
+		"{\"kind\": \"b\", \"value\": 5}",
+		"{\"kind\": \"c\"}",
+		"{\"value\": 6}",
+		"{}",
+		NULL};
+
+int members[MEMBERS];
+Array* filters[MEMBERS];
+
+int is_match(Array* matches, void* member)
+{
+	int i;
+	for(i = 0; i < array_size(matches); i++)
+		if(array_get(matches, i) == member)
+			return 1;
+	return 0;
+}
+
+/* what each member would get on its own */
+void check_set(FILTER_SET* set, int* in_set)
+{
+	JSON* json;
+	Array* matches;
+	int i, m;
+
+	for(i = 0; messages[i] != NULL; i++)
+	{
+		json = json_new(messages[i]);
+		matches = filter_set_match(set, json);
+
+		int count = 0;
+		for(m = 0; m < MEMBERS; m++)
+		{
+			if(!in_set[m])
+			{
+				CHECK(!is_match(matches, &members[m]));
+				continue;
+			}
+			int expected = filters[m] == NULL || json_filter_match_array(json, filters[m]);
+			CHECK(is_match(matches, &members[m]) == expected);
+			count += expected;
+		}
+		CHECK(array_size(matches) == count);
+
+		array_free(matches);
+		json_free(json);
+	}
+}
+
+void test_match()
+{
+	FILTER_SET* set = filter_set_new();
+	int in_set[MEMBERS];
+	int m;
+
+	CHECK(!filter_set_filtered(set));
+	for(m = 0; m < MEMBERS; m++)
+	{
+		filter_set_add(set, &members[m], filters[m]);
+		in_set[m] = 1;
+	}
+	CHECK(filter_set_filtered(set));
+	check_set(set, in_set);
+
+	/* the index is rebuilt without them */
+	CHECK(filter_set_remove(set, &members[2]) == 0);
+	in_set[2] = 0;
+	CHECK(filter_set_remove(set, &members[0]) == 0);
+	in_set[0] = 0;
+	CHECK(filter_set_remove(set, &members[0]) != 0);
+	check_set(set, in_set);
+
+	filter_set_add(set, &members[2], filters[2]);
+	in_set[2] = 1;
+	check_set(set, in_set);
+
+	filter_set_clear(set);
+	CHECK(!filter_set_filtered(set));
+	filter_set_free(set);
+}
+
+void test_unfiltered()
+{
+	FILTER_SET* set = filter_set_new();
+	filter_set_add(set, &members[0], NULL);
+
+	/* everything, even without a body */
+	CHECK(!filter_set_filtered(set));
+	Array* matches = filter_set_match(set, NULL);
+	CHECK(array_size(matches) == 1 && array_get(matches, 0) == &members[0]);
+	array_free(matches);
+
+	/* a filtered member needs a body */
+	filter_set_add(set, &members[1], filters[1]);
+	matches = filter_set_match(set, NULL);
+	CHECK(array_size(matches) == 1 && !is_match(matches, &members[1]));
+	array_free(matches);
+
+	filter_set_free(set);
+	CHECK(filter_set_match(NULL, NULL) == NULL);
+}
+
+int main(int argc, char* argv[])
+{
+	int m, i;
+	for(m = 0; m < MEMBERS; m++)
+	{
+		filters[m] = NULL;
+		if(member_filters[m][0] == NULL)
+			continue;
+		filters[m] = array_new(ELEM_TYPE_PTR);
+		for(i = 0; member_filters[m][i] != NULL; i++)
+			array_add(filters[m], json_filter_compile_local(member_filters[m][i]));
+	}
+
+	test_match();
+	test_unfiltered();
+
+	for(m = 0; m < MEMBERS; m++)
+		json_filter_free_array(filters[m]);
+
+	printf("test_filter_set: %d failure(s)\n", failures);
+	return failures != 0;
+}
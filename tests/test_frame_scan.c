@@ -0,0 +1,150 @@
+/*
+ * test_frame_scan.c
+ *
+ * frame_scan.c: frames cut out of a stream whatever the chunking, with
+ * braces and quotes inside strings, runs long enough for the vector
+ * kernels, the stop byte; the frame buffer.
+ */
+
+#include <frame_scan.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+#define MAX_FRAMES 64
+
+/* the end of each frame in @data, scanned @chunk bytes at a time */
+int scan_ends(const char* data, unsigned int size, unsigned int chunk,
+		unsigned int* ends)
+{
+	int state = BUFFER_FINAL, brackets = 0, count = 0;
+	unsigned int pos = 0, end, frame_start = 0;
+
+	while(pos < size)
+	{
+		end = pos + chunk < size ? pos + chunk : size;
+		while(pos < end)
+		{
+			if(frame_scan(&state, &brackets, data, &pos, end, &frame_start,
+					FRAME_SCAN_NO_STOP) != FRAME_SCAN_FRAME)
+				break;
+			if(count < MAX_FRAMES)
+				ends[count] = pos;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* the same frames whole and byte by byte, where the vector kernels are not used */
+void check_chunks(const char* data, int expected)
+{
+	unsigned int whole[MAX_FRAMES], bytes[MAX_FRAMES], chunks[MAX_FRAMES];
+	unsigned int size = strlen(data);
+
+	int count = scan_ends(data, size, size, whole);
+	CHECK(count == expected);
+	CHECK(scan_ends(data, size, 1, bytes) == count);
+	CHECK(scan_ends(data, size, 7, chunks) == count);
+	CHECK(!memcmp(whole, bytes, count * sizeof(unsigned int)));
+	CHECK(!memcmp(whole, chunks, count * sizeof(unsigned int)));
+}
+
+void test_frames()
+{
+	unsigned int ends[MAX_FRAMES];
+
+	const char* two = "{\"a\": 1}{\"b\": {\"c\": 2}}";
+	CHECK(scan_ends(two, strlen(two), strlen(two), ends) == 2);
+	CHECK(ends[0] == 8 && ends[1] == strlen(two));
+
+	check_chunks("{\"a\": \"}{\"}", 1);
+	check_chunks("{\"a\": \"\\\"}\"}", 1);
+	check_chunks("{'a': '}\\''}", 1);
+	check_chunks("  {} x {\"a\": [1, 2]}\n{", 2);
+	check_chunks("{\"a\": \"{", 0);
+}
+
+void test_long_runs()
+{
+	char data[4096];
+	unsigned int len;
+
+	/* specials at every offset of a vector block */
+	for(len = 0; len < 70; len++)
+	{
+		strcpy(data, "{\"s\": \"");
+		memset(data + 7, 'x', len);
+		strcpy(data + 7 + len, "}\\\"{\"}{\"t\": ");
+		memset(data + strlen(data), ' ', len);
+		strcat(data, "1}");
+		check_chunks(data, 2);
+	}
+
+	/* bytes above 0x7f are not specials */
+	memset(data, 0xe9, 1000);
+	strcpy(data + 1000, "{\"s\": \"");
+	memset(data + 1007, 0xe9, 1000);
+	strcpy(data + 2007, "\"}");
+	check_chunks(data, 1);
+}
+
+void test_stop()
+{
+	const char data[] = " {\"a\": \"\\n\"}\n{}";
+	int state = BUFFER_FINAL, brackets = 0;
+	unsigned int pos = 0, frame_start = 0, size = strlen(data);
+
+	CHECK(frame_scan(&state, &brackets, data, &pos, size, &frame_start, '\n') == FRAME_SCAN_FRAME);
+	CHECK(frame_start == 1 && pos == 12);
+	/* only between frames */
+	CHECK(frame_scan(&state, &brackets, data, &pos, size, &frame_start, '\n') == FRAME_SCAN_STOP);
+	CHECK(pos == 12);
+	pos++;
+	CHECK(frame_scan(&state, &brackets, data, &pos, size, &frame_start, '\n') == FRAME_SCAN_FRAME);
+	CHECK(pos == size);
+}
+
+void test_buffer()
+{
+	FRAME_BUFFER frame;
+	char big[FRAME_BUFFER_INIT_CAPACITY * 3];
+
+	frame_buffer_init(&frame);
+	frame_buffer_append(&frame, "xabcx", 1, 4);
+	frame_buffer_append(&frame, "de", 0, 2);
+	CHECK(frame.size == 5 && !strcmp(frame.data, "abcde"));
+
+	memset(big, 'a', sizeof(big));
+	frame_buffer_append(&frame, big, 0, sizeof(big));
+	CHECK(frame.size == 5 + (int)sizeof(big) && frame.data[frame.size] == '\0');
+	CHECK(frame.capacity > (unsigned int)frame.size);
+
+	/* kept for the next frame */
+	unsigned int capacity = frame.capacity;
+	frame_buffer_reset(&frame);
+	CHECK(frame.size == 0 && frame.data[0] == '\0' && frame.capacity == capacity);
+
+	/* given back after an unusually large one */
+	CHECK(frame_buffer_reserve(&frame, FRAME_BUFFER_MAX_IDLE_CAPACITY) == 0);
+	frame_buffer_reset(&frame);
+	CHECK(frame.capacity == FRAME_BUFFER_INIT_CAPACITY);
+
+	frame_buffer_free(&frame);
+	CHECK(frame.data == NULL && frame.capacity == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	test_frames();
+	test_long_runs();
+	test_stop();
+	test_buffer();
+
+	printf("test_frame_scan: %d failure(s)\n", failures);
+	return failures != 0;
+}
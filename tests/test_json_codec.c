@@ -0,0 +1,153 @@
+/*
+ * test_json_codec.c
+ *
+ * json_codec.c: schema driven round trips, nil bodies, values outside
+ * the schema and truncated or oversized input.
+ */
+
+#include <json_codec.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+const char* schema_text =
+		"{\"type\": \"object\", \"properties\": {"
+		"\"id\": {\"type\": \"integer\"},"
+		"\"name\": {\"type\": \"string\"},"
+		"\"values\": {\"type\": \"array\", \"items\": {\"type\": \"number\"}},"
+		"\"extra\": {}}}";
+
+JSON_CODEC* codec_new(const char* text)
+{
+	JSON* schema = json_new(text);
+	JSON_CODEC* codec = json_codec_compile(schema);
+	json_free(schema);
+	return codec;
+}
+
+void test_round_trip()
+{
+	JSON_CODEC* codec = codec_new(schema_text);
+	JSON* json = json_new("{\"id\": 7, \"name\": \"sensor\", \"values\": [0.5, 1.5], \"extra\": {\"any\": [1]}}");
+	JSON* back = NULL;
+	JSON_PACK pack;
+
+	json_pack_init(&pack);
+	CHECK(json_codec_encode(codec, json, &pack) == 0);
+	CHECK(json_codec_decode(codec, pack.data, pack.size, &back) == (int)pack.size);
+	CHECK(back != NULL && json_get_int(back, "id") == 7);
+	char* name = json_get_str(back, "name");
+	CHECK(name && !strcmp(name, "sensor"));
+	free(name);
+
+	json_free(back);
+	json_free(json);
+	json_pack_free(&pack);
+	json_codec_free(codec);
+}
+
+void test_outside_schema()
+{
+	JSON_CODEC* codec = codec_new(schema_text);
+	JSON_PACK pack;
+	const char* bad[] = {
+		"{\"id\": \"7\"}",
+		"{\"other\": 1}",
+		"{\"values\": [1, \"a\"]}",
+		"[1]",
+		NULL};
+	int i;
+
+	json_pack_init(&pack);
+	for(i = 0; bad[i] != NULL; i++)
+	{
+		JSON* json = json_new(bad[i]);
+		CHECK(json_codec_encode(codec, json, &pack) != 0);
+		/* nothing left behind */
+		CHECK(pack.size == 0);
+		json_free(json);
+	}
+	CHECK(json_codec_encode(codec, NULL, &pack) != 0 && pack.size == 0);
+
+	json_pack_free(&pack);
+	json_codec_free(codec);
+}
+
+void test_nil()
+{
+	JSON* back = (JSON*)1;
+	const unsigned char nil[] = {0xc0};
+
+	/* a body the schema does not model, sent as nil */
+	JSON_CODEC* any = codec_new("{}");
+	CHECK(json_codec_decode(any, nil, sizeof(nil), &back) == 1 && back == NULL);
+	json_codec_free(any);
+
+	/* a property that is null */
+	JSON_CODEC* codec = codec_new(schema_text);
+	JSON* json = json_new("{\"extra\": null}");
+	JSON_PACK pack;
+	json_pack_init(&pack);
+	CHECK(json_codec_encode(codec, json, &pack) == 0);
+	CHECK(json_codec_decode(codec, pack.data, pack.size, &back) == (int)pack.size);
+	CHECK(back != NULL);
+	json_free(back);
+	json_free(json);
+	json_pack_free(&pack);
+
+	CHECK(json_codec_decode(codec, NULL, 0, &back) < 0 && back == NULL);
+	json_codec_free(codec);
+	CHECK(json_codec_compile(NULL) == NULL);
+}
+
+void test_truncated()
+{
+	JSON_CODEC* codec = codec_new(schema_text);
+	JSON* json = json_new("{\"id\": 7, \"name\": \"sensor\", \"values\": [0.5, 1.5], \"extra\": \"x\"}");
+	JSON* back;
+	JSON_PACK pack;
+	unsigned int size;
+
+	json_pack_init(&pack);
+	CHECK(json_codec_encode(codec, json, &pack) == 0);
+	json_free(json);
+
+	for(size = 0; size < pack.size; size++)
+	{
+		back = NULL;
+		CHECK(json_codec_decode(codec, pack.data, size, &back) < 0 && back == NULL);
+	}
+	json_pack_free(&pack);
+	json_codec_free(codec);
+
+	/* an array length no bytes could hold */
+	JSON_CODEC* ints = codec_new("{\"type\": \"array\", \"items\": {\"type\": \"integer\"}}");
+	const unsigned char huge[] = {0xff, 0xff, 0xff, 0xff, 0x0f, 0x00};
+	CHECK(json_codec_decode(ints, huge, sizeof(huge), &back) < 0);
+	json_codec_free(ints);
+
+	/* null items take no bytes: bounded by count */
+	JSON_CODEC* nulls = codec_new("{\"type\": \"array\", \"items\": {\"type\": \"null\"}}");
+	CHECK(json_codec_decode(nulls, huge, sizeof(huge), &back) < 0);
+	json_codec_free(nulls);
+
+	/* a string longer than the data */
+	JSON_CODEC* str = codec_new("{\"type\": \"string\"}");
+	const unsigned char long_str[] = {0x10, 'a', 'b'};
+	CHECK(json_codec_decode(str, long_str, sizeof(long_str), &back) < 0);
+	json_codec_free(str);
+}
+
+int main(int argc, char* argv[])
+{
+	test_round_trip();
+	test_outside_schema();
+	test_nil();
+	test_truncated();
+
+	printf("test_json_codec: %d failure(s)\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * test_json_filter.c
+ *
+ * json_filter.c: filters compiled once, matched on messages the same
+ * as the text filters; malformed filters, interned property names.
+ */
+
+#include <json_filter.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+const char* message_text = "{\"value\": 5, \"name\": \"abc\", \"space\": \"a b\"}";
+
+void test_compile()
+{
+	JSON_FILTER* filter = json_filter_compile("value > 3");
+	CHECK(filter->type == JSON_FILTER_NUMBER);
+	CHECK(!strcmp(filter->prop, "value") && filter->sign == '>' && filter->number == 3);
+	json_filter_free(filter);
+
+	filter = json_filter_compile("space = 'a b'  ");
+	CHECK(filter->type == JSON_FILTER_STRING);
+	CHECK(filter->sign == '=' && !strcmp(filter->value, "a b"));
+	json_filter_free(filter);
+
+	/* never hit */
+	const char* bad[] = {"value", "value >", "value >   ", "", NULL};
+	JSON* json = json_new(message_text);
+	int i;
+	for(i = 0; bad[i] != NULL; i++)
+	{
+		filter = json_filter_compile(bad[i]);
+		CHECK(filter->type == JSON_FILTER_NONE);
+		CHECK(json_filter_match(json, filter) == 0);
+		json_filter_free(filter);
+	}
+	filter = json_filter_compile(NULL);
+	CHECK(filter->type == JSON_FILTER_NONE);
+	json_filter_free(filter);
+	json_free(json);
+}
+
+void test_match()
+{
+	const char* hold[] = {"value > 3", "value < 6", "value = 5", "value != 4",
+			"name = 'abc'", "name != 'x'", "space = 'a b'", NULL};
+	const char* fail[] = {"value < 3", "value = 4", "value != 5", "name = 'ab'",
+			"name != 'abc'", "name > 3", "value = '5'", "missing = 1",
+			"missing = 'a'", NULL};
+	JSON* json = json_new(message_text);
+	JSON_FILTER* filter;
+	int i;
+
+	for(i = 0; hold[i] != NULL; i++)
+	{
+		filter = json_filter_compile(hold[i]);
+		CHECK(json_filter_match(json, filter) == 1);
+		CHECK(json_filter_validate_one(json, (char*)hold[i]) == 1);
+		json_filter_free(filter);
+	}
+	for(i = 0; fail[i] != NULL; i++)
+	{
+		filter = json_filter_compile(fail[i]);
+		CHECK(json_filter_match(json, filter) == 0);
+		CHECK(json_filter_validate_one(json, (char*)fail[i]) == 0);
+		json_filter_free(filter);
+	}
+
+	CHECK(json_filter_match(NULL, NULL) == 0);
+	CHECK(json_filter_match(json, NULL) == 1);
+	json_free(json);
+}
+
+void test_array()
+{
+	JSON* json = json_new(message_text);
+	Array* paths = array_new(ELEM_TYPE_STR);
+	array_add(paths, "value > 3");
+	array_add(paths, "name = 'abc'");
+
+	Array* filters = json_filter_compile_array(paths);
+	CHECK(array_size(filters) == 2);
+	CHECK(json_filter_match_array(json, filters) == 1);
+	json_filter_free_array(filters);
+
+	array_add(paths, "value > 5");
+	filters = json_filter_compile_array(paths);
+	CHECK(json_filter_match_array(json, filters) == 0);
+	CHECK(json_filter_validate_array(json, paths) == 0);
+	json_filter_free_array(filters);
+
+	CHECK(json_filter_match_array(json, NULL) == 1);
+	array_free(paths);
+	json_free(json);
+}
+
+void test_local()
+{
+	JSON_FILTER* a = json_filter_compile_local("value > 3");
+	JSON_FILTER* b = json_filter_compile_local("value < 9");
+	JSON_FILTER* remote = json_filter_compile("value > 3");
+
+	/* one copy of the name for the local eps */
+	CHECK(a->prop == b->prop);
+	CHECK(remote->prop != a->prop && !strcmp(remote->prop, a->prop));
+
+	JSON* json = json_new(message_text);
+	CHECK(json_filter_match(json, a) && json_filter_match(json, b));
+	json_free(json);
+
+	json_filter_free(a);
+	json_filter_free(remote);
+	/* still there for the others */
+	CHECK(!strcmp(b->prop, "value"));
+	json_filter_free(b);
+
+	char *prop = NULL, *value = NULL;
+	CHECK(json_filter_equality("name = 'abc'", &prop, &value) == 1);
+	CHECK(prop && value && !strcmp(prop, "name") && !strcmp(value, "abc"));
+	free(prop);
+	free(value);
+	CHECK(json_filter_equality("value = 5", &prop, &value) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	test_compile();
+	test_match();
+	test_array();
+	test_local();
+
+	printf("test_json_filter: %d failure(s)\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * test_json_pack.c
+ *
+ * json_pack.c: MessagePack round trips, nil, duplicate map keys and
+ * truncated input, which must be refused rather than read past.
+ */
+
+#include <json_pack.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+void test_round_trip()
+{
+	JSON_PACK pack;
+	JSON* json = json_new("{\"i\": -300, \"s\": \"text\", \"a\": [1, true, 2.5], \"o\": {\"n\": null}}");
+	JSON* back = NULL;
+
+	json_pack_init(&pack);
+	json_pack(&pack, json);
+	CHECK(json_unpack(pack.data, pack.size, &back) == pack.size);
+	CHECK(back != NULL);
+	CHECK(json_get_int(back, "i") == -300);
+	char* s = json_get_str(back, "s");
+	CHECK(s && !strcmp(s, "text"));
+	free(s);
+	JSON* o = json_get_json(back, "o");
+	CHECK(o != NULL);
+	json_free(o);
+
+	json_free(back);
+	json_pack_free(&pack);
+	json_free(json);
+}
+
+void test_scalars()
+{
+	JSON_PACK pack;
+	long long value;
+	char* str;
+	unsigned int count;
+
+	json_pack_init(&pack);
+	json_pack_int(&pack, 1LL << 40);
+	json_pack_int(&pack, -1);
+	json_pack_str(&pack, "abc");
+	json_pack_str(&pack, NULL);
+	json_pack_array_head(&pack, 20);
+
+	unsigned int pos = 0, used;
+	CHECK((used = json_unpack_int(pack.data + pos, pack.size - pos, &value)) > 0
+			&& value == 1LL << 40);
+	pos += used;
+	CHECK((used = json_unpack_int(pack.data + pos, pack.size - pos, &value)) > 0
+			&& value == -1);
+	pos += used;
+	CHECK((used = json_unpack_str(pack.data + pos, pack.size - pos, &str)) > 0
+			&& str && !strcmp(str, "abc"));
+	free(str);
+	pos += used;
+	/* nil reads as a NULL string */
+	CHECK((used = json_unpack_str(pack.data + pos, pack.size - pos, &str)) == 1
+			&& str == NULL);
+	pos += used;
+	CHECK((used = json_unpack_array_head(pack.data + pos, pack.size - pos, &count)) > 0
+			&& count == 20);
+	pos += used;
+	CHECK(pos == pack.size);
+
+	json_pack_free(&pack);
+}
+
+void test_nil()
+{
+	JSON_PACK pack;
+	JSON* json = (JSON*)1;
+
+	json_pack_init(&pack);
+	json_pack(&pack, NULL);
+	CHECK(pack.size == 1 && pack.data[0] == 0xc0);
+	CHECK(json_unpack(pack.data, pack.size, &json) == 1 && json == NULL);
+	json_pack_free(&pack);
+}
+
+void test_duplicate_keys()
+{
+	/* {"a": 1, "a": 2}: the last one wins, as json-c does with text */
+	const unsigned char data[] = {0x82, 0xa1, 'a', 0x01, 0xa1, 'a', 0x02};
+	JSON* json = NULL;
+
+	CHECK(json_unpack(data, sizeof(data), &json) == sizeof(data));
+	CHECK(json != NULL && json_get_int(json, "a") == 2);
+	json_free(json);
+}
+
+void test_truncated()
+{
+	JSON_PACK pack;
+	JSON* json = json_new("{\"key\": \"a longer string value\", \"list\": [1, 2, 3, 70000]}");
+	JSON* back;
+	unsigned int size;
+
+	json_pack_init(&pack);
+	json_pack(&pack, json);
+	json_free(json);
+
+	/* every prefix is refused */
+	for(size = 0; size < pack.size; size++)
+	{
+		back = NULL;
+		CHECK(json_unpack(pack.data, size, &back) == 0 && back == NULL);
+	}
+	json_pack_free(&pack);
+
+	/* lengths beyond the data */
+	const unsigned char str8[] = {0xd9, 0x10, 'a', 'b'};
+	const unsigned char str32[] = {0xdb, 0xff, 0xff, 0xff, 0xff, 'a'};
+	const unsigned char array32[] = {0xdd, 0xff, 0xff, 0xff, 0xff, 0x01};
+	const unsigned char map16[] = {0xde, 0xff, 0xff, 0xa1, 'a', 0x01};
+	const unsigned char int64[] = {0xcf, 0x00, 0x01};
+	const unsigned char bin8[] = {0xc4, 0x05, 0x00};
+	char* str;
+	const void* bin;
+	unsigned int len;
+	long long value;
+
+	CHECK(json_unpack(str8, sizeof(str8), &back) == 0);
+	CHECK(json_unpack_str(str32, sizeof(str32), &str) == 0);
+	CHECK(json_unpack(array32, sizeof(array32), &back) == 0);
+	CHECK(json_unpack(map16, sizeof(map16), &back) == 0);
+	CHECK(json_unpack_int(int64, sizeof(int64), &value) == 0);
+	CHECK(json_unpack_bin(bin8, sizeof(bin8), &bin, &len) == 0);
+
+	/* a map key must be a string */
+	const unsigned char int_key[] = {0x81, 0x01, 0x02};
+	CHECK(json_unpack(int_key, sizeof(int_key), &back) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	test_round_trip();
+	test_scalars();
+	test_nil();
+	test_duplicate_keys();
+	test_truncated();
+
+	printf("test_json_pack: %d failure(s)\n", failures);
+	return failures != 0;
+}
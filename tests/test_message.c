@@ -0,0 +1,117 @@
+/*
+ * test_message.c
+ *
+ * message.c: message_parse_lazy on the text the cores write and on
+ * texts it must hand to json-c or refuse; the binary envelope.
+ */
+
+#include <message.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+MESSAGE* parse(const char* text)
+{
+	return message_parse_lazy(text, strlen(text));
+}
+
+void test_lazy()
+{
+	MESSAGE* msg = parse("{\"status\": 9, \"msg_id\": \"m1\", \"msg_json\": {\"value\": 5}}");
+	CHECK(msg != NULL);
+	CHECK(msg->status == MSG_MSG);
+	CHECK(msg->msg_id && !strcmp(msg->msg_id, "m1"));
+	CHECK(msg->lazy);
+	CHECK(json_get_int(message_json(msg), "value") == 5);
+	message_free(msg);
+
+	/* what message_to_str writes reads back the same */
+	JSON* body = json_new("{\"value\": 6}");
+	MESSAGE* out = message_new_id_json("m2", body, MSG_REQ);
+	char* text = message_to_str(out);
+	msg = parse(text);
+	CHECK(msg != NULL && msg->status == MSG_REQ);
+	CHECK(msg && msg->msg_id && !strcmp(msg->msg_id, "m2"));
+	CHECK(msg && json_get_int(message_json(msg), "value") == 6);
+	message_free(msg);
+	free(text);
+	message_free(out);
+	json_free(body);
+
+	/* header values json-c reads for us */
+	msg = parse("{\"status\": 9, \"msg_id\": \"\\u00e9\", \"msg_json\": {}}");
+	CHECK(msg != NULL && msg->status == MSG_MSG && msg->msg_id != NULL);
+	message_free(msg);
+}
+
+void test_duplicate_keys()
+{
+	/* the last one wins, as with json-c */
+	MESSAGE* msg = parse("{\"status\": 9, \"status\": 10, \"msg_json\": {}}");
+	CHECK(msg != NULL && msg->status == MSG_REQ);
+	message_free(msg);
+
+	msg = parse("{\"status\": 9, \"msg_json\": {\"a\": 1}, \"msg_json\": {\"a\": 2}}");
+	CHECK(msg != NULL);
+	CHECK(msg && json_get_int(message_json(msg), "a") == 2);
+	message_free(msg);
+}
+
+void test_refused()
+{
+	const char* bad[] = {
+		"",
+		"{\"status\": 9, \"msg_json\": {}}x",
+		"{\"status\": 9, \"msg_json\": {}}}",
+		"{\"status\": 9, \"msg_json\": {}}{\"status\": 10}",
+		"{\"status\": 9, \"msg_json\": {\"a\": [1}}",
+		"{\"status\": 9, \"msg_json\": {\"a\": \"}",
+		NULL};
+	int i;
+	for(i = 0; bad[i] != NULL; i++)
+		CHECK(parse(bad[i]) == NULL);
+	CHECK(message_parse_lazy(NULL, 0) == NULL);
+}
+
+void test_bin()
+{
+	JSON* body = json_new("{\"value\": 7}");
+	MESSAGE* out = message_new_id_json("m3", body, MSG_MSG);
+	unsigned int size;
+	void* data = message_to_bin(out, &size);
+
+	MESSAGE* msg = message_parse_bin(data, size, NULL, NULL);
+	CHECK(msg != NULL && msg->status == MSG_MSG);
+	CHECK(msg && json_get_int(message_json(msg), "value") == 7);
+	message_free(msg);
+
+	/* every prefix is refused */
+	unsigned int len;
+	for(len = 0; len < size; len++)
+		CHECK(message_parse_bin(data, len, NULL, NULL) == NULL);
+
+	free(data);
+	message_free(out);
+	json_free(body);
+
+	/* [status, msg_id, ep_id, conn, module, nil]: no body */
+	const unsigned char nil_body[] = {0x96, 0x09, 0xa2, 'm', '4', 0xc0, 0x00, 0xc0, 0xc0};
+	msg = message_parse_bin(nil_body, sizeof(nil_body), NULL, NULL);
+	CHECK(msg != NULL && msg->status == MSG_MSG);
+	CHECK(msg && message_json(msg) == NULL);
+	message_free(msg);
+}
+
+int main(int argc, char* argv[])
+{
+	test_lazy();
+	test_duplicate_keys();
+	test_refused();
+	test_bin();
+
+	printf("test_message: %d failure(s)\n", failures);
+	return failures != 0;
+}
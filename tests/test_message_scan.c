@@ -0,0 +1,149 @@
+/*
+ * test_message_scan.c
+ *
+ * message_scan.c: the header read without json-c, on the layout the
+ * cores write and on the texts that must fall back or be refused.
+ */
+
+#include <message_scan.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+/* the value of @field in @data is exactly @expected */
+int field_is(const char* data, MESSAGE_SCAN* scan, int field, const char* expected)
+{
+	return scan->len[field] == strlen(expected)
+			&& !memcmp(data + scan->start[field], expected, scan->len[field]);
+}
+
+int scan_head(const char* data, MESSAGE_SCAN* scan)
+{
+	return message_scan_head(data, strlen(data), scan);
+}
+
+int scan_any(const char* data, MESSAGE_SCAN* scan)
+{
+	return message_scan(data, strlen(data), scan);
+}
+
+void test_head()
+{
+	MESSAGE_SCAN scan;
+	long long status;
+	char* msg_id;
+	const char* data = "{\"status\": 9, \"msg_id\": \"a\\\"b\", \"msg_json\": {\"x\": \"}\"}}";
+
+	CHECK(scan_head(data, &scan) == 0);
+	CHECK(message_scan_int(data, &scan, MESSAGE_SCAN_STATUS, &status) == 0 && status == 9);
+	CHECK(message_scan_str(data, &scan, MESSAGE_SCAN_MSG_ID, &msg_id) == 0
+			&& msg_id && !strcmp(msg_id, "a\"b"));
+	free(msg_id);
+	CHECK(field_is(data, &scan, MESSAGE_SCAN_MSG_JSON, "{\"x\": \"}\"}"));
+	CHECK(scan.len[MESSAGE_SCAN_EP_ID] == 0);
+
+	/* other orders are for message_scan */
+	data = "{\"msg_json\": {}, \"status\": 2}";
+	CHECK(scan_head(data, &scan) != 0);
+	CHECK(scan_any(data, &scan) == 0);
+	CHECK(message_scan_int(data, &scan, MESSAGE_SCAN_STATUS, &status) == 0 && status == 2);
+
+	/* not read here: json-c does it */
+	data = "{\"status\": 1.0, \"msg_id\": \"\\u00e9\", \"msg_json\": {}}";
+	CHECK(scan_head(data, &scan) == 0);
+	CHECK(message_scan_int(data, &scan, MESSAGE_SCAN_STATUS, &status) != 0);
+	CHECK(message_scan_str(data, &scan, MESSAGE_SCAN_MSG_ID, &msg_id) != 0);
+}
+
+void test_duplicate_keys()
+{
+	MESSAGE_SCAN scan;
+	long long status;
+
+	/* the last one wins, as with json-c */
+	const char* data = "{\"status\": 1, \"status\": 2, \"msg_json\": {}}";
+	CHECK(scan_head(data, &scan) != 0);
+	CHECK(scan_any(data, &scan) == 0);
+	CHECK(message_scan_int(data, &scan, MESSAGE_SCAN_STATUS, &status) == 0 && status == 2);
+
+	data = "{\"status\": 1, \"msg_json\": {\"a\": 1}, \"msg_json\": {\"b\": 2}}";
+	CHECK(scan_head(data, &scan) != 0);
+	CHECK(scan_any(data, &scan) == 0);
+	CHECK(field_is(data, &scan, MESSAGE_SCAN_MSG_JSON, "{\"b\": 2}"));
+}
+
+void test_trailing()
+{
+	MESSAGE_SCAN scan;
+
+	CHECK(scan_head("{\"status\": 1, \"msg_json\": {}} \n", &scan) == 0);
+	CHECK(scan_any("{\"status\": 1} \n", &scan) == 0);
+
+	const char* bad[] = {
+		"{\"status\": 1, \"msg_json\": {}}x",
+		"{\"status\": 1, \"msg_json\": {}}}",
+		"{\"status\": 1, \"msg_json\": {}}{}",
+		"{\"status\": 1, \"msg_json\": {} 1}",
+		"{\"status\": 1}, 2",
+		"{} {}",
+		NULL};
+	int i;
+	for(i = 0; bad[i] != NULL; i++)
+	{
+		CHECK(scan_head(bad[i], &scan) != 0);
+		CHECK(scan_any(bad[i], &scan) != 0);
+	}
+}
+
+void test_malformed()
+{
+	MESSAGE_SCAN scan;
+	const char* bad[] = {
+		"",
+		"[]",
+		"{\"status\": 1",
+		"{\"status\": }",
+		"{\"msg_json\": {\"a\": [1, 2}]}",
+		"{\"msg_json\": {\"a\": \"}\"}",
+		"{status: 1}",
+		NULL};
+	int i;
+	for(i = 0; bad[i] != NULL; i++)
+	{
+		CHECK(scan_head(bad[i], &scan) != 0);
+		CHECK(scan_any(bad[i], &scan) != 0);
+	}
+}
+
+void test_value()
+{
+	const char* good[] = {"{}", "[]", "{\"a\": [1, {\"b\": \"]\"}]}", "[\"\\\"\", null]", NULL};
+	const char* bad[] = {"", "1", "\"a\"", "{\"a\": 1} x", "{\"a\": 1}}", "[1, 2}", "{\"a\": [}", NULL};
+	int i;
+
+	for(i = 0; good[i] != NULL; i++)
+		CHECK(message_scan_value(good[i], strlen(good[i])) == 0);
+	for(i = 0; bad[i] != NULL; i++)
+		CHECK(message_scan_value(bad[i], strlen(bad[i])) != 0);
+
+	/* nesting beyond what is scanned */
+	char deep[600];
+	memset(deep, '[', 300);
+	memset(deep + 300, ']', 300);
+	CHECK(message_scan_value(deep, 600) != 0);
+}
+
+int main(int argc, char* argv[])
+{
+	test_head();
+	test_duplicate_keys();
+	test_trailing();
+	test_malformed();
+	test_value();
+
+	printf("test_message_scan: %d failure(s)\n", failures);
+	return failures != 0;
+}